@@ -0,0 +1,118 @@
+// Compares the JSPI build (build/jspi) with the release build (build/simd),
+// same flags but ASYNCIFY instead of JSPI: binary size, startup and call
+// overhead (main thread calls, calls proxied to the helper thread and a full
+// scan), using SANE's test backend. Requires both builds
+// (./build.sh --release and ./build.sh --jspi) and a Node.js with JSPI, the
+// script restarts itself with --experimental-wasm-jspi if needed.
+//
+// usage: node bench/jspi.js [--calls N] [--json FILE]
+//   --calls N    calls per measurement (default 2000)
+//   --json FILE  also write the results as JSON
+
+const fs = require('fs');
+const path = require('path');
+const { spawnSync } = require('child_process');
+const jspiSupported = require('../lib/jspi.js');
+
+if (!jspiSupported()) {
+    if (process.execArgv.includes('--experimental-wasm-jspi')) {
+        console.error('This Node.js version does not support JSPI.');
+        process.exit(1);
+    }
+    const { status } = spawnSync(process.execPath, ['--experimental-wasm-jspi', ...process.execArgv, __filename, ...process.argv.slice(2)], { stdio: 'inherit' });
+    process.exit(status === null ? 1 : status);
+}
+
+const args = process.argv.slice(2);
+const argValue = (name, def) => {
+    const i = args.indexOf(name);
+    return i === -1 ? def : args[i + 1];
+};
+const calls = parseInt(argValue('--calls'), 10) || 2000;
+const jsonFile = argValue('--json', null);
+
+const builds = {
+    asyncify: path.join(__dirname, '../build/simd'),
+    jspi: path.join(__dirname, '../build/jspi'),
+};
+
+const round = (n, d = 1) => Math.round(n * 10 ** d) / 10 ** d;
+const kib = (file) => round(fs.statSync(file).size / 1024);
+
+async function time(n, fn) {
+    const t0 = performance.now();
+    for (let i = 0; i < n; i++) {
+        await fn();
+    }
+    return (performance.now() - t0) / n;
+}
+
+async function measure(dir) {
+    const factory = require(path.join(dir, 'libsane.js'));
+    const lib = await factory({ sane: { debugTestDevices: 1 } });
+    lib.sane_init();
+    await lib.sane_get_devices();
+    await lib.sane_open('test:0');
+
+    const result = {
+        wasm_kib: kib(path.join(dir, 'libsane.wasm')),
+        js_kib: kib(path.join(dir, 'libsane.js')),
+        startup_ms: round(lib.sane_startup_timing().total_ms),
+        // main thread, no suspending
+        get_state_us: round(await time(calls, () => lib.sane_get_state()) * 1000),
+        // proxied to the helper thread
+        get_option_us: round(await time(calls, () => lib.sane_control_option_get_value(0)) * 1000),
+    };
+
+    // full scan, 300dpi color (test backend, 'Color pattern')
+    const set = async (name, value) => {
+        const { options } = await lib.sane_get_all_options();
+        const opt = options.find(o => o.descriptor.name === name);
+        await lib.sane_control_option_set_value(opt.index, value);
+    };
+    await set('mode', 'Color');
+    await set('resolution', 300);
+    await set('test-picture', 'Color pattern');
+    const t0 = performance.now();
+    await lib.sane_start();
+    let reads = 0;
+    for (;;) {
+        const { status } = await lib.sane_fast_read_blocking();
+        reads++;
+        if (status !== lib.SANE_STATUS.GOOD) {
+            break;
+        }
+    }
+    await lib.sane_cancel();
+    result.scan_ms = round(performance.now() - t0);
+    result.read_us = round((performance.now() - t0) / reads * 1000);
+
+    await lib.sane_close();
+    await lib.sane_exit();
+    return result;
+}
+
+(async () => {
+    const results = {};
+    for (const [name, dir] of Object.entries(builds)) {
+        if (!fs.existsSync(path.join(dir, 'libsane.js'))) {
+            throw new Error(`Build '${name}' not found (${dir}).`);
+        }
+        results[name] = await measure(dir);
+        console.error(`${name}: done`);
+    }
+    console.table(results);
+
+    if (jsonFile) {
+        fs.writeFileSync(jsonFile, JSON.stringify({
+            node: process.version,
+            calls,
+            date: new Date().toISOString(),
+            results,
+        }, null, 2) + '\n');
+    }
+    process.exit(0);
+})().catch(e => {
+    console.error(e);
+    process.exit(1);
+});
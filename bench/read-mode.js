@@ -0,0 +1,94 @@
+// Compares the time-to-last-byte of the ScanDataReader read modes, 'blocking'
+// (sane_read_blocking) and 'poll' (sane_read + setTimeout), using SANE's test
+// backend. Requires a full build (npm run build).
+//
+// usage: node bench/read-mode.js [runs]
+
+const { libsane, ScanDataReader, ScanOptions, SANEStatus } = require('..');
+
+const runs = parseInt(process.argv[2], 10) || 3;
+
+const scenarios = [
+    {
+        name: 'gray 8-bit 150dpi',
+        options: { mode: 'Gray', depth: 8, resolution: 150 },
+    },
+    {
+        name: 'color 8-bit 150dpi, 64KiB reads',
+        options: { mode: 'Color', depth: 8, resolution: 150, 'read-limit': true, 'read-limit-size': 64 * 1024 },
+    },
+    {
+        name: 'color 8-bit 75dpi, 5ms device delay',
+        options: { mode: 'Color', depth: 8, resolution: 75, 'read-delay': true, 'read-delay-duration': 5000 },
+    },
+];
+
+async function setOptions(lib, values) {
+    let opts = await ScanOptions.get(lib);
+    for (const [name, value] of Object.entries(values)) {
+        const opt = opts.options.find(o => o.descriptor.name === name);
+        if (!opt) {
+            throw new Error(`Option '${name}' not found.`);
+        }
+        const { status, updated } = await opts.setValue(opt.index, value);
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[status]} setting option '${name}'.`);
+        }
+        opts = updated;
+    }
+}
+
+async function scan(lib, readMode) {
+    const reader = new ScanDataReader(lib, { readMode });
+    let bytes = 0;
+    let reads = 0;
+    reader.on('data', (parameters, data) => {
+        bytes += data.length;
+        reads++;
+    });
+    const t0 = performance.now();
+    const { status, promise } = await reader.start();
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_start().`);
+    }
+    await promise;
+    return { ms: performance.now() - t0, bytes, reads };
+}
+
+(async () => {
+    const lib = await libsane({ sane: { debugTestDevices: 1 } });
+    lib.sane_init();
+    await lib.sane_get_devices();
+    const { status } = await lib.sane_open('test:0');
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_open().`);
+    }
+
+    const results = [];
+    for (const { name, options } of scenarios) {
+        await setOptions(lib, options);
+        for (const readMode of ['blocking', 'poll']) {
+            const samples = [];
+            for (let i = 0; i < runs; i++) {
+                samples.push(await scan(lib, readMode));
+            }
+            const ms = samples.map(s => s.ms).sort((a, b) => a - b);
+            results.push({
+                scenario: name,
+                readMode,
+                'bytes': samples[0].bytes,
+                'reads': samples[0].reads,
+                'ttlb median (ms)': Math.round(ms[Math.floor(ms.length / 2)]),
+                'ttlb min (ms)': Math.round(ms[0]),
+            });
+        }
+    }
+    console.table(results);
+
+    await lib.sane_close();
+    await lib.sane_exit();
+    process.exit(0);
+})().catch(e => {
+    console.error(e);
+    process.exit(1);
+});
@@ -0,0 +1,165 @@
+// Scan throughput of ScanDataReader and ScanImageReader at several
+// resolutions, modes and depths, using SANE's test backend with its largest
+// scan area. Reports MB/s, time-to-first-line, total latency and the peak
+// WASM/JS memory. Requires a full build (npm run build).
+//
+// usage: node bench/throughput.js [--runs N] [--quick] [--json FILE]
+//   --runs N     runs per scenario (default 3), the median is reported
+//   --quick      only the smaller resolutions
+//   --json FILE  also write the results as JSON (for regression tracking)
+
+const fs = require('fs');
+const { libsane, ScanDataReader, ScanImageReader, ScanOptions, SANEStatus } = require('..');
+
+const args = process.argv.slice(2);
+const argValue = (name, def) => {
+    const i = args.indexOf(name);
+    return i === -1 ? def : args[i + 1];
+};
+const runs = parseInt(argValue('--runs'), 10) || 3;
+const quick = args.includes('--quick');
+const jsonFile = argValue('--json', null);
+
+// test backend: 'Color pattern' picture, full scan area (200x200mm)
+const base = { 'test-picture': 'Color pattern', 'tl-x': 0, 'tl-y': 0, 'br-x': 200, 'br-y': 200 };
+const modes = [
+    { mode: 'Lineart' },
+    { mode: 'Gray', depth: 8 },
+    { mode: 'Color', depth: 8 },
+    { mode: 'Color', depth: 16 },
+];
+const resolutions = quick ? [75, 150] : [75, 150, 300, 600];
+
+const scenarios = [];
+for (const resolution of resolutions) {
+    for (const m of modes) {
+        if (resolution === 600 && m.depth === 16) {
+            continue; // ~130MiB per scan, not worth it
+        }
+        scenarios.push({
+            name: `${m.mode.toLowerCase()}${m.depth ? ` ${m.depth}-bit` : ''} ${resolution}dpi`,
+            options: { ...base, ...m, resolution },
+        });
+    }
+}
+
+const readers = {
+    data: ScanDataReader,
+    image: ScanImageReader,
+};
+
+async function setOptions(lib, values) {
+    let opts = await ScanOptions.get(lib);
+    for (const [name, value] of Object.entries(values)) {
+        const opt = opts.options.find(o => o.descriptor.name === name);
+        if (!opt) {
+            throw new Error(`Option '${name}' not found.`);
+        }
+        if (opt.descriptor.cap.INACTIVE) {
+            continue; // e.g. depth on lineart
+        }
+        const { status, updated } = await opts.setValue(opt.index, value);
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[status]} setting option '${name}'.`);
+        }
+        opts = updated;
+    }
+}
+
+function jsHeap() {
+    const { heapUsed, arrayBuffers } = process.memoryUsage();
+    return heapUsed + arrayBuffers;
+}
+
+async function scan(lib, Reader) {
+    global.gc && global.gc();
+    const reader = new Reader(lib);
+    const heap = { wasm: lib.HEAPU8.buffer.byteLength, js: jsHeap() };
+    const sample = () => {
+        heap.wasm = Math.max(heap.wasm, lib.HEAPU8.buffer.byteLength);
+        heap.js = Math.max(heap.js, jsHeap());
+    };
+    let bytes = 0;
+    let firstLine = null;
+    const t0 = performance.now();
+    reader.on('data', (parameters, data) => {
+        bytes += data.length;
+        if (firstLine === null && Reader === ScanDataReader && bytes >= parameters.bytes_per_line) {
+            firstLine = performance.now() - t0;
+        }
+        sample();
+    });
+    if (Reader === ScanImageReader) {
+        reader.on('line', () => {
+            if (firstLine === null) {
+                firstLine = performance.now() - t0;
+            }
+        });
+        reader.on('image', sample);
+    }
+    const { status, promise } = await reader.start();
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_start().`);
+    }
+    await promise;
+    const ms = performance.now() - t0;
+    return { ms, bytes, firstLine, wasmHeap: heap.wasm, jsHeap: heap.js };
+}
+
+const median = (values) => {
+    const v = [...values].sort((a, b) => a - b);
+    return v[Math.floor(v.length / 2)];
+};
+const mib = (n) => n / (1024 * 1024);
+const round = (n, d = 1) => Math.round(n * 10 ** d) / 10 ** d;
+
+(async () => {
+    const lib = await libsane({ sane: { debugTestDevices: 1 } });
+    lib.sane_init();
+    await lib.sane_get_devices();
+    const { status } = await lib.sane_open('test:0');
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_open().`);
+    }
+
+    const results = [];
+    for (const { name, options } of scenarios) {
+        await setOptions(lib, options);
+        for (const [reader, Reader] of Object.entries(readers)) {
+            const samples = [];
+            for (let i = 0; i < runs; i++) {
+                samples.push(await scan(lib, Reader));
+            }
+            const ms = median(samples.map(s => s.ms));
+            results.push({
+                scenario: name,
+                reader,
+                bytes: samples[0].bytes,
+                mb_s: round(mib(samples[0].bytes) / (ms / 1000)),
+                first_line_ms: round(median(samples.map(s => s.firstLine))),
+                total_ms: round(ms),
+                wasm_heap_peak_mb: round(mib(Math.max(...samples.map(s => s.wasmHeap)))),
+                js_heap_peak_mb: round(mib(Math.max(...samples.map(s => s.jsHeap)))),
+            });
+            console.error(`${name} (${reader}): ${results[results.length - 1].mb_s} MB/s`);
+        }
+    }
+    console.table(results);
+
+    if (jsonFile) {
+        fs.writeFileSync(jsonFile, JSON.stringify({
+            version: lib.SANE_WASM_VERSION,
+            node: process.version,
+            runs,
+            date: new Date().toISOString(),
+            results,
+        }, null, 2) + '\n');
+    }
+
+    await lib.sane_close();
+    await lib.sane_exit();
+    process.exit(0);
+})().catch(e => {
+    console.error(e);
+    process.exit(1);
+});
@@ -0,0 +1,100 @@
+// Records a scan from a real USB device (node-usb, see post.js) as a USB
+// trace for bench/usb-replay.js. The trace has the scan options and a hash
+// of the scanned data, the replay does the same scan and checks it.
+// Requires a full build (npm run build) and the usb package.
+//
+// usage: node bench/usb-record.js OUTPUT [--device NAME] [OPTION=VALUE...]
+//   OUTPUT         trace file (JSON, gzipped if it ends with .gz)
+//   --device NAME  SANE device name (default: the first device found)
+//   OPTION=VALUE   SANE options to set before scanning, in order (e.g.
+//                  mode=Color resolution=150), numbers are parsed
+
+const fs = require('fs');
+const zlib = require('zlib');
+const crypto = require('crypto');
+const { libsane, ScanDataReader, ScanOptions, SANEStatus, USBRecorder } = require('..');
+
+const args = process.argv.slice(2);
+const argValue = (name, def) => {
+    const i = args.indexOf(name);
+    return i === -1 ? def : args.splice(i, 2)[1];
+};
+const device = argValue('--device', null);
+const output = args.shift();
+if (!output) {
+    console.error("usage: node bench/usb-record.js OUTPUT [--device NAME] [OPTION=VALUE...]");
+    process.exit(1);
+}
+const options = args.map(arg => {
+    const [name, ...rest] = arg.split('=');
+    const value = rest.join('=');
+    return [name, value !== '' && !isNaN(value) ? Number(value) : value];
+});
+
+async function setOptions(lib, values) {
+    let opts = await ScanOptions.get(lib);
+    for (const [name, value] of values) {
+        const opt = opts.options.find(o => o.descriptor.name === name);
+        if (!opt) {
+            throw new Error(`Option '${name}' not found.`);
+        }
+        const { status, updated } = await opts.setValue(opt.index, value);
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[status]} setting option '${name}'.`);
+        }
+        opts = updated;
+    }
+}
+
+(async () => {
+    const recorder = new USBRecorder(require('usb').webusb);
+    const lib = await libsane({ sane: { usb: recorder } });
+    await lib.sane_init();
+    const { devices } = await lib.sane_get_devices();
+    const name = device || (devices[0] && devices[0].name);
+    if (!name) {
+        throw new Error("No devices found.");
+    }
+    const { status } = await lib.sane_open(name);
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_open().`);
+    }
+    await setOptions(lib, options);
+
+    const reader = new ScanDataReader(lib);
+    const hash = crypto.createHash('sha256');
+    let bytes = 0;
+    let parameters = null;
+    reader.on('data', (p, data) => {
+        parameters = p;
+        hash.update(data);
+        bytes += data.length;
+    });
+    const t0 = performance.now();
+    const start = await reader.start();
+    if (start.status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[start.status]} during sane_start().`);
+    }
+    await start.promise;
+    const ms = performance.now() - t0;
+    await lib.sane_close();
+    await lib.sane_exit();
+
+    const trace = recorder.trace({
+        version: lib.SANE_WASM_VERSION,
+        date: new Date().toISOString(),
+        device: name,
+        options,
+        parameters,
+        bytes,
+        sha256: hash.digest('hex'),
+        scan_ms: Math.round(ms * 10) / 10,
+    });
+    const json = JSON.stringify(trace);
+    fs.writeFileSync(output, output.endsWith('.gz') ? zlib.gzipSync(json) : json);
+    console.error(`${name}: ${bytes} bytes in ${Math.round(ms)}ms, ${trace.calls.length} USB calls, written to ${output}`);
+    process.exit(0);
+})().catch(e => {
+    console.error(e);
+    process.exit(1);
+});
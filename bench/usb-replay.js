@@ -0,0 +1,139 @@
+// Replays a USB trace from bench/usb-record.js, the backend and the full
+// data path (libusb, glue.cpp, readers) run without the device. Reports
+// the scan time against the recorded device time and checks that the
+// scanned data matches the recording (exit code 1 if it doesn't).
+// Requires a full build (npm run build).
+//
+// usage: node bench/usb-replay.js TRACE [--speed N] [--runs N] [--json FILE]
+//   --speed N    replay speed (default: Infinity, no device time), 1 for the
+//                recorded timing
+//   --runs N     runs (default 3), the median is reported
+//   --json FILE  also write the results as JSON (for regression tracking)
+
+const fs = require('fs');
+const zlib = require('zlib');
+const crypto = require('crypto');
+const { libsane, ScanDataReader, ScanOptions, SANEStatus, USBReplay } = require('..');
+
+const args = process.argv.slice(2);
+const argValue = (name, def) => {
+    const i = args.indexOf(name);
+    return i === -1 ? def : args.splice(i, 2)[1];
+};
+const speed = Number(argValue('--speed', 'Infinity'));
+const runs = parseInt(argValue('--runs'), 10) || 3;
+const jsonFile = argValue('--json', null);
+const traceFile = args.shift();
+if (!traceFile) {
+    console.error("usage: node bench/usb-replay.js TRACE [--speed N] [--runs N] [--json FILE]");
+    process.exit(1);
+}
+
+const raw = fs.readFileSync(traceFile);
+const trace = JSON.parse(traceFile.endsWith('.gz') ? zlib.gunzipSync(raw) : raw);
+const { meta } = trace;
+
+async function setOptions(lib, values) {
+    let opts = await ScanOptions.get(lib);
+    for (const [name, value] of values) {
+        const opt = opts.options.find(o => o.descriptor.name === name);
+        if (!opt) {
+            throw new Error(`Option '${name}' not found.`);
+        }
+        const { status, updated } = await opts.setValue(opt.index, value);
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[status]} setting option '${name}'.`);
+        }
+        opts = updated;
+    }
+}
+
+async function replay() {
+    const usb = new USBReplay(trace, { speed });
+    const t0 = performance.now();
+    const lib = await libsane({ sane: { usb } });
+    await lib.sane_init();
+    const { devices } = await lib.sane_get_devices();
+    const name = devices.some(d => d.name === meta.device) ? meta.device : devices[0] && devices[0].name;
+    const { status } = await lib.sane_open(name);
+    if (status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[status]} during sane_open() (${usb.mismatches.length} mismatched USB calls).`);
+    }
+    await setOptions(lib, meta.options || []);
+
+    const reader = new ScanDataReader(lib);
+    const hash = crypto.createHash('sha256');
+    let bytes = 0;
+    reader.on('data', (p, data) => {
+        hash.update(data);
+        bytes += data.length;
+    });
+    const t1 = performance.now();
+    const start = await reader.start();
+    if (start.status !== SANEStatus.GOOD) {
+        throw new Error(`Status ${SANEStatus[start.status]} during sane_start() (${usb.mismatches.length} mismatched USB calls).`);
+    }
+    await start.promise;
+    const scan_ms = performance.now() - t1;
+    await lib.sane_close();
+    await lib.sane_exit();
+    return {
+        total_ms: performance.now() - t0,
+        scan_ms,
+        bytes,
+        sha256: hash.digest('hex'),
+        mismatches: usb.mismatches.length,
+        remaining: usb.remaining,
+    };
+}
+
+const median = (values) => {
+    const v = [...values].sort((a, b) => a - b);
+    return v[Math.floor(v.length / 2)];
+};
+const mib = (n) => n / (1024 * 1024);
+const round = (n, d = 1) => Math.round(n * 10 ** d) / 10 ** d;
+
+(async () => {
+    const samples = [];
+    for (let i = 0; i < runs; i++) {
+        samples.push(await replay());
+    }
+    const scan_ms = median(samples.map(s => s.scan_ms));
+    // device time (sum of the recorded call durations), what the replay
+    // waits at speed 1, the rest of the scan time is sane-wasm
+    const device_ms = trace.calls.reduce((ms, call) => ms + call[1], 0);
+    const ok = samples.every(s => s.sha256 === meta.sha256 && !s.mismatches);
+    const result = {
+        device: meta.device,
+        speed,
+        bytes: samples[0].bytes,
+        usb_calls: trace.calls.length,
+        recorded_scan_ms: meta.scan_ms,
+        recorded_device_ms: round(device_ms),
+        scan_ms: round(scan_ms),
+        total_ms: round(median(samples.map(s => s.total_ms))),
+        mb_s: round(mib(samples[0].bytes) / (scan_ms / 1000)),
+        mismatches: Math.max(...samples.map(s => s.mismatches)),
+        unused_calls: Math.max(...samples.map(s => s.remaining)),
+        data_ok: ok,
+    };
+    console.table([result]);
+
+    if (jsonFile) {
+        fs.writeFileSync(jsonFile, JSON.stringify({
+            trace: traceFile,
+            node: process.version,
+            runs,
+            date: new Date().toISOString(),
+            result,
+        }, null, 2) + '\n');
+    }
+    if (!ok) {
+        console.error("Scanned data doesn't match the recording.");
+    }
+    process.exit(ok ? 0 : 1);
+})().catch(e => {
+    console.error(e);
+    process.exit(1);
+});
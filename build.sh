@@ -7,13 +7,16 @@
 set -eo pipefail
 cd -- "$(dirname -- "$0")"
 
-ARGS=("with-docker" "clean" "no-build" "debug" "emrun" "shell")
+ARGS=("with-docker" "clean" "no-build" "debug" "release" "jspi" "slim" "emrun" "shell")
 usage() {
     echo "usage: ${0##*/} [options]"
     echo "  --with-docker  run with docker (preferred)"
     echo "  --clean        clean 'deps' and 'build' directories"
     echo "  --no-build     don't actually build"
     echo "  --debug        enable debug flags"
+    echo "  --release      optimized build (-O3, LTO, SIMD) to 'build/simd'"
+    echo "  --jspi         experimental (not verified): JSPI instead of ASYNCIFY to 'build/jspi'"
+    echo "  --slim         also build one variant per backend family to '<out>/slim'"
     echo "  --emrun        run emrun development server"
     echo "  --shell        run debug shell (depends on --with-docker)"
 }
@@ -29,9 +32,26 @@ for V in "$@"; do
     fi
 done
 
+if [ -n "$ARG_debug" ] && [ -n "$ARG_release" ]; then
+    echo "--debug and --release cannot be used together" ; exit 1
+fi
+if [ -n "$ARG_jspi" ] && [ -n "$ARG_debug$ARG_release" ]; then
+    echo "--jspi cannot be used with --debug or --release (it's a release build)" ; exit 1
+fi
+
+# The JSPI build needs a newer emscripten (the current JSPI API,
+# WebAssembly.Suspending), it uses its own docker image.
+# XXX: experimental, this variant has not been built or benchmarked yet
+DOCKER_IMAGE=sane-wasm
+DOCKER_BUILD_ARGS=()
+if [ -n "$ARG_jspi" ]; then
+    DOCKER_IMAGE=sane-wasm-jspi
+    DOCKER_BUILD_ARGS=(--build-arg EMSDK_VERSION=3.1.74)
+fi
+
 # use docker
 if [ -n "$ARG_with_docker" ] && [ -z "$SANE_WASM_DOCKER" ]; then
-    docker build -t sane-wasm .
+    docker build "${DOCKER_BUILD_ARGS[@]}" -t "$DOCKER_IMAGE" .
     EXTRA_ARGS=()
     if [ -n "$ARG_emrun" ]; then
         EXTRA_ARGS+=("-p6931:6931")
@@ -80,7 +100,7 @@ if [ -n "$ARG_with_docker" ] && [ -z "$SANE_WASM_DOCKER" ]; then
         -v "$PWD:/src" \
         -u "$(id -u):$(id -g)" \
         "${EXTRA_ARGS[@]}" \
-        sane-wasm:latest "$@"
+        "$DOCKER_IMAGE:latest" "$@"
 
     # MAGIC cleanup
     if [ -f .git ]; then
@@ -101,11 +121,24 @@ if [ -n "$ARG_clean" ]; then
     rm -rf build
 fi
 
+# The default build is the compatibility build (no SIMD), it goes to 'build'.
+# The release build goes to 'build/simd', the loader picks it when the
+# runtime supports WebAssembly SIMD. Each build keeps the other's artifacts.
+# The JSPI build goes to 'build/jspi', it's a release build that uses
+# JavaScript Promise Integration instead of ASYNCIFY to suspend (see below),
+# all runtimes with JSPI also support SIMD.
+OUT=build
+if [ -n "$ARG_release" ]; then
+    OUT=build/simd
+elif [ -n "$ARG_jspi" ]; then
+    OUT=build/jspi
+fi
+
 # post build actions
 post-build() {
     if [ -n "$ARG_emrun" ]; then
         echo "running emrun"
-        emrun --no_browser build/libsane.html
+        emrun --no_browser "$OUT/libsane.html"
     fi
     if [ -n "$ARG_shell" ] && [ -n "$SANE_WASM_DOCKER" ] && [ -z "$SANE_WASM_SHELL" ]; then
         echo "running bash shell"
@@ -120,8 +153,10 @@ if [ -n "$ARG_no_build" ]; then
 fi
 
 # build
-rm -rf build
 mkdir -p build
+find build -mindepth 1 -maxdepth 1 ! -name simd ! -name jspi -exec rm -rf {} +
+rm -rf "$OUT"
+mkdir -p "$OUT"
 
 # The backends are selected automatically by reading SANE's .desc files and
 # selecting the backends that support at least one USB device.
@@ -140,23 +175,63 @@ SANE_WASM_VERSION=$(git describe --tags --always --dirty)
 if [ -n "$ARG_debug" ]; then
     SANE_WASM_VERSION="$SANE_WASM_VERSION-debug"
 fi
-cat <<EOF >build/version.h
-#define SANE_WASM_COMMIT "$SANE_WASM_COMMIT"
-#define SANE_WASM_VERSION "$SANE_WASM_VERSION"
-#define SANE_WASM_BACKENDS "$SANE_WASM_BACKENDS"
-EOF
-
+if [ -n "$ARG_release" ]; then
+    SANE_WASM_VERSION="$SANE_WASM_VERSION-simd"
+fi
+if [ -n "$ARG_jspi" ]; then
+    SANE_WASM_VERSION="$SANE_WASM_VERSION-jspi"
+fi
 DEPS="$PWD/deps"
 SANE="$DEPS/backends"
 PREFIX="$PWD/build/prefix"
 export EM_PKG_CONFIG_PATH=$PREFIX/lib/pkgconfig
 
+# Initial module memory (emscripten's default), exported to glue.cpp
+# (version.h) and pre.js (version.js), the memoryLimit option creates the
+# module memory before the runtime does and needs it.
+SANE_WASM_INITIAL_MEMORY=$((16 * 1024 * 1024))
+
 # debug flags
 D_O0G3=()
 if [ -n "$ARG_debug" ]; then
     D_O0G3=("-O0" "-g3")
 fi
 
+# release flags, used for all dependencies and glue.cpp
+# libjpeg-turbo has no WebAssembly SIMD code (WITH_SIMD is x86/arm only),
+# with SIMD128 enabled it still gets clang's auto-vectorization
+R_FLAGS=()
+if [ -n "$ARG_release$ARG_jspi" ]; then
+    R_FLAGS=("-O3" "-flto" "-msimd128")
+fi
+export CFLAGS="${R_FLAGS[*]}"
+export CXXFLAGS="${R_FLAGS[*]}"
+
+# Suspending (link time only): the blocking calls (backends sleeping, libusb
+# waiting for WebUSB) only happen on the helper threads, inside the tasks
+# proxied by glue.cpp (run_on_thread), the main thread never suspends (it
+# uses coroutines). ASYNCIFY instruments every function that may be on the
+# stack of a suspending call. With JSPI, only the thread mailbox export (that
+# runs the proxied tasks) can suspend, and nothing is instrumented.
+A_FLAGS=("-sASYNCIFY")
+if [ -n "$ARG_jspi" ]; then
+    A_FLAGS=("-sJSPI" "-sJSPI_EXPORTS=_emscripten_check_mailbox")
+fi
+
+# The dependencies are built in-tree, switching between the default and the
+# release builds (or emscripten versions) requires rebuilding them with the
+# new flags.
+FLAGS_STAMP="$DEPS/.build-flags"
+BUILD_FLAGS="${R_FLAGS[*]} $(emcc -dumpversion)"
+if [ "$(cat "$FLAGS_STAMP" 2>/dev/null)" != "$BUILD_FLAGS" ]; then
+    find deps -mindepth 1 -maxdepth 1 -type d | while IFS= read -r DIR; do
+        echo "cleaning '$DIR' (build flags changed)"
+        git -C "$DIR" checkout .
+        git -C "$DIR" clean -fdx
+    done
+fi
+echo "$BUILD_FLAGS" >"$FLAGS_STAMP"
+
 # apply dependency patches
 (
     cd deps
@@ -170,8 +245,8 @@ fi
 # https://github.com/libjpeg-turbo/libjpeg-turbo/issues/250
 (
     cd deps/libjpeg-turbo
-    export LDFLAGS="-sALLOW_MEMORY_GROWTH"
-    [ -f Makefile ] || emcmake cmake -DWITH_SIMD=0 -DENABLE_SHARED=0 .
+    export LDFLAGS="-sALLOW_MEMORY_GROWTH ${R_FLAGS[*]}"
+    [ -f Makefile ] || emcmake cmake -DWITH_SIMD=0 -DENABLE_SHARED=0 -DCMAKE_BUILD_TYPE=Release "-DCMAKE_C_FLAGS=${R_FLAGS[*]}" .
     emmake make -j jpeg-static
 )
 
@@ -186,65 +261,133 @@ fi
     emmake make -j install
 )
 
-# backends
-(
-    cd deps/backends
-    [ -f configure ] || ./autogen.sh
-    export CPPFLAGS="-I$DEPS/libjpeg-turbo -Wno-error=incompatible-function-pointer-types"
-    export LDFLAGS="-L$DEPS/libjpeg-turbo --bind -sASYNCIFY -sALLOW_MEMORY_GROWTH"
-    export BACKENDS="$SANE_WASM_BACKENDS"
-    # XXX: Force enable mmap, configure can't detect valid mmap, force it on!
-    # I've looked briefly into this, it's probably emscripten's implementation
-    # that is not complete, mmap appears to only be used by the pieusb backend
-    # consider disabling it if this is problematic.
-    [ -f Makefile ] || sed -i "s/ac_cv_func_mmap_fixed_mapped=no/ac_cv_func_mmap_fixed_mapped=yes/g" configure
-    [ -f Makefile ] || emconfigure ./configure --prefix="$PREFIX" --host=wasm32 --enable-pthread --disable-shared
-    # make only the required parts
-    emmake make -j -C lib
-    emmake make -j -C sanei
-    emmake make -j -C backend install
-)
+# The backends and sane-wasm itself are built once for the full build and,
+# with --slim, once for each backend family (e.g. 'canon', 'epson', grouped by
+# manufacturer, see utils.py usb-families). The slim variants only include
+# the backends of that family, they go to '<out>/slim/<family>'. Set
+# SANE_WASM_FAMILIES to only build some families (space separated).
+build-variant() {
+    local VOUT="$1"
+    local VBACKENDS="$2"
+    local VVERSION="$3"
+    mkdir -p "$VOUT"
+
+    # The backends are selected on configure, reconfigure when they change.
+    local BACKENDS_STAMP="$DEPS/.build-backends"
+    if [ "$(cat "$BACKENDS_STAMP" 2>/dev/null)" != "$VBACKENDS" ] && [ -f "$SANE/Makefile" ]; then
+        echo "cleaning 'deps/backends' (backends changed)"
+        git -C "$SANE" checkout .
+        git -C "$SANE" clean -fdx
+        git -C "$SANE" apply ../backends.patch
+    fi
+    echo "$VBACKENDS" >"$BACKENDS_STAMP"
+    rm -rf "$PREFIX/etc/sane.d"
+
+    # backends
+    (
+        cd deps/backends
+        [ -f configure ] || ./autogen.sh
+        export CPPFLAGS="-I$DEPS/libjpeg-turbo -Wno-error=incompatible-function-pointer-types"
+        export LDFLAGS="-L$DEPS/libjpeg-turbo --bind ${A_FLAGS[*]} -sALLOW_MEMORY_GROWTH ${R_FLAGS[*]}"
+        export BACKENDS="$VBACKENDS"
+        # XXX: Force enable mmap, configure can't detect valid mmap, force it on!
+        # I've looked briefly into this, it's probably emscripten's implementation
+        # that is not complete, mmap appears to only be used by the pieusb backend
+        # consider disabling it if this is problematic.
+        [ -f Makefile ] || sed -i "s/ac_cv_func_mmap_fixed_mapped=no/ac_cv_func_mmap_fixed_mapped=yes/g" configure
+        [ -f Makefile ] || emconfigure ./configure --prefix="$PREFIX" --host=wasm32 --enable-pthread --disable-shared
+        # make only the required parts
+        emmake make -j -C lib
+        emmake make -j -C sanei
+        emmake make -j -C backend install
+    )
+
+    # The backends that configure actually enabled (the ones preloaded by the
+    # dll backend), glue.cpp also calls them directly (Module.sane.backends).
+    # SANE_WASM_USB_IDS maps USB IDs to backends (Module.sane.deviceHints).
+    local ENABLED
+    ENABLED=$(sed -n "s/^PRELOADABLE_BACKENDS = //p" "$SANE/backend/Makefile" | xargs)
+    ENABLED=${ENABLED:-$VBACKENDS}
+    cat <<EOF >build/version.h
+#define SANE_WASM_COMMIT "$SANE_WASM_COMMIT"
+#define SANE_WASM_VERSION "$VVERSION"
+#define SANE_WASM_BACKENDS "$ENABLED"
+#define SANE_WASM_BACKENDS_LIST(X) $(for B in $ENABLED; do printf "X(%s) " "$B"; done)
+#define SANE_WASM_USB_IDS "$(./utils.py usb-ids -b "${ENABLED// /,}")"
+#define SANE_WASM_INITIAL_MEMORY $SANE_WASM_INITIAL_MEMORY
+EOF
+    cat <<EOF >build/version.js
+var SANE_WASM_INITIAL_MEMORY = $SANE_WASM_INITIAL_MEMORY;
+EOF
+
+    # Truncate dll.conf, this file sets which backends are enabled, but because we
+    # are doing a static build without shared libraries we don't really need it
+    # (all backends are always enabled). Leaving other backends listed on that file
+    # causes SANE to try to dynamically load them, we don't need that.
+    : >"$PREFIX/etc/sane.d/dll.conf"
+
+    # Set test backend's number of devices to 0.
+    # XXX: Oops what? There is some kind of invalid memory access on the backend
+    #      file deps/backends/backend/test.c, setting number_of_devices to 0 causes
+    #      some weird behavior and it's as if 1 device was selected.
+    #      I've looked briefly into this, but was unable to find the cause,
+    #      it's somehow related to how the option is read with:
+    #      read_option (line, "number_of_devices", ...
+    #      and then used on a for loop:
+    #      for (num = 0; num < init_number_of_devices; num++)
+    #      that loop should never run with init_number_of_devices = 0.
+    #      I've tested this config on my linux distribution version of SANE and
+    #      it triggers a Segmentation Fault so there is definitely a problem there.
+    # XXX: Setting it to -999 for now, fix this, and revert this to 0.
+    #      The fix should probably be pushed upstream to SANE itself:
+    #      https://gitlab.com/sane-project/backends/-/issues
+    if [ -f "$PREFIX/etc/sane.d/test.conf" ]; then
+        sed -i "s/^number_of_devices .*/number_of_devices -999/g" "$PREFIX/etc/sane.d/test.conf"
+    fi
 
-# Truncate dll.conf, this file sets which backends are enabled, but because we
-# are doing a static build without shared libraries we don't really need it
-# (all backends are always enabled). Leaving other backends listed on that file
-# causes SANE to try to dynamically load them, we don't need that.
-: >"$PREFIX/etc/sane.d/dll.conf"
-
-# Set test backend's number of devices to 0.
-# XXX: Oops what? There is some kind of invalid memory access on the backend
-#      file deps/backends/backend/test.c, setting number_of_devices to 0 causes
-#      some weird behavior and it's as if 1 device was selected.
-#      I've looked briefly into this, but was unable to find the cause,
-#      it's somehow related to how the option is read with:
-#      read_option (line, "number_of_devices", ...
-#      and then used on a for loop:
-#      for (num = 0; num < init_number_of_devices; num++)
-#      that loop should never run with init_number_of_devices = 0.
-#      I've tested this config on my linux distribution version of SANE and
-#      it triggers a Segmentation Fault so there is definitely a problem there.
-# XXX: Setting it to -999 for now, fix this, and revert this to 0.
-#      The fix should probably be pushed upstream to SANE itself:
-#      https://gitlab.com/sane-project/backends/-/issues
-sed -i "s/^number_of_devices .*/number_of_devices -999/g" "$PREFIX/etc/sane.d/test.conf"
-
-# build sane-wasm itself (with glue.cpp)
-set -x
-# XXX: -std=c++20 help?
-"$SANE/libtool" --tag=CC --mode=link emcc \
-    -std=c++20 \
-    "-I$SANE/include" "$SANE/backend/.libs/libsane.la" "$SANE/sanei/.libs/libsanei.la" \
-    glue.cpp -o build/libsane.html "${D_O0G3[@]}" \
-    --bind -pthread -sASYNCIFY -sALLOW_MEMORY_GROWTH -sPTHREAD_POOL_SIZE=2 \
-    --embed-file="$PREFIX/etc/sane.d@/etc/sane.d" \
-    -sEXPORTED_RUNTIME_METHODS=FS \
-    -sMODULARIZE -sEXPORT_NAME=LibSANE \
-    --pre-js pre.js --post-js post.js --shell-file shell.html
-set +x
+    # build sane-wasm itself (with glue.cpp)
+    # The config files (/etc/sane.d) are packed to libsane.data and loaded in
+    # parallel with the wasm file, instead of embedded in it (--embed-file),
+    # keeping them out of the wasm file that is compiled.
+    # The pthread pool is sized at runtime from Module.sane.threadPoolSize (handle
+    # API device threads, see pre.js) plus the main helper thread, the discovery
+    # thread and one spare worker for threads started by the backends.
+    # The libusb transfer functions are wrapped by glue.cpp (metrics).
+    set -x
+    # XXX: -std=c++20 help?
+    "$SANE/libtool" --tag=CC --mode=link emcc \
+        -std=c++20 \
+        "-I$SANE/include" "$SANE/backend/.libs/libsane.la" "$SANE/sanei/.libs/libsanei.la" \
+        "-I$DEPS/libjpeg-turbo" "-L$DEPS/libjpeg-turbo" -ljpeg -sUSE_ZLIB=1 \
+        glue.cpp -o "$VOUT/libsane.html" "${D_O0G3[@]}" "${R_FLAGS[@]}" \
+        --bind -pthread "${A_FLAGS[@]}" -sALLOW_MEMORY_GROWTH -sINITIAL_MEMORY="$SANE_WASM_INITIAL_MEMORY" \
+        -sPTHREAD_POOL_SIZE=Module.sane.threadPoolSize+3 \
+        -Wl,--wrap=libusb_bulk_transfer,--wrap=libusb_interrupt_transfer,--wrap=libusb_control_transfer \
+        --preload-file="$PREFIX/etc/sane.d@/etc/sane.d" \
+        -sEXPORTED_RUNTIME_METHODS=FS,HEAPU8 \
+        -sMODULARIZE -sEXPORT_NAME=LibSANE \
+        --pre-js build/version.js --pre-js pre.js --post-js post.js --shell-file shell.html
+    set +x
+
+    # clean variant directory on non-debug builds
+    if [ -z "$ARG_debug" ]; then
+        rm -rf "$VOUT/.libs"
+    fi
+}
+
+build-variant "$OUT" "$SANE_WASM_BACKENDS" "$SANE_WASM_VERSION"
+if [ -n "$ARG_slim" ]; then
+    while read -r FAMILY BACKENDS; do
+        if [ -n "$SANE_WASM_FAMILIES" ] && [[ " $SANE_WASM_FAMILIES " != *" $FAMILY "* ]]; then
+            continue
+        fi
+        build-variant "$OUT/slim/$FAMILY" "$BACKENDS" "$SANE_WASM_VERSION-slim-$FAMILY"
+    done < <(./utils.py usb-families -b "${SANE_WASM_BACKENDS// /,}")
+fi
 
 # clean build directory on non-debug builds
 if [ -z "$ARG_debug" ]; then
-    rm -rf build/.libs build/prefix build/version.h
+    rm -rf build/prefix build/version.h build/version.js
 fi
 
 post-build
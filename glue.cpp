@@ -42,41 +42,252 @@
 #include <emscripten/val.h>
 #include <emscripten/proxying.h>
 #include <emscripten/eventloop.h>
+#include <emscripten/threading.h>
+#include <emscripten/heap.h>
 #include <sane/sane.h>
+#include <malloc.h>
+#include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <zlib.h>
 #include <string>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
 #include <coroutine>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
 
 #include "build/version.h"
 
 using namespace emscripten;
 
+// read buffer size, default for Module.sane.readBufferSize
 #define BUFFER_LEN 2*1024*1024
-
+// sane_read_blocking: sleep between empty reads (grows up to max) and maximum
+// time without data before returning to JS, default for Module.sane.readIdleMax
+#define READ_SLEEP_MIN_MS 1
+#define READ_SLEEP_MAX_MS 16
+#define READ_IDLE_MAX_MS 250
+// sane_read_stream: default number of read buffers (slots)
+#define READ_STREAM_SLOTS 4
+// handle API: default number of device threads created at startup
+#define THREAD_POOL_SIZE 2
+
+// Calls that block (on the device or backend) run on helper threads, the
+// main thread is never blocked. Each device has its own helper thread (see
+// struct device), global calls (device discovery, sane_exit) run on the
+// discovery thread so they don't wait for (or stall) device calls.
 static ProxyingQueue queue;
-static std::thread helper;
+static std::thread helper; // single handle API device
+static std::thread discovery; // global calls
 
 SANE_Int version_code = 0;
-SANE_Handle handle = NULL;
-SANE_Byte buffer[BUFFER_LEN];
+size_t buffer_len = BUFFER_LEN; // set on main()
+double read_idle_max_ms = READ_IDLE_MAX_MS; // set on main()
 
 void helper_thread_main() {
     emscripten_runtime_keepalive_push();
 }
 
+// Metrics (sane-wasm, not part of SANE API)
+
+// Opt-in (Module.sane.metrics), collected from the main and helper threads:
+// latency of each SANE function call (the backend itself), time waiting on
+// the ProxyingQueue (run_on_thread, both ways), sane_read sizes and USB
+// transfers (libusb calls wrapped at link time, see build.sh).
+// Histograms are log2: bucket 0 is < 1 (us or bytes), bucket i is
+// [2^(i-1), 2^i), the last bucket has everything above.
+#define METRIC_BUCKETS 24
+
+enum {
+    METRIC_INIT,
+    METRIC_EXIT,
+    METRIC_GET_DEVICES,
+    METRIC_OPEN,
+    METRIC_CLOSE,
+    METRIC_GET_OPTION_DESCRIPTOR,
+    METRIC_CONTROL_OPTION,
+    METRIC_GET_PARAMETERS,
+    METRIC_START,
+    METRIC_READ,
+    METRIC_CANCEL,
+    METRIC_FUNCTIONS,
+};
+
+const char *metric_names[METRIC_FUNCTIONS] = {
+    "sane_init", "sane_exit", "sane_get_devices", "sane_open", "sane_close",
+    "sane_get_option_descriptor", "sane_control_option",
+    "sane_get_parameters", "sane_start", "sane_read", "sane_cancel",
+};
+
+enum {
+    METRIC_USB_BULK_IN,
+    METRIC_USB_BULK_OUT,
+    METRIC_USB_INTERRUPT_IN,
+    METRIC_USB_INTERRUPT_OUT,
+    METRIC_USB_CONTROL_IN,
+    METRIC_USB_CONTROL_OUT,
+    METRIC_USB_TYPES,
+};
+
+const char *metric_usb_names[METRIC_USB_TYPES] = {
+    "bulk_in", "bulk_out", "interrupt_in", "interrupt_out", "control_in", "control_out",
+};
+
+struct metric_histogram {
+    int count = 0;
+    double total = 0;
+    double max = 0;
+    int buckets[METRIC_BUCKETS] = {};
+
+    void add(double value, double unit) {
+        int i = value < unit ? 0 : std::min(METRIC_BUCKETS - 1, 1 + (int) std::log2(value / unit));
+        count++;
+        total += value;
+        max = std::max(max, value);
+        buckets[i]++;
+    }
+};
+
+struct metrics_data {
+    metric_histogram functions[METRIC_FUNCTIONS]; // ms
+    metric_histogram proxy_queue; // ms, from run_on_thread to the helper thread
+    metric_histogram proxy_resume; // ms, from the helper thread back to main
+    metric_histogram read_bytes; // sane_read lengths
+    int read_empty = 0; // sane_read GOOD with 0 bytes
+    metric_histogram usb[METRIC_USB_TYPES]; // bytes
+    int usb_errors[METRIC_USB_TYPES] = {};
+};
+
+bool metrics_enabled = false; // set on main()
+std::mutex metrics_mutex;
+metrics_data metrics;
+
+void metrics_call(int fn, double ms) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    metrics.functions[fn].add(ms, 0.001);
+}
+
+void metrics_read(SANE_Status status, SANE_Int len) {
+    if (status != SANE_STATUS_GOOD) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    metrics.read_bytes.add(len, 1);
+    if (len == 0) {
+        metrics.read_empty++;
+    }
+}
+
+void metrics_usb(int type, int result, int len) {
+    if (!metrics_enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    if (result < 0) {
+        metrics.usb_errors[type]++;
+    } else {
+        metrics.usb[type].add(len, 1);
+    }
+}
+
+// SANE function wrapper (see BACKEND_ENTRY), times the call
+template <int M, auto F> struct metered;
+template <int M, typename R, typename... A, R (*F)(A...)>
+struct metered<M, F> {
+    static R call(A... args) {
+        if (!metrics_enabled) {
+            return F(args...);
+        }
+        double start = emscripten_get_now();
+        if constexpr (std::is_void_v<R>) {
+            F(args...);
+            metrics_call(M, emscripten_get_now() - start);
+        } else {
+            R r = F(args...);
+            metrics_call(M, emscripten_get_now() - start);
+            if constexpr (M == METRIC_READ) {
+                metrics_read(r, *std::get<3>(std::tuple<A...>(args...)));
+            }
+            return r;
+        }
+    }
+};
+
+// libusb synchronous transfers used by sanei_usb, linked with
+// --wrap=libusb_* so these are called instead
+struct libusb_device_handle;
+extern "C" {
+    int __real_libusb_bulk_transfer(libusb_device_handle *dev, unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+    int __real_libusb_interrupt_transfer(libusb_device_handle *dev, unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+    int __real_libusb_control_transfer(libusb_device_handle *dev, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned char *data, uint16_t length, unsigned int timeout);
+
+    int __wrap_libusb_bulk_transfer(libusb_device_handle *dev, unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) {
+        int r = __real_libusb_bulk_transfer(dev, endpoint, data, length, transferred, timeout);
+        metrics_usb((endpoint & 0x80) ? METRIC_USB_BULK_IN : METRIC_USB_BULK_OUT, r, transferred ? *transferred : 0);
+        return r;
+    }
+
+    int __wrap_libusb_interrupt_transfer(libusb_device_handle *dev, unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) {
+        int r = __real_libusb_interrupt_transfer(dev, endpoint, data, length, transferred, timeout);
+        metrics_usb((endpoint & 0x80) ? METRIC_USB_INTERRUPT_IN : METRIC_USB_INTERRUPT_OUT, r, transferred ? *transferred : 0);
+        return r;
+    }
+
+    int __wrap_libusb_control_transfer(libusb_device_handle *dev, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned char *data, uint16_t length, unsigned int timeout) {
+        int r = __real_libusb_control_transfer(dev, request_type, request, value, index, data, length, timeout);
+        metrics_usb((request_type & 0x80) ? METRIC_USB_CONTROL_IN : METRIC_USB_CONTROL_OUT, r, r);
+        return r;
+    }
+}
+
 template <typename Function>
-auto run_on_helper_thread(Function&& fn) {
+auto run_on_thread(std::thread &thread, Function&& fn) {
     // https://en.cppreference.com/w/cpp/language/coroutines
     struct awaiter : std::suspend_always
     {
+        pthread_t _thread;
         Function _fn;
         std::optional<std::invoke_result_t<Function>> _re;
+        double _time = 0; // metrics
         void await_suspend(std::coroutine_handle<> h)
         {
+            if (metrics_enabled) {
+                _time = emscripten_get_now();
+            }
             queue.proxyCallback(
-                helper.native_handle(),
-                [this] { _re.emplace(_fn()); },
-                [h] { h.resume(); },
+                _thread,
+                [this] {
+                    if (_time) {
+                        double now = emscripten_get_now();
+                        std::lock_guard<std::mutex> lock(metrics_mutex);
+                        metrics.proxy_queue.add(now - _time, 0.001);
+                    }
+                    _re.emplace(_fn());
+                    if (_time) {
+                        _time = emscripten_get_now();
+                    }
+                },
+                [this, h] {
+                    if (_time) {
+                        double now = emscripten_get_now();
+                        std::lock_guard<std::mutex> lock(metrics_mutex);
+                        metrics.proxy_resume.add(now - _time, 0.001);
+                    }
+                    h.resume();
+                },
                 NULL
             );
         }
@@ -85,7 +296,245 @@ auto run_on_helper_thread(Function&& fn) {
             return std::move(_re.value());
         }
     };
-    return awaiter{{}, fn};
+    return awaiter{{}, thread.native_handle(), fn};
+}
+
+// Backends (sane-wasm, not part of SANE API)
+
+// By default all calls go through the dll backend, which initializes and
+// probes every backend on sane_get_devices. When sane_init is given a list of
+// backends (Module.sane.backends) or device IDs (Module.sane.deviceHints),
+// the dll backend is skipped and only those backends are called, directly.
+// They are initialized on first use (sane_get_devices or sane_open), like
+// the dll backend does.
+
+struct backend {
+    const char *name;
+    SANE_Status (*init)(SANE_Int *version_code, SANE_Auth_Callback authorize);
+    void (*exit)(void);
+    SANE_Status (*get_devices)(const SANE_Device ***device_list, SANE_Bool local_only);
+    SANE_Status (*open)(SANE_String_Const devicename, SANE_Handle *handle);
+    void (*close)(SANE_Handle handle);
+    const SANE_Option_Descriptor *(*get_option_descriptor)(SANE_Handle handle, SANE_Int option);
+    SANE_Status (*control_option)(SANE_Handle handle, SANE_Int option, SANE_Action action, void *value, SANE_Int *info);
+    SANE_Status (*get_parameters)(SANE_Handle handle, SANE_Parameters *params);
+    SANE_Status (*start)(SANE_Handle handle);
+    SANE_Status (*read)(SANE_Handle handle, SANE_Byte *data, SANE_Int max_length, SANE_Int *length);
+    void (*cancel)(SANE_Handle handle);
+    bool inited = false;
+};
+
+// the entry points of the statically linked backends are prefixed with the
+// backend name (sane_<backend>_init, etc.), the same the dll backend uses
+#define BACKEND_DECLARE(be) extern "C" { \
+    SANE_Status sane_##be##_init(SANE_Int *, SANE_Auth_Callback); \
+    void sane_##be##_exit(void); \
+    SANE_Status sane_##be##_get_devices(const SANE_Device ***, SANE_Bool); \
+    SANE_Status sane_##be##_open(SANE_String_Const, SANE_Handle *); \
+    void sane_##be##_close(SANE_Handle); \
+    const SANE_Option_Descriptor *sane_##be##_get_option_descriptor(SANE_Handle, SANE_Int); \
+    SANE_Status sane_##be##_control_option(SANE_Handle, SANE_Int, SANE_Action, void *, SANE_Int *); \
+    SANE_Status sane_##be##_get_parameters(SANE_Handle, SANE_Parameters *); \
+    SANE_Status sane_##be##_start(SANE_Handle); \
+    SANE_Status sane_##be##_read(SANE_Handle, SANE_Byte *, SANE_Int, SANE_Int *); \
+    void sane_##be##_cancel(SANE_Handle); \
+}
+#define BACKEND_METERED(be, M, fn) metered<M, sane_##be##fn>::call
+#define BACKEND_FUNCTIONS(be) \
+    BACKEND_METERED(be, METRIC_INIT, init), \
+    BACKEND_METERED(be, METRIC_EXIT, exit), \
+    BACKEND_METERED(be, METRIC_GET_DEVICES, get_devices), \
+    BACKEND_METERED(be, METRIC_OPEN, open), \
+    BACKEND_METERED(be, METRIC_CLOSE, close), \
+    BACKEND_METERED(be, METRIC_GET_OPTION_DESCRIPTOR, get_option_descriptor), \
+    BACKEND_METERED(be, METRIC_CONTROL_OPTION, control_option), \
+    BACKEND_METERED(be, METRIC_GET_PARAMETERS, get_parameters), \
+    BACKEND_METERED(be, METRIC_START, start), \
+    BACKEND_METERED(be, METRIC_READ, read), \
+    BACKEND_METERED(be, METRIC_CANCEL, cancel)
+#define BACKEND_ENTRY(be) { #be, BACKEND_FUNCTIONS(be##_) },
+
+SANE_WASM_BACKENDS_LIST(BACKEND_DECLARE)
+
+backend backends_all[] = { SANE_WASM_BACKENDS_LIST(BACKEND_ENTRY) };
+// sane_* (dll backend), BACKEND_FUNCTIONS pastes sane_##fn here
+backend backend_dll = { "dll", BACKEND_FUNCTIONS() };
+
+std::vector<backend *> backends_selected; // empty: use the dll backend
+std::mutex backends_mutex; // backend init (discovery and device threads)
+// sane_get_devices with selected backends, names are "backend:device"
+std::vector<std::string> backends_device_names;
+std::vector<SANE_Device> backends_devices;
+std::vector<const SANE_Device *> backends_device_list;
+
+backend *backend_find(const std::string &name) {
+    for (backend &be : backends_all) {
+        if (name == be.name) {
+            return &be;
+        }
+    }
+    return NULL;
+}
+
+bool backend_in(const std::vector<backend *> &list, const backend *be) {
+    return std::find(list.begin(), list.end(), be) != list.end();
+}
+
+// Adds the backends that support a USB ID ("vvvv:pppp", matched against the
+// IDs in SANE's backend descriptions, SANE_WASM_USB_IDS) to list.
+void backends_for_usb_id(std::string id, std::vector<backend *> &list) {
+    // " vvvv:pppp:backend vvvv:pppp:backend ... "
+    std::string ids = " " SANE_WASM_USB_IDS " ";
+    std::transform(id.begin(), id.end(), id.begin(), ::tolower);
+    std::string key = " " + id + ":";
+    for (size_t i = ids.find(key); i != std::string::npos; i = ids.find(key, i + 1)) {
+        size_t start = i + key.size();
+        backend *be = backend_find(ids.substr(start, ids.find(' ', start) - start));
+        if (be && !backend_in(list, be)) {
+            list.push_back(be);
+        }
+    }
+}
+
+// Sets backends_selected from Module.sane.backends and
+// Module.sane.deviceHints (USB IDs, see backends_for_usb_id). Hints that
+// don't match any backend are ignored, an unknown backend name is an error.
+// With Module.sane.discoveryCache and no selection, all the backends are
+// selected, the discovery cache needs to probe a subset of the backends
+// (sane_discovery_probe) and the dll backend can't do that.
+bool backends_select() {
+    backends_selected.clear();
+    val opts = val::module_property("sane");
+    if (opts["backends"].isArray()) {
+        for (const std::string &name : vecFromJSArray<std::string>(opts["backends"])) {
+            backend *be = backend_find(name);
+            if (!be) {
+                backends_selected.clear();
+                return false;
+            }
+            if (!backend_in(backends_selected, be)) {
+                backends_selected.push_back(be);
+            }
+        }
+    }
+    if (opts["deviceHints"].isArray()) {
+        for (const std::string &hint : vecFromJSArray<std::string>(opts["deviceHints"])) {
+            backends_for_usb_id(hint, backends_selected);
+        }
+    }
+    if (backends_selected.empty() && opts["discoveryCache"].isTrue()) {
+        for (backend &be : backends_all) {
+            backends_selected.push_back(&be);
+        }
+    }
+    return true;
+}
+
+SANE_Status backend_init(backend *be) {
+    std::lock_guard<std::mutex> lock(backends_mutex);
+    if (be->inited) {
+        return SANE_STATUS_GOOD;
+    }
+    SANE_Int version_code;
+    SANE_Status status = be->init(&version_code, NULL);
+    be->inited = status == SANE_STATUS_GOOD;
+    return status;
+}
+
+// Only call this from the discovery thread.
+void backends_exit() {
+    if (backends_selected.empty()) {
+        backend_dll.exit();
+        return;
+    }
+    for (backend *be : backends_selected) {
+        if (be->inited) {
+            be->exit();
+            be->inited = false;
+        }
+    }
+    backends_selected.clear();
+    backends_device_list.clear();
+    backends_devices.clear();
+    backends_device_names.clear();
+}
+
+// Probes the selected backends, or only the ones in probe (if not NULL).
+// Only call this from the discovery thread.
+SANE_Status backends_get_devices(const SANE_Device ***device_list, const std::vector<backend *> *probe = NULL) {
+    if (backends_selected.empty()) {
+        return backend_dll.get_devices(device_list, SANE_TRUE);
+    }
+    backends_device_list.clear();
+    backends_devices.clear();
+    backends_device_names.clear();
+    for (backend *be : backends_selected) {
+        if (probe && !backend_in(*probe, be)) {
+            continue;
+        }
+        const SANE_Device **list = NULL;
+        if (backend_init(be) != SANE_STATUS_GOOD || be->get_devices(&list, SANE_TRUE) != SANE_STATUS_GOOD) {
+            continue; // like the dll backend, skip failing backends
+        }
+        for (int i = 0; list[i]; i++) {
+            backends_device_names.push_back(std::string(be->name) + ":" + list[i]->name);
+            backends_devices.push_back(*list[i]);
+        }
+    }
+    // names are only set now, backends_device_names doesn't move anymore
+    for (size_t i = 0; i < backends_devices.size(); i++) {
+        backends_devices[i].name = backends_device_names[i].c_str();
+        backends_device_list.push_back(&backends_devices[i]);
+    }
+    backends_device_list.push_back(NULL);
+    *device_list = backends_device_list.data();
+    return SANE_STATUS_GOOD;
+}
+
+// Opens "backend:device" (or "backend", its first device) on the selected
+// backend, or any device with the dll backend.
+// Only call this from the device's helper thread.
+SANE_Status backends_open(const std::string &devicename, backend **be, SANE_Handle *h) {
+    if (backends_selected.empty()) {
+        *be = &backend_dll;
+        return backend_dll.open(devicename.c_str(), h);
+    }
+    size_t colon = devicename.find(':');
+    std::string name = devicename.substr(0, colon);
+    std::string dev = colon == std::string::npos ? "" : devicename.substr(colon + 1);
+    *be = name.empty() ? backends_selected[0] : backend_find(name);
+    if (!*be || !backend_in(backends_selected, *be)) {
+        return SANE_STATUS_INVAL;
+    }
+    SANE_Status status = backend_init(*be);
+    if (status != SANE_STATUS_GOOD) {
+        return status;
+    }
+    return (*be)->open(dev.c_str(), h);
+}
+
+// Calls sane_read until there is data, EOF or an error, sleeping a little
+// between empty reads. Gives up after read_idle_max_ms without data or when
+// abort is set, returning SANE_STATUS_GOOD with *len = 0.
+// XXX: This still polls, SANE has no way to wait for data other than a
+//      blocking sane_read (sane_set_io_mode/sane_get_select_fd are not
+//      usable here), the sleep only bounds the cost of the empty reads.
+// Only call this from the device's helper thread.
+SANE_Status read_until_data(const backend *be, SANE_Handle handle, SANE_Byte *data, SANE_Int max_length, SANE_Int *len, const std::atomic<bool> *abort = NULL) {
+    SANE_Status status;
+    double start = emscripten_get_now();
+    double sleep = READ_SLEEP_MIN_MS;
+    while (true) {
+        status = be->read(handle, data, max_length, len);
+        if (
+            status != SANE_STATUS_GOOD || *len > 0 || (abort && *abort) ||
+            emscripten_get_now() - start >= read_idle_max_ms
+        ) {
+            return status;
+        }
+        emscripten_thread_sleep(sleep);
+        sleep = std::min(sleep * 2, (double) READ_SLEEP_MAX_MS);
+    }
 }
 
 val build_response(SANE_Status status, const char *key, const val &value = val::null()) {
@@ -95,477 +544,2864 @@ val build_response(SANE_Status status, const char *key, const val &value = val::
     return obj;
 }
 
-val build_response(SANE_Status status) {
-    val obj = val::object();
-    obj.set("status", (int) status);
-    return obj;
-}
+val build_response(SANE_Status status) {
+    val obj = val::object();
+    obj.set("status", (int) status);
+    return obj;
+}
+
+#define RETURN_IF_ERROR(status) if (status != SANE_STATUS_GOOD) return build_response(status);
+#define RETURN_IF_ERROR_KEY(status, key) if (status != SANE_STATUS_GOOD) return build_response(status, key);
+#define CORETURN_IF_ERROR(status) if (status != SANE_STATUS_GOOD) co_return build_response(status);
+#define CORETURN_IF_ERROR_KEY(status, key) if (status != SANE_STATUS_GOOD) co_return build_response(status, key);
+
+val bitmap_cap_to_val(SANE_Int cap) {
+    val obj = val::object();
+    obj.set("SOFT_SELECT", (bool) ((cap & SANE_CAP_SOFT_SELECT) != 0));
+    obj.set("HARD_SELECT", (bool) ((cap & SANE_CAP_HARD_SELECT) != 0));
+    obj.set("SOFT_DETECT", (bool) ((cap & SANE_CAP_SOFT_DETECT) != 0));
+    obj.set("EMULATED", (bool) ((cap & SANE_CAP_EMULATED) != 0));
+    obj.set("AUTOMATIC", (bool) ((cap & SANE_CAP_AUTOMATIC) != 0));
+    obj.set("INACTIVE", (bool) ((cap & SANE_CAP_INACTIVE) != 0));
+    obj.set("ADVANCED", (bool) ((cap & SANE_CAP_ADVANCED) != 0));
+    return obj;
+}
+
+val bitmap_info_to_val(SANE_Int info) {
+    val obj = val::object();
+    obj.set("INEXACT", (bool) ((info & SANE_INFO_INEXACT) != 0));
+    obj.set("RELOAD_OPTIONS", (bool) ((info & SANE_INFO_RELOAD_OPTIONS) != 0));
+    obj.set("RELOAD_PARAMS", (bool) ((info & SANE_INFO_RELOAD_PARAMS) != 0));
+    return obj;
+}
+
+// Image conversion (sane-wasm, not part of SANE API)
+
+// Converts raw SANE data (GRAY/RGB, 1/8/16-bit) to 8-bit images with the
+// requested layout. This used to be done in JS by ScanImageReader, one pixel
+// at a time. Full lines are converted directly from the input, only the
+// partial line at the end of each chunk is copied and carried forward.
+
+enum SANE_Image_Layout {
+    SANE_IMAGE_LAYOUT_RGBA = 0,
+    SANE_IMAGE_LAYOUT_BGRA,
+    SANE_IMAGE_LAYOUT_RGB,
+    SANE_IMAGE_LAYOUT_GRAY,
+};
+
+typedef void (*convert_line_fn)(const SANE_Byte *in, SANE_Byte *out, int pixels);
+
+// Preview pyramid, downsampled versions of the converted image (same
+// layout) built as the lines are converted. Level 0 is at most the preview
+// width (area filter, each pixel is the average of factor x factor image
+// pixels), each next level is half of the previous one, built from its
+// lines as they complete. The cost doesn't depend on the preview size.
+struct preview_level {
+    int factor = 1; // input (image or previous level) pixels per pixel, both directions
+    int in_width = 0;
+    int in_height = 0;
+    int width = 0;
+    int height = 0;
+    int lines = 0; // completed lines
+    int acc_lines = 0; // input lines added to acc
+    std::vector<uint64_t> acc; // sums of the current line (width * bytes per pixel)
+    std::vector<SANE_Byte> data; // width * height * bytes per pixel
+};
+
+struct image_converter {
+    SANE_Parameters params;
+    convert_line_fn convert_line = NULL;
+    int bytes_per_pixel = 0;
+    int line = 0;
+    std::vector<SANE_Byte> tail; // partial line, carried between chunks
+    std::vector<SANE_Byte> output; // converted lines, reused between chunks
+    std::vector<preview_level> preview; // preview pyramid, if enabled
+};
+
+
+template <int L>
+inline SANE_Byte *put_rgb(SANE_Byte *out, SANE_Byte r, SANE_Byte g, SANE_Byte b) {
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGBA) {
+        out[0] = r; out[1] = g; out[2] = b; out[3] = 0xff;
+        return out + 4;
+    } else if constexpr (L == SANE_IMAGE_LAYOUT_BGRA) {
+        out[0] = b; out[1] = g; out[2] = r; out[3] = 0xff;
+        return out + 4;
+    } else if constexpr (L == SANE_IMAGE_LAYOUT_RGB) {
+        out[0] = r; out[1] = g; out[2] = b;
+        return out + 3;
+    } else {
+        // ITU-R BT.601 luma, 8-bit fixed point
+        out[0] = (SANE_Byte) ((77 * r + 150 * g + 29 * b) >> 8);
+        return out + 1;
+    }
+}
+
+template <int L>
+inline SANE_Byte *put_gray(SANE_Byte *out, SANE_Byte v) {
+    if constexpr (L == SANE_IMAGE_LAYOUT_GRAY) {
+        out[0] = v;
+        return out + 1;
+    } else {
+        return put_rgb<L>(out, v, v, v);
+    }
+}
+
+#ifdef __wasm_simd128__
+// wasm_i8x16_shuffle is a macro that takes 16 lane indices, this expands the
+// PX* helpers (3 or 4 indices each) before they reach it
+#define SHUFFLE(a, b, ...) SHUFFLE_EXPAND(a, b, __VA_ARGS__)
+#define SHUFFLE_EXPAND(...) wasm_i8x16_shuffle(__VA_ARGS__)
+// lane indices for one RGBA/BGRA output pixel, the alpha lane is set with OR
+#define PX8(i) (bgr ? (i) + 2 : (i)), (i) + 1, (bgr ? (i) : (i) + 2), 0
+#define PX16(i) (bgr ? (i) + 5 : (i) + 1), (i) + 3, (bgr ? (i) + 1 : (i) + 5), 0
+#define PXG(i) (i), (i), (i), 0
+#endif
+
+template <int L>
+void convert_gray1(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    for (int p = 0; p < pixels; in++) {
+        for (int mask = 0x80; mask && p < pixels; mask >>= 1, p++) {
+            out = put_gray<L>(out, *in & mask ? 0x00 : 0xff);
+        }
+    }
+}
+
+template <int L>
+void convert_rgb1(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    // rgb is interlaced byte-by-byte not bit-by-bit, so 3 bytes have the
+    // R-G-B for 8 pixels, according to the test backend the bits are also
+    // inverted on this format (if compared with 1-bit gray)
+    for (int p = 0; p < pixels; in += 3) {
+        for (int mask = 0x80; mask && p < pixels; mask >>= 1, p++) {
+            out = put_rgb<L>(out, in[0] & mask ? 0xff : 0x00, in[1] & mask ? 0xff : 0x00, in[2] & mask ? 0xff : 0x00);
+        }
+    }
+}
+
+template <int L>
+void convert_gray8(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    int p = 0;
+    if constexpr (L == SANE_IMAGE_LAYOUT_GRAY) {
+        memcpy(out, in, pixels);
+        return;
+    }
+#ifdef __wasm_simd128__
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGBA || L == SANE_IMAGE_LAYOUT_BGRA) {
+        const v128_t alpha = wasm_i32x4_splat(0xff000000);
+        for (; p + 16 <= pixels; p += 16, in += 16, out += 64) {
+            v128_t v = wasm_v128_load(in);
+            wasm_v128_store(out, wasm_v128_or(SHUFFLE(v, v, PXG(0), PXG(1), PXG(2), PXG(3)), alpha));
+            wasm_v128_store(out + 16, wasm_v128_or(SHUFFLE(v, v, PXG(4), PXG(5), PXG(6), PXG(7)), alpha));
+            wasm_v128_store(out + 32, wasm_v128_or(SHUFFLE(v, v, PXG(8), PXG(9), PXG(10), PXG(11)), alpha));
+            wasm_v128_store(out + 48, wasm_v128_or(SHUFFLE(v, v, PXG(12), PXG(13), PXG(14), PXG(15)), alpha));
+        }
+    }
+#endif
+    for (; p < pixels; p++, in++) {
+        out = put_gray<L>(out, *in);
+    }
+}
+
+template <int L>
+void convert_rgb8(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    int p = 0;
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGB) {
+        memcpy(out, in, pixels * 3);
+        return;
+    }
+#ifdef __wasm_simd128__
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGBA || L == SANE_IMAGE_LAYOUT_BGRA) {
+        constexpr bool bgr = L == SANE_IMAGE_LAYOUT_BGRA;
+        const v128_t alpha = wasm_i32x4_splat(0xff000000);
+        // 16 pixels per iteration, 48 bytes in, 64 bytes out
+        for (; p + 16 <= pixels; p += 16, in += 48, out += 64) {
+            v128_t a = wasm_v128_load(in);
+            v128_t b = wasm_v128_load(in + 16);
+            v128_t c = wasm_v128_load(in + 32);
+            wasm_v128_store(out, wasm_v128_or(SHUFFLE(a, a, PX8(0), PX8(3), PX8(6), PX8(9)), alpha));
+            wasm_v128_store(out + 16, wasm_v128_or(SHUFFLE(a, b, PX8(12), PX8(15), PX8(18), PX8(21)), alpha));
+            wasm_v128_store(out + 32, wasm_v128_or(SHUFFLE(b, c, PX8(8), PX8(11), PX8(14), PX8(17)), alpha));
+            wasm_v128_store(out + 48, wasm_v128_or(SHUFFLE(c, c, PX8(4), PX8(7), PX8(10), PX8(13)), alpha));
+        }
+    }
+#endif
+    for (; p < pixels; p++, in += 3) {
+        out = put_rgb<L>(out, in[0], in[1], in[2]);
+    }
+}
+
+// 16-bit samples use the machine byte order (little-endian on wasm), they
+// are reduced to 8-bit by keeping the most significant byte
+
+template <int L>
+void convert_gray16(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    int p = 0;
+#ifdef __wasm_simd128__
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGBA || L == SANE_IMAGE_LAYOUT_BGRA) {
+        const v128_t alpha = wasm_i32x4_splat(0xff000000);
+        for (; p + 8 <= pixels; p += 8, in += 16, out += 32) {
+            v128_t v = wasm_v128_load(in);
+            wasm_v128_store(out, wasm_v128_or(SHUFFLE(v, v, PXG(1), PXG(3), PXG(5), PXG(7)), alpha));
+            wasm_v128_store(out + 16, wasm_v128_or(SHUFFLE(v, v, PXG(9), PXG(11), PXG(13), PXG(15)), alpha));
+        }
+    }
+#endif
+    for (; p < pixels; p++, in += 2) {
+        out = put_gray<L>(out, in[1]);
+    }
+}
+
+template <int L>
+void convert_rgb16(const SANE_Byte *in, SANE_Byte *out, int pixels) {
+    int p = 0;
+#ifdef __wasm_simd128__
+    if constexpr (L == SANE_IMAGE_LAYOUT_RGBA || L == SANE_IMAGE_LAYOUT_BGRA) {
+        constexpr bool bgr = L == SANE_IMAGE_LAYOUT_BGRA;
+        const v128_t alpha = wasm_i32x4_splat(0xff000000);
+        // 8 pixels per iteration, 48 bytes in, 32 bytes out
+        for (; p + 8 <= pixels; p += 8, in += 48, out += 32) {
+            v128_t a = wasm_v128_load(in);
+            v128_t b = wasm_v128_load(in + 16);
+            v128_t c = wasm_v128_load(in + 32);
+            wasm_v128_store(out, wasm_v128_or(SHUFFLE(a, b, PX16(0), PX16(6), PX16(12), PX16(18)), alpha));
+            wasm_v128_store(out + 16, wasm_v128_or(SHUFFLE(b, c, PX16(8), PX16(14), PX16(20), PX16(26)), alpha));
+        }
+    }
+#endif
+    for (; p < pixels; p++, in += 6) {
+        out = put_rgb<L>(out, in[1], in[3], in[5]);
+    }
+}
+
+#ifdef __wasm_simd128__
+#undef SHUFFLE
+#undef SHUFFLE_EXPAND
+#undef PX8
+#undef PX16
+#undef PXG
+#endif
+
+template <int L>
+convert_line_fn select_convert_line(const SANE_Parameters &params) {
+    bool gray = params.format == SANE_FRAME_GRAY;
+    switch (params.depth) {
+        case 1: return gray ? convert_gray1<L> : convert_rgb1<L>;
+        case 8: return gray ? convert_gray8<L> : convert_rgb8<L>;
+        case 16: return gray ? convert_gray16<L> : convert_rgb16<L>;
+    }
+    return NULL;
+}
+
+SANE_Status image_converter_begin(image_converter &conv, const SANE_Parameters &params, int layout) {
+    // we support GRAY and RGB single-pass, 1, 8 and 16-bit, known height
+    // that should cover most modern scanners
+    if (params.format != SANE_FRAME_GRAY && params.format != SANE_FRAME_RGB) {
+        return SANE_STATUS_UNSUPPORTED;
+    }
+    if (params.depth != 1 && params.depth != 8 && params.depth != 16) {
+        return SANE_STATUS_UNSUPPORTED;
+    }
+    if (!params.last_frame || params.lines <= 0) {
+        return SANE_STATUS_UNSUPPORTED; // 3-pass or hand-scanner
+    }
+    int channels = params.format == SANE_FRAME_GRAY ? 1 : 3;
+    if (
+        params.bytes_per_line <= 0 || params.pixels_per_line <= 0 ||
+        (long long) params.bytes_per_line * 8 < (long long) params.pixels_per_line * params.depth * channels
+    ) {
+        return SANE_STATUS_INVAL;
+    }
+
+    convert_line_fn fn = NULL;
+    int bpp = 0;
+    switch (layout) {
+        case SANE_IMAGE_LAYOUT_RGBA: fn = select_convert_line<SANE_IMAGE_LAYOUT_RGBA>(params); bpp = 4; break;
+        case SANE_IMAGE_LAYOUT_BGRA: fn = select_convert_line<SANE_IMAGE_LAYOUT_BGRA>(params); bpp = 4; break;
+        case SANE_IMAGE_LAYOUT_RGB: fn = select_convert_line<SANE_IMAGE_LAYOUT_RGB>(params); bpp = 3; break;
+        case SANE_IMAGE_LAYOUT_GRAY: fn = select_convert_line<SANE_IMAGE_LAYOUT_GRAY>(params); bpp = 1; break;
+    }
+    if (!fn) {
+        return SANE_STATUS_INVAL;
+    }
+
+    conv.params = params;
+    conv.convert_line = fn;
+    conv.bytes_per_pixel = bpp;
+    conv.line = 0;
+    conv.preview.clear();
+    conv.tail.clear();
+    conv.tail.reserve(params.bytes_per_line);
+    // reads are at most buffer_len bytes, size the output for the most lines
+    // a read can complete (with the tail), it doesn't grow while scanning
+    size_t out_bpl = (size_t) params.pixels_per_line * bpp;
+    conv.output.resize((buffer_len / params.bytes_per_line + 1) * out_bpl);
+    return SANE_STATUS_GOOD;
+}
+
+// Enable the preview pyramid (before converting any data), level 0 is at
+// most `width` pixels wide, up to `levels` levels (stops at 1x1).
+SANE_Status image_converter_preview(image_converter &conv, int width, int levels) {
+    if (!conv.convert_line || conv.line || !conv.tail.empty() || width <= 0 || levels <= 0) {
+        return SANE_STATUS_INVAL;
+    }
+    if (conv.params.lines <= 0) {
+        return SANE_STATUS_UNSUPPORTED; // unknown number of lines (e.g. hand scanners)
+    }
+    size_t bpp = conv.bytes_per_pixel;
+    int in_width = conv.params.pixels_per_line;
+    int in_height = conv.params.lines;
+    int factor = (in_width + width - 1) / width;
+    conv.preview.clear();
+    for (int i = 0; i < levels; i++) {
+        preview_level &lv = conv.preview.emplace_back();
+        lv.factor = factor;
+        lv.in_width = in_width;
+        lv.in_height = in_height;
+        lv.width = (in_width + factor - 1) / factor;
+        lv.height = (in_height + factor - 1) / factor;
+        lv.acc.assign(lv.width * bpp, 0);
+        lv.data.resize(lv.width * lv.height * bpp);
+        if (lv.width == 1 && lv.height == 1) {
+            break;
+        }
+        in_width = lv.width;
+        in_height = lv.height;
+        factor = 2;
+    }
+    return SANE_STATUS_GOOD;
+}
+
+// Add an input line to a preview level, a completed line is added to the
+// next level.
+void preview_add_line(std::vector<preview_level> &preview, size_t i, const SANE_Byte *in, size_t bpp) {
+    preview_level &lv = preview[i];
+    if (lv.lines >= lv.height) {
+        return; // more lines than expected
+    }
+    int f = lv.factor;
+    uint64_t *acc = lv.acc.data();
+    for (int x = 0; x < lv.width; x++, acc += bpp) {
+        int n = std::min(f, lv.in_width - x * f) * bpp;
+        for (int k = 0; k < n; k++) {
+            acc[k % bpp] += *in++;
+        }
+    }
+    lv.acc_lines++;
+    if (lv.acc_lines < f && lv.lines * f + lv.acc_lines < lv.in_height) {
+        return;
+    }
+    // line complete (or last input line), average
+    acc = lv.acc.data();
+    SANE_Byte *out = lv.data.data() + lv.lines * lv.width * bpp;
+    for (int x = 0; x < lv.width; x++) {
+        uint64_t div = (uint64_t) std::min(f, lv.in_width - x * f) * lv.acc_lines;
+        for (size_t c = 0; c < bpp; c++, acc++) {
+            *out++ = (*acc + div / 2) / div;
+            *acc = 0;
+        }
+    }
+    lv.acc_lines = 0;
+    lv.lines++;
+    if (i + 1 < preview.size()) {
+        preview_add_line(preview, i + 1, out - lv.width * bpp, bpp);
+    }
+}
+
+// Convert a chunk of raw data, returns the number of full lines written to
+// conv.output (they start at line conv.line - lines).
+int image_converter_write(image_converter &conv, const SANE_Byte *in, size_t len) {
+    size_t bpl = conv.params.bytes_per_line;
+    size_t lines = (conv.tail.size() + len) / bpl;
+    if (!lines) {
+        // not enough data for a full line
+        conv.tail.insert(conv.tail.end(), in, in + len);
+        return 0;
+    }
+
+    size_t out_bpl = (size_t) conv.params.pixels_per_line * conv.bytes_per_pixel;
+    if (conv.output.size() < lines * out_bpl) {
+        conv.output.resize(lines * out_bpl);
+    }
+    SANE_Byte *out = conv.output.data();
+    size_t l = 0;
+
+    // complete the partial line from the previous chunk
+    if (!conv.tail.empty()) {
+        size_t n = bpl - conv.tail.size();
+        conv.tail.insert(conv.tail.end(), in, in + n);
+        conv.convert_line(conv.tail.data(), out, conv.params.pixels_per_line);
+        conv.tail.clear();
+        in += n;
+        len -= n;
+        out += out_bpl;
+        l++;
+    }
+
+    // convert all other full lines in place
+    for (; l < lines; l++, in += bpl, len -= bpl, out += out_bpl) {
+        conv.convert_line(in, out, conv.params.pixels_per_line);
+    }
+
+    conv.tail.insert(conv.tail.end(), in, in + len);
+    conv.line += lines;
+    if (!conv.preview.empty()) {
+        for (l = 0, out = conv.output.data(); l < lines; l++, out += out_bpl) {
+            preview_add_line(conv.preview, 0, out, conv.bytes_per_pixel);
+        }
+    }
+    return lines;
+}
+
+void image_converter_end(image_converter &conv) {
+    conv.convert_line = NULL;
+    // release memory, a full scan can leave large buffers behind
+    std::vector<SANE_Byte>().swap(conv.tail);
+    std::vector<SANE_Byte>().swap(conv.output);
+    std::vector<preview_level>().swap(conv.preview);
+}
+
+// Gets direct access to the bytes of a Uint8Array. Views that point to the
+// module memory (e.g. the data returned by sane_read) are used in place,
+// other arrays are copied to the storage vector.
+const SANE_Byte *uint8array_data(const val &data, size_t &len, std::vector<SANE_Byte> &storage) {
+    len = data["length"].as<size_t>();
+    if (data["buffer"].strictlyEquals(val::module_property("HEAPU8")["buffer"])) {
+        return (const SANE_Byte *) data["byteOffset"].as<uintptr_t>();
+    }
+    storage = convertJSArrayToNumberVector<SANE_Byte>(data);
+    return storage.data();
+}
+
+val sane_parameters_to_val(const SANE_Parameters &params) {
+    val parameters = val::object();
+    parameters.set("format", (int) params.format);
+    parameters.set("last_frame", (bool) params.last_frame);
+    parameters.set("bytes_per_line", params.bytes_per_line);
+    parameters.set("pixels_per_line", params.pixels_per_line);
+    parameters.set("lines", params.lines);
+    parameters.set("depth", params.depth);
+    return parameters;
+}
+
+void sane_parameters_from_val(const val &v, SANE_Parameters &params) {
+    params.format = (SANE_Frame) v["format"].as<int>();
+    params.last_frame = v["last_frame"].as<bool>() ? SANE_TRUE : SANE_FALSE;
+    params.bytes_per_line = v["bytes_per_line"].as<int>();
+    params.pixels_per_line = v["pixels_per_line"].as<int>();
+    params.lines = v["lines"].as<int>();
+    params.depth = v["depth"].as<int>();
+}
+
+// Image encoding (sane-wasm, not part of SANE API)
+
+// Encodes raw SANE data to compressed images (JPEG or PNG) line by line as
+// the data arrives, the full uncompressed image never exists in memory.
+// Uses its own image_converter (to RGB or GRAY) so it can run side by side
+// with sane_image_*.
+// TIFF is not supported, the first IFD offset (in the header) is only known
+// after the compressed data is written and the header was already returned.
+
+#define ENCODER_JPEG_BUFFER_LEN 64*1024
+#define ENCODER_ZLIB_BUFFER_LEN 64*1024
+
+enum SANE_Image_Format {
+    SANE_IMAGE_FORMAT_JPEG = 0,
+    SANE_IMAGE_FORMAT_PNG,
+};
+
+struct jpeg_error_jmp {
+    jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+struct image_encoder {
+    int format = -1; // -1 = not started
+    image_converter conv;
+    int lines = 0; // lines encoded
+    std::vector<SANE_Byte> out; // encoded data, since the last call
+    std::vector<SANE_Byte> row; // scratch row (png filter)
+    std::vector<SANE_Byte> prev; // previous row (png filter) or padding row
+    // JPEG
+    jpeg_compress_struct jpeg;
+    jpeg_error_jmp jpeg_err;
+    jpeg_destination_mgr jpeg_dest;
+    std::vector<SANE_Byte> jpeg_buf;
+    // PNG
+    z_stream zs;
+    std::vector<SANE_Byte> zbuf;
+    std::vector<SANE_Byte> idat;
+};
+
+
+void jpeg_error_exit_jmp(j_common_ptr cinfo) {
+    longjmp(((jpeg_error_jmp *) cinfo->err)->jmp, 1);
+}
+
+void jpeg_output_message_discard(j_common_ptr cinfo) {
+}
+
+// moves the data written by libjpeg to enc.out
+void jpeg_dest_flush(j_compress_ptr cinfo) {
+    image_encoder &enc = *(image_encoder *) cinfo->client_data;
+    size_t n = enc.jpeg_buf.size() - enc.jpeg_dest.free_in_buffer;
+    enc.out.insert(enc.out.end(), enc.jpeg_buf.begin(), enc.jpeg_buf.begin() + n);
+    enc.jpeg_dest.next_output_byte = enc.jpeg_buf.data();
+    enc.jpeg_dest.free_in_buffer = enc.jpeg_buf.size();
+}
+
+void jpeg_dest_init(j_compress_ptr cinfo) {
+}
+
+boolean jpeg_dest_empty(j_compress_ptr cinfo) {
+    jpeg_dest_flush(cinfo);
+    return TRUE;
+}
+
+void put_be32(std::vector<SANE_Byte> &v, uint32_t x) {
+    SANE_Byte b[4] = {(SANE_Byte) (x >> 24), (SANE_Byte) (x >> 16), (SANE_Byte) (x >> 8), (SANE_Byte) x};
+    v.insert(v.end(), b, b + 4);
+}
+
+void png_chunk(std::vector<SANE_Byte> &v, const char *type, const SANE_Byte *data, size_t len) {
+    put_be32(v, len);
+    size_t start = v.size();
+    v.insert(v.end(), type, type + 4);
+    v.insert(v.end(), data, data + len);
+    put_be32(v, crc32(0, v.data() + start, len + 4));
+}
+
+// deflate with the zlib stream input already set, output goes to enc.idat
+int png_deflate(image_encoder &enc, int flush) {
+    int ret;
+    do {
+        enc.zs.next_out = enc.zbuf.data();
+        enc.zs.avail_out = enc.zbuf.size();
+        ret = deflate(&enc.zs, flush);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return ret;
+        }
+        enc.idat.insert(enc.idat.end(), enc.zbuf.data(), enc.zs.next_out);
+    } while (enc.zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return Z_OK;
+}
+
+SANE_Status image_encoder_rows(image_encoder &enc, const SANE_Byte *rows, int n, size_t stride) {
+    n = std::min(n, enc.conv.params.lines - enc.lines); // ignore extra lines
+    if (n <= 0) {
+        return SANE_STATUS_GOOD;
+    }
+    if (enc.format == SANE_IMAGE_FORMAT_JPEG) {
+        if (setjmp(enc.jpeg_err.jmp)) {
+            return SANE_STATUS_IO_ERROR;
+        }
+        for (int i = 0; i < n; i++) {
+            JSAMPROW row = (JSAMPROW) (rows + i * stride);
+            jpeg_write_scanlines(&enc.jpeg, &row, 1);
+        }
+        jpeg_dest_flush(&enc.jpeg);
+    } else {
+        // filter type 2 (Up), cheap and works well on scanned images
+        for (int i = 0; i < n; i++) {
+            const SANE_Byte *cur = rows + i * stride;
+            enc.row[0] = 2;
+            for (size_t j = 0; j < stride; j++) {
+                enc.row[j + 1] = cur[j] - enc.prev[j];
+            }
+            memcpy(enc.prev.data(), cur, stride);
+            enc.zs.next_in = enc.row.data();
+            enc.zs.avail_in = enc.row.size();
+            if (png_deflate(enc, Z_NO_FLUSH) != Z_OK) {
+                return SANE_STATUS_IO_ERROR;
+            }
+        }
+        if (!enc.idat.empty()) {
+            png_chunk(enc.out, "IDAT", enc.idat.data(), enc.idat.size());
+            enc.idat.clear();
+        }
+    }
+    enc.lines += n;
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status image_encoder_begin(image_encoder &enc, const SANE_Parameters &params, int format, int quality, int level) {
+    if (format != SANE_IMAGE_FORMAT_JPEG && format != SANE_IMAGE_FORMAT_PNG) {
+        return SANE_STATUS_INVAL;
+    }
+    int layout = params.format == SANE_FRAME_GRAY ? SANE_IMAGE_LAYOUT_GRAY : SANE_IMAGE_LAYOUT_RGB;
+    SANE_Status status = image_converter_begin(enc.conv, params, layout);
+    if (status != SANE_STATUS_GOOD) {
+        return status;
+    }
+    size_t stride = (size_t) params.pixels_per_line * enc.conv.bytes_per_pixel;
+
+    enc.out.clear();
+    enc.lines = 0;
+    if (format == SANE_IMAGE_FORMAT_JPEG) {
+        if (params.pixels_per_line > 65500 || params.lines > 65500) {
+            image_converter_end(enc.conv);
+            return SANE_STATUS_UNSUPPORTED; // JPEG size limit
+        }
+        enc.jpeg.err = jpeg_std_error(&enc.jpeg_err.pub);
+        enc.jpeg_err.pub.error_exit = jpeg_error_exit_jmp;
+        enc.jpeg_err.pub.output_message = jpeg_output_message_discard;
+        if (setjmp(enc.jpeg_err.jmp)) {
+            jpeg_destroy_compress(&enc.jpeg);
+            image_converter_end(enc.conv);
+            return SANE_STATUS_INVAL;
+        }
+        jpeg_create_compress(&enc.jpeg);
+        enc.jpeg_buf.resize(ENCODER_JPEG_BUFFER_LEN);
+        enc.jpeg_dest.next_output_byte = enc.jpeg_buf.data();
+        enc.jpeg_dest.free_in_buffer = enc.jpeg_buf.size();
+        enc.jpeg_dest.init_destination = jpeg_dest_init;
+        enc.jpeg_dest.empty_output_buffer = jpeg_dest_empty;
+        enc.jpeg_dest.term_destination = jpeg_dest_flush;
+        enc.jpeg.dest = &enc.jpeg_dest;
+        enc.jpeg.client_data = &enc;
+        enc.jpeg.image_width = params.pixels_per_line;
+        enc.jpeg.image_height = params.lines;
+        enc.jpeg.input_components = enc.conv.bytes_per_pixel;
+        enc.jpeg.in_color_space = enc.conv.bytes_per_pixel == 1 ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_set_defaults(&enc.jpeg);
+        jpeg_set_quality(&enc.jpeg, std::clamp(quality, 1, 100), TRUE);
+        jpeg_start_compress(&enc.jpeg, TRUE);
+        jpeg_dest_flush(&enc.jpeg);
+    } else {
+        memset(&enc.zs, 0, sizeof(enc.zs));
+        if (deflateInit(&enc.zs, std::clamp(level, 0, 9)) != Z_OK) {
+            image_converter_end(enc.conv);
+            return SANE_STATUS_NO_MEM;
+        }
+        enc.zbuf.resize(ENCODER_ZLIB_BUFFER_LEN);
+        enc.row.assign(stride + 1, 0);
+        enc.idat.clear();
+        static const SANE_Byte signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        enc.out.insert(enc.out.end(), signature, signature + sizeof(signature));
+        std::vector<SANE_Byte> ihdr;
+        put_be32(ihdr, params.pixels_per_line);
+        put_be32(ihdr, params.lines);
+        ihdr.push_back(8); // bit depth
+        ihdr.push_back(enc.conv.bytes_per_pixel == 1 ? 0 : 2); // color type, gray or rgb
+        ihdr.push_back(0); // compression
+        ihdr.push_back(0); // filter
+        ihdr.push_back(0); // interlace
+        png_chunk(enc.out, "IHDR", ihdr.data(), ihdr.size());
+    }
+    enc.prev.assign(stride, 0);
+    enc.format = format;
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status image_encoder_write(image_encoder &enc, const SANE_Byte *in, size_t len) {
+    enc.out.clear();
+    int lines = image_converter_write(enc.conv, in, len);
+    size_t stride = (size_t) enc.conv.params.pixels_per_line * enc.conv.bytes_per_pixel;
+    return image_encoder_rows(enc, enc.conv.output.data(), lines, stride);
+}
+
+// Finishes the image, missing lines (e.g. cancelled scan) are filled with
+// white. The encoder is always released, even on error.
+SANE_Status image_encoder_end(image_encoder &enc) {
+    SANE_Status status = SANE_STATUS_GOOD;
+    size_t stride = (size_t) enc.conv.params.pixels_per_line * enc.conv.bytes_per_pixel;
+    std::vector<SANE_Byte> white(stride, 0xff);
+    enc.out.clear();
+    while (status == SANE_STATUS_GOOD && enc.lines < enc.conv.params.lines) {
+        status = image_encoder_rows(enc, white.data(), 1, stride);
+    }
+    if (enc.format == SANE_IMAGE_FORMAT_JPEG) {
+        if (status == SANE_STATUS_GOOD && !setjmp(enc.jpeg_err.jmp)) {
+            jpeg_finish_compress(&enc.jpeg);
+        } else {
+            status = SANE_STATUS_IO_ERROR;
+        }
+        jpeg_destroy_compress(&enc.jpeg);
+        std::vector<SANE_Byte>().swap(enc.jpeg_buf);
+    } else {
+        if (status == SANE_STATUS_GOOD) {
+            enc.zs.next_in = NULL;
+            enc.zs.avail_in = 0;
+            if (png_deflate(enc, Z_FINISH) == Z_OK) {
+                png_chunk(enc.out, "IDAT", enc.idat.data(), enc.idat.size());
+                png_chunk(enc.out, "IEND", NULL, 0);
+            } else {
+                status = SANE_STATUS_IO_ERROR;
+            }
+        }
+        deflateEnd(&enc.zs);
+        std::vector<SANE_Byte>().swap(enc.zbuf);
+        std::vector<SANE_Byte>().swap(enc.idat);
+        std::vector<SANE_Byte>().swap(enc.row);
+    }
+    std::vector<SANE_Byte>().swap(enc.prev);
+    image_converter_end(enc.conv);
+    enc.format = -1;
+    return status;
+}
+
+// Read stream (sane-wasm, not part of SANE API)
+
+// The helper thread keeps reading into a ring of buffers (slots) while JS
+// consumes the filled ones. Filled slots are handed to JS as views over the
+// module memory (no copies), JS must release them when done. When all slots
+// are in use the helper thread waits (a stall, backpressure from JS).
+//
+// In batch mode (document feeders) the loop doesn't end at EOF, it marks the
+// end of the page and calls sane_start for the next one right away, so the
+// next sheet is fed while JS is still processing the previous one. The batch
+// ends with SANE_STATUS_NO_DOCS (empty feeder).
+
+#define READ_STREAM_PAGE_END -1 // filled_slots marker, EOF of a page
+#define READ_STREAM_PAGE_START -2 // filled_slots marker, next page started
+
+struct read_stream {
+    const backend *be = NULL;
+    SANE_Handle handle = NULL;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::vector<SANE_Byte>> slots;
+    std::vector<SANE_Int> lengths;
+    std::deque<int> free_slots;
+    std::deque<int> filled_slots; // slots and page markers, in order
+    std::deque<SANE_Parameters> pages; // parameters for each PAGE_START
+    bool batch = false; // keep going after EOF
+    bool active = false; // started and not stopped yet
+    bool running = false; // helper thread loop is running
+    std::atomic<bool> stop = false;
+    SANE_Status status = SANE_STATUS_GOOD; // final status (after the loop ends)
+    std::coroutine_handle<> waiter = nullptr; // sane_read_stream_next waiting
+    int nexts = 0; // sane_read_stream_next calls in progress (main thread only)
+    std::vector<std::coroutine_handle<>> drain_waiters; // waiting for nexts == 0 (main thread only)
+    // counters
+    int reads = 0;
+    long long bytes = 0;
+    int stalls = 0;
+    double stall_ms = 0;
+    int waits = 0;
+    double wait_ms = 0;
+};
+
+// wake the coroutine waiting on sane_read_stream_next (call with lock held)
+void read_stream_wake(read_stream &stream) {
+    if (stream.waiter) {
+        std::coroutine_handle<> h = stream.waiter;
+        stream.waiter = nullptr;
+        queue.proxyAsync(emscripten_main_runtime_thread_id(), [h] { h.resume(); });
+    }
+}
+
+void read_stream_main(read_stream &stream) {
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    while (true) {
+        if (stream.free_slots.empty() && !stream.stop) {
+            stream.stalls++;
+            double t = emscripten_get_now();
+            stream.cond.wait(lock, [&stream] { return !stream.free_slots.empty() || stream.stop; });
+            stream.stall_ms += emscripten_get_now() - t;
+        }
+        if (stream.stop) {
+            stream.status = SANE_STATUS_CANCELLED;
+            break;
+        }
+
+        int slot = stream.free_slots.front();
+        stream.free_slots.pop_front();
+        lock.unlock();
+        SANE_Int len = 0;
+        SANE_Status status = read_until_data(stream.be, stream.handle, stream.slots[slot].data(), stream.slots[slot].size(), &len, &stream.stop);
+        lock.lock();
+
+        if (status == SANE_STATUS_GOOD && len > 0) {
+            stream.lengths[slot] = len;
+            stream.filled_slots.push_back(slot);
+            stream.reads++;
+            stream.bytes += len;
+            read_stream_wake(stream);
+            continue;
+        }
+        stream.free_slots.push_front(slot);
+        if (status == SANE_STATUS_EOF && stream.batch && !stream.stop) {
+            stream.filled_slots.push_back(READ_STREAM_PAGE_END);
+            read_stream_wake(stream);
+            lock.unlock();
+            SANE_Parameters params;
+            status = stream.be->start(stream.handle);
+            if (status == SANE_STATUS_GOOD) {
+                status = stream.be->get_parameters(stream.handle, &params);
+            }
+            lock.lock();
+            if (status == SANE_STATUS_GOOD) {
+                stream.pages.push_back(params);
+                stream.filled_slots.push_back(READ_STREAM_PAGE_START);
+                read_stream_wake(stream);
+                continue;
+            }
+            // NO_DOCS (the normal end of the batch) or an error
+        }
+        if (status != SANE_STATUS_GOOD) {
+            stream.status = status;
+            break;
+        }
+    }
+    stream.running = false;
+    read_stream_wake(stream);
+}
+
+struct read_stream_awaiter : std::suspend_always {
+    read_stream &stream;
+    double start = 0;
+    bool await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (!stream.filled_slots.empty() || !stream.running) {
+            return false; // don't suspend
+        }
+        start = emscripten_get_now();
+        stream.waiter = h;
+        stream.waits++;
+        return true;
+    }
+    void await_resume() {
+        if (start) {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            stream.wait_ms += emscripten_get_now() - start;
+        }
+    }
+};
+
+// Asks the helper thread loop to stop, returns true if the stream is active,
+// in that case the caller must wait for the helper thread (run anything on
+// it) and then call read_stream_free.
+bool read_stream_request_stop(read_stream &stream) {
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    if (!stream.active) {
+        return false;
+    }
+    stream.stop = true;
+    stream.cond.notify_all();
+    return true;
+}
+
+// Counts a sane_read_stream_next call in progress. Close/cancel/stop run
+// on another scheduler resource (see pre.js), they wait for these calls
+// (read_stream_drain) before freeing the slots or the device.
+struct read_stream_next_guard {
+    read_stream &stream;
+    read_stream_next_guard(read_stream &stream) : stream(stream) {
+        stream.nexts++;
+    }
+    ~read_stream_next_guard() {
+        if (--stream.nexts == 0) {
+            // resumed later, the call is still returning
+            for (std::coroutine_handle<> h : stream.drain_waiters) {
+                queue.proxyAsync(emscripten_main_runtime_thread_id(), [h] { h.resume(); });
+            }
+            stream.drain_waiters.clear();
+        }
+    }
+};
+
+// Waits for the sane_read_stream_next calls in progress to return (they
+// return SANE_STATUS_CANCELLED once the stream is stopped).
+struct read_stream_drain : std::suspend_always {
+    read_stream &stream;
+    bool await_suspend(std::coroutine_handle<> h) {
+        if (!stream.nexts) {
+            return false; // don't suspend
+        }
+        stream.drain_waiters.push_back(h);
+        return true;
+    }
+};
+
+void read_stream_free(read_stream &stream) {
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    stream.active = false;
+    stream.slots.clear();
+    stream.slots.shrink_to_fit();
+    stream.lengths.clear();
+    stream.free_slots.clear();
+    stream.filled_slots.clear();
+    stream.pages.clear();
+}
+
+// Option cache (sane-wasm, not part of SANE API)
+
+// Reading all options one by one from JS costs two calls per option (the
+// descriptor and the value), sane_get_all_options reads everything in a
+// single call. The descriptors (and their JS objects) are kept until the
+// backend signals SANE_INFO_RELOAD_OPTIONS, only the values are read again.
+// sane_set_option sets a value and compares the options with the cached
+// ones, returning only what changed (a reload usually touches a few).
+
+val option_descriptor_to_val(const SANE_Option_Descriptor *desc) {
+    // convert size, we don't need to expose size in byte units
+    // for the frontend is more useful in "number of words" (items)
+    int size = desc->size;
+    switch (desc->type) {
+        case SANE_TYPE_BOOL: size = size/sizeof(SANE_Bool); break;
+        case SANE_TYPE_INT: size = size/sizeof(SANE_Int); break;
+        case SANE_TYPE_FIXED: size = size/sizeof(SANE_Fixed); break;
+        case SANE_TYPE_STRING: size = size/sizeof(SANE_Char) - 1; break;
+        case SANE_TYPE_BUTTON: break;
+        case SANE_TYPE_GROUP: break;
+    }
+
+    // decode and convert constraint
+    val constraint = val::null();
+    if (desc->constraint_type == SANE_CONSTRAINT_RANGE) {
+        constraint = val::object();
+        if (desc->type == SANE_TYPE_FIXED) {
+            constraint.set("min", SANE_UNFIX(desc->constraint.range->min));
+            constraint.set("max", SANE_UNFIX(desc->constraint.range->max));
+            constraint.set("quant", SANE_UNFIX(desc->constraint.range->quant));
+        } else {
+            constraint.set("min", desc->constraint.range->min);
+            constraint.set("max", desc->constraint.range->max);
+            constraint.set("quant", desc->constraint.range->quant);
+        }
+    } else if (desc->constraint_type == SANE_CONSTRAINT_WORD_LIST) {
+        constraint = val::array();
+        if (desc->type == SANE_TYPE_FIXED) {
+            for (int i = 1; i <= desc->constraint.word_list[0]; i++) {
+                constraint.call<void>("push", SANE_UNFIX(desc->constraint.word_list[i]));
+            }
+        } else {
+            for (int i = 1; i <= desc->constraint.word_list[0]; i++) {
+                constraint.call<void>("push", desc->constraint.word_list[i]);
+            }
+        }
+    } else if (desc->constraint_type == SANE_CONSTRAINT_STRING_LIST) {
+        constraint = val::array();
+        for (const SANE_String_Const *str = desc->constraint.string_list; *str != NULL; str++) {
+            constraint.call<void>("push", val(*str));
+        }
+    }
+
+    // construct final object
+    val option_descriptor = val::object();
+    option_descriptor.set("name", desc->name);
+    option_descriptor.set("title", desc->title);
+    option_descriptor.set("desc", desc->desc);
+    option_descriptor.set("type", (int) desc->type);
+    option_descriptor.set("unit", (int) desc->unit);
+    option_descriptor.set("size", size);
+    option_descriptor.set("cap", bitmap_cap_to_val(desc->cap));
+    option_descriptor.set("constraint_type", (int) desc->constraint_type);
+    option_descriptor.set("constraint", constraint);
+    return option_descriptor;
+}
+
+val option_value_to_val(const SANE_Option_Descriptor *desc, const void *v) {
+    val value = val::null();
+    int n;
+    switch (desc->type) {
+        case SANE_TYPE_BOOL:
+            value = val((bool) *((const SANE_Bool *) v));
+            break;
+        case SANE_TYPE_INT:
+            n = desc->size/sizeof(SANE_Int);
+            if (n == 1) {
+                value = val(*((const SANE_Int *) v));
+            } else if (n > 1) {
+                value = val::array();
+                for (int i = 0; i < n; i++) {
+                    value.call<void>("push", ((const SANE_Int *) v)[i]);
+                }
+            }
+            break;
+        case SANE_TYPE_FIXED:
+            n = desc->size/sizeof(SANE_Fixed);
+            if (n == 1) {
+                value = val(SANE_UNFIX(*((const SANE_Fixed *) v)));
+            } else if (n > 1) {
+                value = val::array();
+                for (int i = 0; i < n; i++) {
+                    value.call<void>("push", SANE_UNFIX(((const SANE_Fixed *) v)[i]));
+                }
+            }
+            break;
+        case SANE_TYPE_STRING:
+            value = val((SANE_String_Const) v);
+            break;
+        case SANE_TYPE_BUTTON:
+        case SANE_TYPE_GROUP:
+        default:
+            break;
+    }
+    return value;
+}
+
+// Converts a JS value to a SANE option value (v has desc->size bytes),
+// returns false if the value type is not valid for the option.
+bool option_value_from_val(const SANE_Option_Descriptor *desc, const val &value, void *v) {
+    if (desc->size <= 0) {
+        // no value (buttons, groups), anything else is a broken descriptor
+        return desc->type == SANE_TYPE_BUTTON || desc->type == SANE_TYPE_GROUP;
+    }
+    int n;
+    bool inval = false;
+    switch (desc->type) {
+        case SANE_TYPE_BOOL:
+            if (value.isTrue()) {
+                *((SANE_Bool *) v) = SANE_TRUE;
+            } else if (value.isFalse()) {
+                *((SANE_Bool *) v) = SANE_FALSE;
+            } else {
+                inval = true;
+            }
+            break;
+        case SANE_TYPE_INT:
+            n = desc->size/sizeof(SANE_Int);
+            if (n == 1) {
+                if (value.isNumber()) {
+                    *((SANE_Int *) v) = value.as<int>();
+                } else {
+                    inval = true;
+                }
+            } else if (n > 1) {
+                if (value.isArray()) {
+                    auto vec = vecFromJSArray<int>(value);
+                    for (int i = 0; i < vec.size() && i < n; i++) {
+                        ((SANE_Int *) v)[i] = vec[i];
+                    }
+                } else {
+                    inval = true;
+                }
+            }
+            break;
+        case SANE_TYPE_FIXED:
+            n = desc->size/sizeof(SANE_Fixed);
+            if (n == 1) {
+                if (value.isNumber()) {
+                    *((SANE_Fixed *) v) = SANE_FIX(value.as<double>());
+                } else {
+                    inval = true;
+                }
+            } else if (n > 1) {
+                if (value.isArray()) {
+                    auto vec = vecFromJSArray<double>(value);
+                    for (int i = 0; i < vec.size() && i < n; i++) {
+                        ((SANE_Fixed *) v)[i] = SANE_FIX(vec[i]);
+                    }
+                } else {
+                    inval = true;
+                }
+            }
+            break;
+        case SANE_TYPE_STRING:
+            if (value.isString()) {
+                int n = desc->size/sizeof(SANE_Char) - 1;
+                std::string str = value.as<std::string>();
+                strncpy((char *) v, str.c_str(), n);
+                ((char *) v)[n] = 0x00;
+            } else {
+                inval = true;
+            }
+            break;
+        case SANE_TYPE_BUTTON:
+        case SANE_TYPE_GROUP:
+        default:
+            break;
+    }
+    return !inval;
+}
+
+// Same as ScanOptionsBase, options without a readable value use null.
+bool option_is_readable(const SANE_Option_Descriptor *desc) {
+    return SANE_OPTION_IS_ACTIVE(desc->cap) && (desc->cap & SANE_CAP_SOFT_DETECT) && desc->type != SANE_TYPE_BUTTON && desc->size > 0;
+}
+
+// Copy of a backend descriptor (strings and constraint included), made on
+// the helper thread. The backends own their descriptors and change or free
+// them on reload and close, the main thread only uses these copies.
+struct option_descriptor_copy {
+    SANE_Option_Descriptor desc = {}; // points to the fields below
+    std::string name, title, text;
+    SANE_Range range = {};
+    std::vector<SANE_Word> words;
+    std::vector<std::string> strings;
+    std::vector<SANE_String_Const> string_list;
+};
+
+typedef std::shared_ptr<const option_descriptor_copy> option_descriptor_ref;
+
+option_descriptor_ref option_descriptor_copy_of(const SANE_Option_Descriptor *src) {
+    auto copy = std::make_shared<option_descriptor_copy>();
+    SANE_Option_Descriptor &desc = copy->desc;
+    desc = *src;
+    // the strings are not moved after this (the copy is not moved either)
+    copy->name = src->name ? src->name : "";
+    copy->title = src->title ? src->title : "";
+    copy->text = src->desc ? src->desc : "";
+    desc.name = src->name ? copy->name.c_str() : NULL;
+    desc.title = src->title ? copy->title.c_str() : NULL;
+    desc.desc = src->desc ? copy->text.c_str() : NULL;
+    if (src->constraint_type == SANE_CONSTRAINT_RANGE) {
+        copy->range = *src->constraint.range;
+        desc.constraint.range = &copy->range;
+    } else if (src->constraint_type == SANE_CONSTRAINT_WORD_LIST) {
+        copy->words.assign(src->constraint.word_list, src->constraint.word_list + src->constraint.word_list[0] + 1);
+        desc.constraint.word_list = copy->words.data();
+    } else if (src->constraint_type == SANE_CONSTRAINT_STRING_LIST) {
+        for (const SANE_String_Const *str = src->constraint.string_list; *str != NULL; str++) {
+            copy->strings.push_back(*str);
+        }
+        for (const std::string &str : copy->strings) {
+            copy->string_list.push_back(str.c_str());
+        }
+        copy->string_list.push_back(NULL);
+        desc.constraint.string_list = copy->string_list.data();
+    } else {
+        desc.constraint_type = SANE_CONSTRAINT_NONE;
+    }
+    return copy;
+}
+
+struct option_cache {
+    bool valid = false; // descriptors valid (no RELOAD_OPTIONS since read)
+    int reloads = 0; // descriptors read count, to find reloads by other calls
+    std::vector<option_descriptor_ref> descs;
+    std::vector<std::string> sigs; // descriptor contents, to find changes
+    std::vector<val> descriptors; // JS objects
+    std::vector<std::vector<SANE_Byte>> values; // last values read
+};
+
+// Raw options read on the helper thread, the cache itself is only used on
+// the main thread.
+struct option_snapshot {
+    bool reload = false; // read the descriptors too
+    int only = -1; // read only this value (-1 = all, -2 = none)
+    std::vector<option_descriptor_ref> descs; // copies, not the backend's
+    std::vector<std::string> sigs;
+    std::vector<std::vector<SANE_Byte>> values; // raw values (empty if not readable)
+};
+
+template <typename T>
+void append_bytes(std::string &str, const T &v) {
+    str.append((const char *) &v, sizeof(T));
+}
+
+// Serializes the descriptor contents, to find what changed on reload (the
+// copies are new on every read).
+std::string option_descriptor_signature(const SANE_Option_Descriptor *desc) {
+    std::string sig;
+    for (const char *str : {desc->name, desc->title, desc->desc}) {
+        sig.append(str ? str : "");
+        sig.push_back(0);
+    }
+    append_bytes(sig, desc->type);
+    append_bytes(sig, desc->unit);
+    append_bytes(sig, desc->size);
+    append_bytes(sig, desc->cap);
+    append_bytes(sig, desc->constraint_type);
+    if (desc->constraint_type == SANE_CONSTRAINT_RANGE) {
+        append_bytes(sig, *desc->constraint.range);
+    } else if (desc->constraint_type == SANE_CONSTRAINT_WORD_LIST) {
+        sig.append((const char *) desc->constraint.word_list, (desc->constraint.word_list[0] + 1) * sizeof(SANE_Word));
+    } else if (desc->constraint_type == SANE_CONSTRAINT_STRING_LIST) {
+        for (const SANE_String_Const *str = desc->constraint.string_list; *str != NULL; str++) {
+            sig.append(*str);
+            sig.push_back(0);
+        }
+    }
+    return sig;
+}
+
+// Reads the descriptors (if snap.reload) and the readable values.
+// Only call this from the device's helper thread.
+SANE_Status option_snapshot_read(const backend *be, SANE_Handle handle, option_snapshot &snap) {
+    if (snap.reload) {
+        snap.descs.clear();
+        snap.sigs.clear();
+        const SANE_Option_Descriptor *desc;
+        for (int i = 0; (desc = be->get_option_descriptor(handle, i)); i++) {
+            snap.descs.push_back(option_descriptor_copy_of(desc));
+            snap.sigs.push_back(option_descriptor_signature(desc));
+        }
+        if (snap.descs.empty()) {
+            return SANE_STATUS_INVAL;
+        }
+    }
+    snap.values.resize(snap.descs.size());
+    for (size_t i = 0; i < snap.descs.size(); i++) {
+        const SANE_Option_Descriptor *desc = &snap.descs[i]->desc;
+        if ((snap.only != -1 && (int) i != snap.only) || !option_is_readable(desc)) {
+            continue;
+        }
+        snap.values[i].resize(desc->size);
+        SANE_Status status = be->control_option(handle, i, SANE_ACTION_GET_VALUE, snap.values[i].data(), NULL);
+        if (status != SANE_STATUS_GOOD) {
+            return status;
+        }
+    }
+    return SANE_STATUS_GOOD;
+}
+
+// Reads only the descriptors, for the cache (on open and after
+// RELOAD_OPTIONS), the option calls get the descriptors from the cache.
+// Only call this from the device's helper thread.
+SANE_Status option_snapshot_read_descriptors(const backend *be, SANE_Handle handle, option_snapshot &snap) {
+    snap.reload = true;
+    snap.only = -2;
+    return option_snapshot_read(be, handle, snap);
+}
+
+val option_cache_option_to_val(option_cache &cache, size_t i) {
+    val option = val::object();
+    option.set("index", (int) i);
+    option.set("descriptor", cache.descriptors[i]);
+    option.set("value", cache.values[i].empty() ? val::null() : option_value_to_val(&cache.descs[i]->desc, cache.values[i].data()));
+    return option;
+}
+
+// Applies a snapshot to the cache, returns the options (same format as
+// ScanOptionsBase.options) with a new descriptor or value, plus option
+// `always` (if >= 0). The descriptor objects are only rebuilt when the
+// descriptor changed.
+val option_cache_update(option_cache &cache, const option_snapshot &snap, int always = -1) {
+    size_t n = snap.descs.size();
+    std::vector<std::string> old_sigs;
+    if (snap.reload) {
+        if (cache.valid) {
+            old_sigs.swap(cache.sigs);
+        }
+        cache.valid = true;
+        cache.reloads++;
+        cache.descs = snap.descs;
+        cache.sigs = snap.sigs;
+        cache.descriptors.resize(n, val::null());
+        cache.values.resize(n);
+    }
+    val changes = val::array();
+    for (size_t i = 0; i < n; i++) {
+        bool desc_changed = snap.reload && (i >= old_sigs.size() || old_sigs[i] != snap.sigs[i]);
+        bool read = snap.only == -1 || (int) i == snap.only;
+        bool value_changed = desc_changed || (read && snap.values[i] != cache.values[i]);
+        if (desc_changed) {
+            cache.descriptors[i] = option_descriptor_to_val(&snap.descs[i]->desc);
+        }
+        if (read) {
+            cache.values[i] = snap.values[i];
+        } else if (desc_changed) {
+            cache.values[i].clear(); // not read, unknown
+        }
+        if (value_changed || (int) i == always) {
+            changes.call<void>("push", option_cache_option_to_val(cache, i));
+        }
+    }
+    return changes;
+}
+
+val option_cache_to_val(option_cache &cache) {
+    val options = val::array();
+    for (size_t i = 0; i < cache.descs.size(); i++) {
+        options.call<void>("push", option_cache_option_to_val(cache, i));
+    }
+    return options;
+}
+
+// Applies a option_snapshot_read_descriptors snapshot, the cache stays
+// invalid if the read failed.
+void option_cache_reload(option_cache &cache, SANE_Status status, const option_snapshot &snap) {
+    cache.valid = false;
+    if (status == SANE_STATUS_GOOD) {
+        option_cache_update(cache, snap);
+    }
+}
+
+// Cached descriptor (copied on the helper thread), NULL for invalid options.
+// Keep the reference while awaiting, a reload replaces the cached copies.
+option_descriptor_ref option_cache_descriptor(const option_cache &cache, int option) {
+    if (!cache.valid || option < 0 || option >= (int) cache.descs.size()) {
+        return NULL;
+    }
+    return cache.descs[option];
+}
+
+void option_cache_clear(option_cache &cache) {
+    cache.valid = false;
+    cache.descs.clear();
+    cache.sigs.clear();
+    cache.descriptors.clear();
+    cache.values.clear();
+}
+
+// Option profiles (sane-wasm, not part of SANE API)
+
+// sane_control_options_apply sets many options (a name -> value map) in a
+// single call on the helper thread. The values are kept as plain data and
+// only converted when set, the descriptors may change while applying
+// (RELOAD_OPTIONS). The options are set in dependency order and the ones
+// that failed (e.g. still inactive) are retried after each reload.
+
+struct option_profile_entry {
+    enum { INVALID, AUTO, BOOL, NUMBER, NUMBERS, STRING } kind = INVALID;
+    std::string name;
+    int rank = 0; // see option_profile_rank
+    bool b = false;
+    std::vector<double> numbers;
+    std::string str;
+    bool done = false; // set (or rejected for good)
+    bool inexact = false;
+    SANE_Status status = SANE_STATUS_INVAL; // last status
+};
+
+// Options that usually change others (their constraints or if they are
+// active) go first, the scan area goes last (its range depends on the
+// source and resolution). Other options keep the profile order.
+int option_profile_rank(const std::string &name) {
+    static const std::vector<std::vector<std::string>> ranks = {
+        {"source"},
+        {"mode"},
+        {"depth", "bit-depth"},
+        {"resolution", "x-resolution", "y-resolution"},
+        {}, // everything else
+        {"tl-x", "tl-y", "br-x", "br-y"},
+    };
+    for (size_t i = 0; i < ranks.size(); i++) {
+        if (std::find(ranks[i].begin(), ranks[i].end(), name) != ranks[i].end()) {
+            return i;
+        }
+    }
+    return 4;
+}
+
+option_profile_entry option_profile_entry_from_val(const std::string &name, const val &value) {
+    option_profile_entry entry;
+    entry.name = name;
+    entry.rank = option_profile_rank(name);
+    if (value.isNull()) {
+        entry.kind = option_profile_entry::AUTO; // same as sane_set_option
+    } else if (value.isTrue() || value.isFalse()) {
+        entry.kind = option_profile_entry::BOOL;
+        entry.b = value.isTrue();
+    } else if (value.isNumber()) {
+        entry.kind = option_profile_entry::NUMBER;
+        entry.numbers.push_back(value.as<double>());
+    } else if (value.isArray()) {
+        entry.kind = option_profile_entry::NUMBERS;
+        entry.numbers = vecFromJSArray<double>(value);
+    } else if (value.isString()) {
+        entry.kind = option_profile_entry::STRING;
+        entry.str = value.as<std::string>();
+    }
+    return entry;
+}
+
+// Same conversion as option_value_from_val (v has desc->size bytes).
+bool option_profile_entry_encode(const SANE_Option_Descriptor *desc, const option_profile_entry &entry, void *v) {
+    if (desc->size <= 0) {
+        return false;
+    }
+    int n;
+    switch (desc->type) {
+        case SANE_TYPE_BOOL:
+            if (entry.kind != option_profile_entry::BOOL) {
+                return false;
+            }
+            *((SANE_Bool *) v) = entry.b ? SANE_TRUE : SANE_FALSE;
+            return true;
+        case SANE_TYPE_INT:
+        case SANE_TYPE_FIXED:
+            n = desc->size/sizeof(SANE_Word);
+            if (entry.kind != (n == 1 ? option_profile_entry::NUMBER : option_profile_entry::NUMBERS)) {
+                return false;
+            }
+            for (int i = 0; i < entry.numbers.size() && i < n; i++) {
+                ((SANE_Word *) v)[i] = desc->type == SANE_TYPE_FIXED ? SANE_FIX(entry.numbers[i]) : (SANE_Int) entry.numbers[i];
+            }
+            return true;
+        case SANE_TYPE_STRING:
+            if (entry.kind != option_profile_entry::STRING) {
+                return false;
+            }
+            n = desc->size/sizeof(SANE_Char) - 1;
+            strncpy((char *) v, entry.str.c_str(), n);
+            ((char *) v)[n] = 0x00;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Sets the profile options, info has the bits of all the sets combined.
+// Only call this from the device's helper thread.
+void option_profile_apply(const backend *be, SANE_Handle handle, std::vector<option_profile_entry> &entries, SANE_Int &info) {
+    std::vector<SANE_Byte> v;
+    bool reloaded = true;
+    while (reloaded) {
+        // another pass after a reload, each pass sets at least one option
+        reloaded = false;
+        for (option_profile_entry &entry : entries) {
+            if (entry.done) {
+                continue;
+            }
+            // find by name, the descriptors may have changed
+            int option = 0;
+            const SANE_Option_Descriptor *desc;
+            while ((desc = be->get_option_descriptor(handle, option)) && (!desc->name || entry.name != desc->name)) {
+                option++;
+            }
+            if (!desc || !SANE_OPTION_IS_ACTIVE(desc->cap)) {
+                entry.status = SANE_STATUS_INVAL; // may show up after a reload
+                continue;
+            }
+            if (!SANE_OPTION_IS_SETTABLE(desc->cap) || entry.kind == option_profile_entry::INVALID) {
+                entry.status = SANE_STATUS_INVAL;
+                entry.done = true;
+                continue;
+            }
+            SANE_Int option_info = 0;
+            if (entry.kind == option_profile_entry::AUTO) {
+                entry.status = be->control_option(handle, option, SANE_ACTION_SET_AUTO, NULL, &option_info);
+            } else {
+                v.assign(std::max(desc->size, 0), 0);
+                if (!option_profile_entry_encode(desc, entry, v.data())) {
+                    entry.status = SANE_STATUS_INVAL;
+                    entry.done = true;
+                    continue;
+                }
+                entry.status = be->control_option(handle, option, SANE_ACTION_SET_VALUE, v.empty() ? NULL : v.data(), &option_info);
+            }
+            if (entry.status != SANE_STATUS_GOOD) {
+                continue; // retried after a reload
+            }
+            entry.done = true;
+            entry.inexact = option_info & SANE_INFO_INEXACT;
+            info |= option_info;
+            if (option_info & SANE_INFO_RELOAD_OPTIONS) {
+                reloaded = true;
+            }
+        }
+    }
+}
+
+// Fast API (sane-wasm, not part of SANE API)
+
+// The regular functions build a new JS object for every result (with one
+// embind call per property), on hot paths (reads, options, parameters) that
+// is most of the cost of the call. The fast functions (sane_fast_*) write
+// the result as int32 words to a fast_result in the module memory and
+// return its address, pre.js decodes it and only builds the usual objects
+// when they are used. Each device has one fast_result per scheduler
+// resource (see pre.js), so results from concurrent calls don't overlap.
+
+enum {
+    FAST_STATUS = 0,
+    FAST_INFO, // SANE_INFO_* bits
+    FAST_DATA, // data address (0 = no data)
+    FAST_LENGTH, // data length in bytes
+    FAST_SLOT, // read stream slot (-1 = none)
+    FAST_LINE, // image convert, first line
+    FAST_LINES, // image convert, number of lines
+    FAST_VALUE_TYPE, // option value type (-1 = no value)
+    FAST_VALUE_COUNT, // option value items
+    FAST_PARAMETERS, // 1 = parameters below are set
+    FAST_FORMAT,
+    FAST_LAST_FRAME,
+    FAST_BYTES_PER_LINE,
+    FAST_PIXELS_PER_LINE,
+    FAST_PARAMETERS_LINES,
+    FAST_DEPTH,
+    FAST_WORDS,
+};
+
+struct fast_result {
+    int32_t words[FAST_WORDS];
+};
+
+fast_result fast_invalid; // results for invalid handles
+std::vector<SANE_Byte> fast_input; // staging for data that is not in the module memory
+
+// Resets the result with the status, returns its address for JS.
+int fast_begin(fast_result &res, SANE_Status status) {
+    memset(res.words, 0, sizeof(res.words));
+    res.words[FAST_STATUS] = status;
+    res.words[FAST_SLOT] = -1;
+    res.words[FAST_VALUE_TYPE] = -1;
+    return (int) (uintptr_t) &res;
+}
+
+int fast_error(SANE_Status status) {
+    return fast_begin(fast_invalid, status);
+}
+
+void fast_set_data(fast_result &res, const void *data, size_t len) {
+    res.words[FAST_DATA] = (int32_t) (uintptr_t) data;
+    res.words[FAST_LENGTH] = (int32_t) len;
+}
+
+void fast_set_parameters(fast_result &res, const SANE_Parameters &params) {
+    res.words[FAST_PARAMETERS] = 1;
+    res.words[FAST_FORMAT] = params.format;
+    res.words[FAST_LAST_FRAME] = params.last_frame ? 1 : 0;
+    res.words[FAST_BYTES_PER_LINE] = params.bytes_per_line;
+    res.words[FAST_PIXELS_PER_LINE] = params.pixels_per_line;
+    res.words[FAST_PARAMETERS_LINES] = params.lines;
+    res.words[FAST_DEPTH] = params.depth;
+}
+
+// Points the result to a raw option value, same rules as option_value_to_val
+// (buttons, groups and empty options have no value).
+void fast_set_value(fast_result &res, const SANE_Option_Descriptor *desc, const void *v) {
+    int n = 0;
+    switch (desc->type) {
+        case SANE_TYPE_BOOL: n = 1; break;
+        case SANE_TYPE_INT: n = desc->size/sizeof(SANE_Int); break;
+        case SANE_TYPE_FIXED: n = desc->size/sizeof(SANE_Fixed); break;
+        case SANE_TYPE_STRING: n = desc->size > 0 ? 1 : 0; break;
+        case SANE_TYPE_BUTTON:
+        case SANE_TYPE_GROUP:
+        default:
+            break;
+    }
+    if (n > 0 && v) {
+        res.words[FAST_VALUE_TYPE] = desc->type;
+        res.words[FAST_VALUE_COUNT] = n;
+        fast_set_data(res, v, desc->size);
+    }
+}
+
+// Devices (sane-wasm, not part of SANE API)
+
+// State for one open device. The single handle API (sane_open, sane_read,
+// etc.) uses a fixed device that runs on the main helper thread. The handle
+// API (sane_handle_*) creates one device per handle, each with its own read
+// buffer and helper thread, so that several devices can be read at the same
+// time. Helper threads are kept after the handle is closed and reused.
+
+struct device {
+    backend *be = NULL; // dll or selected backend (see backends_open)
+    SANE_Handle handle = NULL;
+    std::thread *thread = NULL; // helper thread (sane_read, sane_cancel, etc.)
+    std::vector<SANE_Byte> buffer; // sane_read buffer
+    std::atomic<bool> cancelling = false; // ends sane_read_blocking early
+    bool closing = false; // device_close/sane_exit in progress, new calls fail
+    int calls = 0; // async calls in progress (main thread only)
+    std::vector<std::coroutine_handle<>> idle_waiters; // waiting for calls == 0 (main thread only)
+    read_stream stream;
+    image_converter converter;
+    image_encoder encoder;
+    option_cache options;
+    // parameters of the current frame (since sane_start or a batch page),
+    // sane_get_parameters is answered from here while the helper thread is
+    // busy reading
+    SANE_Parameters parameters = {};
+    bool parameters_valid = false;
+    fast_result fast; // fast API, device calls
+    fast_result fast_stream; // fast API, read stream
+    fast_result fast_parameters; // fast API, sane_fast_get_parameters
+    fast_result fast_sync; // fast API, image/encoder (sync)
+    std::vector<SANE_Byte> fast_value; // fast API, last option value read
+};
+
+device single; // single handle API
+std::map<int, device *> handles; // handle API
+int handles_next = 1;
+std::vector<std::thread *> idle_threads;
+
+device *find_device(int handle) {
+    auto it = handles.find(handle);
+    return it == handles.end() ? NULL : it->second;
+}
+
+std::thread *acquire_thread() {
+    if (idle_threads.empty()) {
+        return new std::thread(helper_thread_main);
+    }
+    std::thread *thread = idle_threads.back();
+    idle_threads.pop_back();
+    return thread;
+}
+
+// Counts an async call on the device (see device_call_wait), it must be
+// the first thing after the device checks, the device is not freed until
+// the call returns.
+struct device_call {
+    device *dev;
+    device_call(device *dev) : dev(dev) {
+        dev->calls++;
+    }
+    ~device_call() {
+        if (--dev->calls == 0) {
+            // resumed later, the call is still returning
+            for (std::coroutine_handle<> h : dev->idle_waiters) {
+                queue.proxyAsync(emscripten_main_runtime_thread_id(), [h] { h.resume(); });
+            }
+            dev->idle_waiters.clear();
+        }
+    }
+};
+
+// Waits for the async calls in progress on the device to return, set
+// dev->closing first (and make the blocking calls return early).
+struct device_call_wait : std::suspend_always {
+    device *dev;
+    bool await_suspend(std::coroutine_handle<> h) {
+        if (!dev->calls) {
+            return false; // don't suspend
+        }
+        dev->idle_waiters.push_back(h);
+        return true;
+    }
+};
+
+// Releases a handle API device (already removed from handles).
+void free_device(device *dev) {
+    if (dev && dev != &single) {
+        idle_threads.push_back(dev->thread);
+        delete dev;
+    }
+}
+
+// SANE API
+
+namespace sane {
+
+    // SANE_Status
+    std::map<const char *, int> SANE_STATUS = {
+        {"GOOD", SANE_STATUS_GOOD},
+        {"UNSUPPORTED", SANE_STATUS_UNSUPPORTED},
+        {"CANCELLED", SANE_STATUS_CANCELLED},
+        {"DEVICE_BUSY", SANE_STATUS_DEVICE_BUSY},
+        {"INVAL", SANE_STATUS_INVAL},
+        {"EOF", SANE_STATUS_EOF},
+        {"JAMMED", SANE_STATUS_JAMMED},
+        {"NO_DOCS", SANE_STATUS_NO_DOCS},
+        {"COVER_OPEN", SANE_STATUS_COVER_OPEN},
+        {"IO_ERROR", SANE_STATUS_IO_ERROR},
+        {"NO_MEM", SANE_STATUS_NO_MEM},
+        {"ACCESS_DENIED", SANE_STATUS_ACCESS_DENIED},
+    };
+
+    // SANE_Value_Type
+    std::map<const char *, int> SANE_TYPE = {
+        {"BOOL", SANE_TYPE_BOOL},
+        {"INT", SANE_TYPE_INT},
+        {"FIXED", SANE_TYPE_FIXED},
+        {"STRING", SANE_TYPE_STRING},
+        {"BUTTON", SANE_TYPE_BUTTON},
+        {"GROUP", SANE_TYPE_GROUP},
+    };
+
+    // SANE_Unit
+    std::map<const char *, int> SANE_UNIT = {
+        {"NONE", SANE_UNIT_NONE},
+        {"PIXEL", SANE_UNIT_PIXEL},
+        {"BIT", SANE_UNIT_BIT},
+        {"MM", SANE_UNIT_MM},
+        {"DPI", SANE_UNIT_DPI},
+        {"PERCENT", SANE_UNIT_PERCENT},
+        {"MICROSECOND", SANE_UNIT_MICROSECOND},
+    };
+
+    // SANE_Constraint_Type
+    std::map<const char *, int> SANE_CONSTRAINT = {
+        {"NONE", SANE_CONSTRAINT_NONE},
+        {"RANGE", SANE_CONSTRAINT_RANGE},
+        {"WORD_LIST", SANE_CONSTRAINT_WORD_LIST},
+        {"STRING_LIST", SANE_CONSTRAINT_STRING_LIST},
+    };
+
+    // SANE_Action not used on the exposed api
+
+    // SANE_Frame
+    std::map<const char *, int> SANE_FRAME = {
+        {"GRAY", SANE_FRAME_GRAY},
+        {"RGB", SANE_FRAME_RGB},
+        {"RED", SANE_FRAME_RED},
+        {"GREEN", SANE_FRAME_GREEN},
+        {"BLUE", SANE_FRAME_BLUE},
+    };
+
+    // SANE_Image_Layout (sane-wasm, not part of SANE API)
+    std::map<const char *, int> SANE_IMAGE_LAYOUT = {
+        {"RGBA", SANE_IMAGE_LAYOUT_RGBA},
+        {"BGRA", SANE_IMAGE_LAYOUT_BGRA},
+        {"RGB", SANE_IMAGE_LAYOUT_RGB},
+        {"GRAY", SANE_IMAGE_LAYOUT_GRAY},
+    };
+
+    // SANE_Image_Format (sane-wasm, not part of SANE API)
+    std::map<const char *, int> SANE_IMAGE_FORMAT = {
+        {"JPEG", SANE_IMAGE_FORMAT_JPEG},
+        {"PNG", SANE_IMAGE_FORMAT_PNG},
+    };
+
+    val sane_get_state() {
+        val version = val::object();
+        version.set("major", SANE_VERSION_MAJOR(version_code));
+        version.set("minor", SANE_VERSION_MINOR(version_code));
+        version.set("build", SANE_VERSION_BUILD(version_code));
+        val state = val::object();
+        state.set("initialized", !!version_code);
+        state.set("version_code", version_code);
+        state.set("version", version);
+        state.set("open", !!single.handle);
+        state.set("handles", (int) handles.size());
+        val backends = val::null();
+        if (!backends_selected.empty()) {
+            backends = val::array();
+            for (backend *be : backends_selected) {
+                backends.call<void>("push", val(be->name));
+            }
+        }
+        state.set("backends", backends);
+        return state;
+    }
+
+    // Metrics (sane-wasm, not part of SANE API)
+
+    val metric_histogram_to_val(const metric_histogram &h, const char *count, const char *total, const char *max, const char *histogram) {
+        val obj = val::object();
+        obj.set(count, h.count);
+        obj.set(total, h.total);
+        obj.set(max, h.max);
+        val buckets = val::array();
+        for (int i = 0; i < METRIC_BUCKETS; i++) {
+            buckets.call<void>("push", h.buckets[i]);
+        }
+        obj.set(histogram, buckets);
+        return obj;
+    }
+
+    val sane_get_metrics() {
+        if (!metrics_enabled) {
+            return val::null();
+        }
+        std::lock_guard<std::mutex> lock(metrics_mutex);
+        val functions = val::object();
+        for (int i = 0; i < METRIC_FUNCTIONS; i++) {
+            if (metrics.functions[i].count) {
+                functions.set(metric_names[i], metric_histogram_to_val(metrics.functions[i], "calls", "total_ms", "max_ms", "histogram_us"));
+            }
+        }
+        val proxy = val::object();
+        proxy.set("queue", metric_histogram_to_val(metrics.proxy_queue, "calls", "total_ms", "max_ms", "histogram_us"));
+        proxy.set("resume", metric_histogram_to_val(metrics.proxy_resume, "calls", "total_ms", "max_ms", "histogram_us"));
+        val reads = metric_histogram_to_val(metrics.read_bytes, "calls", "bytes", "max_bytes", "histogram_bytes");
+        reads.set("empty", metrics.read_empty);
+        val usb = val::object();
+        for (int i = 0; i < METRIC_USB_TYPES; i++) {
+            if (metrics.usb[i].count || metrics.usb_errors[i]) {
+                val u = metric_histogram_to_val(metrics.usb[i], "transfers", "bytes", "max_bytes", "histogram_bytes");
+                u.set("errors", metrics.usb_errors[i]);
+                usb.set(metric_usb_names[i], u);
+            }
+        }
+        val obj = val::object();
+        obj.set("functions", functions);
+        obj.set("proxy", proxy);
+        obj.set("reads", reads);
+        obj.set("usb", usb);
+        return obj;
+    }
+
+    void sane_reset_metrics() {
+        std::lock_guard<std::mutex> lock(metrics_mutex);
+        metrics = metrics_data();
+    }
+
+    // Memory (sane-wasm, not part of SANE API)
+
+    val sane_get_memory_stats() {
+        // the module memory never shrinks, its size is also the high-water
+        // mark, malloc (dlmalloc) keeps its own peak (max footprint)
+        struct mallinfo mi = mallinfo();
+        val obj = val::object();
+        obj.set("heap_size", (double) emscripten_get_heap_size());
+        obj.set("malloc_used", (double) mi.uordblks);
+        obj.set("malloc_footprint", (double) mi.arena);
+        obj.set("malloc_footprint_peak", (double) mi.usmblks);
+        obj.set("read_buffer_size", (double) buffer_len);
+        return obj;
+    }
+
+    val sane_init() {
+        if (version_code) {
+            return build_response(SANE_STATUS_INVAL, "version_code");
+        }
+
+        if (!backends_select()) {
+            return build_response(SANE_STATUS_INVAL, "version_code");
+        }
+        SANE_Status status = SANE_STATUS_GOOD;
+        if (backends_selected.empty()) {
+            status = backend_dll.init(&version_code, NULL);
+            RETURN_IF_ERROR_KEY(status, "version_code");
+        } else {
+            // the backends are only initialized on first use
+            version_code = SANE_VERSION_CODE(SANE_CURRENT_MAJOR, SANE_CURRENT_MINOR, 0);
+        }
+
+        return build_response(status, "version_code", val(version_code));
+    }
+
+    val sane_exit() {
+        if (!version_code) {
+            co_return build_response(SANE_STATUS_INVAL);
+        }
+
+        // sane_exit closes all handles, each one on its own helper thread
+        // (like device_close), after stopping its read stream, waiting for
+        // every helper thread, only then the backends exit
+        std::vector<device *> devices = {&single};
+        for (const auto &kv : handles) {
+            devices.push_back(kv.second);
+        }
+        handles.clear();
+        for (device *dev : devices) {
+            dev->closing = true;
+            bool streaming = read_stream_request_stop(dev->stream);
+            dev->cancelling = true;
+            co_await device_call_wait{{}, dev};
+            co_await run_on_thread(*dev->thread, [dev] {
+                if (dev->handle) {
+                    dev->be->close(dev->handle);
+                }
+                return 0;
+            });
+            dev->cancelling = false;
+            co_await read_stream_drain{{}, dev->stream};
+            if (streaming) {
+                read_stream_free(dev->stream);
+            }
+            dev->handle = NULL;
+            dev->parameters_valid = false;
+            option_cache_clear(dev->options);
+            dev->closing = false;
+        }
+        co_await run_on_thread(discovery, [] {
+            backends_exit();
+            return 0;
+        });
+        version_code = 0;
+        single.be = NULL;
+        for (device *dev : devices) {
+            free_device(dev);
+        }
+        co_return build_response(SANE_STATUS_GOOD);
+    }
+
+    val device_list_to_val(const SANE_Device **device_list) {
+        val devices = val::array();
+        for (int i = 0; device_list[i]; i++) {
+            val device = val::object();
+            device.set("name", device_list[i]->name);
+            device.set("vendor", device_list[i]->vendor);
+            device.set("model", device_list[i]->model);
+            device.set("type", device_list[i]->type);
+            devices.call<void>("push", device);
+        }
+        return devices;
+    }
+
+    val sane_get_devices() {
+        const SANE_Device **device_list = NULL;
+        SANE_Status status = co_await run_on_thread(discovery, [&device_list] {
+            return backends_get_devices(&device_list);
+        });
+        CORETURN_IF_ERROR_KEY(status, "devices");
+        co_return build_response(status, "devices", device_list_to_val(device_list));
+    }
+
+    // Discovery probe (sane-wasm, not part of SANE API)
+
+    // Same as sane_get_devices, but only probes the given backends plus the
+    // ones that support the given USB IDs (SANE_WASM_USB_IDS), out of the
+    // selected backends. Used by the discovery cache (pre.js) to verify the
+    // devices of a known set of USB devices without a full discovery.
+    val sane_discovery_probe(val names, val usb_ids) {
+        if (!version_code || backends_selected.empty() || !names.isArray() || !usb_ids.isArray()) {
+            co_return build_response(SANE_STATUS_INVAL, "devices");
+        }
+
+        std::vector<backend *> probe;
+        for (const std::string &name : vecFromJSArray<std::string>(names)) {
+            backend *be = backend_find(name);
+            if (be && !backend_in(probe, be)) {
+                probe.push_back(be);
+            }
+        }
+        for (const std::string &id : vecFromJSArray<std::string>(usb_ids)) {
+            backends_for_usb_id(id, probe);
+        }
+
+        const SANE_Device **device_list = NULL;
+        SANE_Status status = co_await run_on_thread(discovery, [&device_list, &probe] {
+            return backends_get_devices(&device_list, &probe);
+        });
+        CORETURN_IF_ERROR_KEY(status, "devices");
+        co_return build_response(status, "devices", device_list_to_val(device_list));
+    }
+
+    val sane_open(std::string devicename) {
+        if (!version_code || single.handle) {
+            co_return build_response(SANE_STATUS_INVAL);
+        }
+
+        backend *be = NULL;
+        SANE_Handle h = NULL;
+        option_snapshot snap;
+        SANE_Status snap_status = SANE_STATUS_INVAL;
+        SANE_Status status = co_await run_on_thread(*single.thread, [&devicename, &be, &h, &snap, &snap_status] {
+            SANE_Status status = backends_open(devicename, &be, &h);
+            if (status == SANE_STATUS_GOOD) {
+                snap_status = option_snapshot_read_descriptors(be, h, snap);
+            }
+            return status;
+        });
+        CORETURN_IF_ERROR(status);
+        single.be = be;
+        single.handle = h;
+        option_cache_reload(single.options, snap_status, snap);
+        co_return build_response(status);
+    }
+
+    val device_close(device *dev) {
+        if (!dev || !dev->handle || dev->closing) {
+            co_return build_response(SANE_STATUS_INVAL);
+        }
+
+        // same as device_cancel, reads in progress return early, then wait
+        // for every call on the device before closing and freeing it
+        dev->closing = true;
+        bool streaming = read_stream_request_stop(dev->stream);
+        dev->cancelling = true;
+        co_await device_call_wait{{}, dev};
+        co_await run_on_thread(*dev->thread, [dev] {
+            dev->be->close(dev->handle);
+            return 0;
+        });
+        dev->cancelling = false;
+        co_await read_stream_drain{{}, dev->stream};
+        if (streaming) {
+            read_stream_free(dev->stream);
+        }
+        dev->handle = NULL;
+        dev->parameters_valid = false;
+        option_cache_clear(dev->options);
+        dev->closing = false;
+        free_device(dev);
+        co_return build_response(SANE_STATUS_GOOD);
+    }
+
+    val device_get_option_descriptor(device *dev, int option) {
+        if (!dev || dev->closing || !dev->handle) {
+            return build_response(SANE_STATUS_INVAL, "option_descriptor");
+        }
+
+        // sync, served from the cache, the backend is only called on the
+        // helper thread (the cache is read on open and after RELOAD_OPTIONS)
+        if (!dev->options.valid) {
+            return build_response(SANE_STATUS_INVAL, "option_descriptor");
+        }
+        if (!option_cache_descriptor(dev->options, option)) {
+            return build_response(SANE_STATUS_GOOD, "option_descriptor");
+        }
+
+        return build_response(SANE_STATUS_GOOD, "option_descriptor", dev->options.descriptors[option]);
+    }
+
+    val device_control_option_get_value(device *dev, int option) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "value");
+        }
+        device_call call(dev);
+
+        // the descriptor is copied on the helper thread (only type and size
+        // are used for the value)
+        SANE_Option_Descriptor desc = {};
+        std::vector<SANE_Byte> v;
+        SANE_Int info = 0; // discard
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, &desc, &v, &info] {
+            const SANE_Option_Descriptor *d = dev->be->get_option_descriptor(dev->handle, option);
+            if (!d) {
+                return SANE_STATUS_INVAL;
+            }
+            desc = *d;
+            v.resize(std::max(desc.size, 0));
+            return dev->be->control_option(dev->handle, option, SANE_ACTION_GET_VALUE, v.empty() ? NULL : v.data(), &info);
+        });
+        CORETURN_IF_ERROR_KEY(status, "value");
+
+        co_return build_response(status, "value", option_value_to_val(&desc, v.empty() ? NULL : v.data()));
+    }
+
+    val device_control_option_set_value(device *dev, int option, val value) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+        device_call call(dev);
+
+        // the descriptor comes from the cache (copied on the helper thread)
+        if (!dev->options.valid) {
+            option_snapshot cached;
+            SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &cached] {
+                return option_snapshot_read_descriptors(dev->be, dev->handle, cached);
+            });
+            option_cache_reload(dev->options, status, cached);
+        }
+        option_descriptor_ref desc_copy = option_cache_descriptor(dev->options, option);
+        if (!desc_copy) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+        const SANE_Option_Descriptor *desc = &desc_copy->desc;
+
+        std::vector<SANE_Byte> v(std::max(desc->size, 0));
+        if (!option_value_from_val(desc, value, v.data())) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+
+        SANE_Int info = 0;
+        option_snapshot snap;
+        SANE_Status snap_status = SANE_STATUS_GOOD;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, &v, &info, &snap, &snap_status] {
+            SANE_Status status = dev->be->control_option(dev->handle, option, SANE_ACTION_SET_VALUE, v.empty() ? NULL : v.data(), &info);
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                snap_status = option_snapshot_read_descriptors(dev->be, dev->handle, snap);
+            }
+            return status;
+        });
+        if (info & SANE_INFO_RELOAD_OPTIONS) {
+            option_cache_reload(dev->options, snap_status, snap);
+        }
+        CORETURN_IF_ERROR_KEY(status, "info");
+
+        co_return build_response(status, "info", bitmap_info_to_val(info));
+    }
+
+    val device_control_option_set_auto(device *dev, int option) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+        device_call call(dev);
+
+        SANE_Int info = 0;
+        option_snapshot snap;
+        SANE_Status snap_status = SANE_STATUS_GOOD;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, &info, &snap, &snap_status] {
+            SANE_Status status = dev->be->control_option(dev->handle, option, SANE_ACTION_SET_AUTO, NULL, &info);
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                snap_status = option_snapshot_read_descriptors(dev->be, dev->handle, snap);
+            }
+            return status;
+        });
+        if (info & SANE_INFO_RELOAD_OPTIONS) {
+            option_cache_reload(dev->options, snap_status, snap);
+        }
+        CORETURN_IF_ERROR_KEY(status, "info");
+        co_return build_response(status, "info", bitmap_info_to_val(info));
+    }
+
+    val device_get_all_options(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "options");
+        }
+        device_call call(dev);
+
+        option_snapshot snap;
+        snap.reload = !dev->options.valid;
+        if (!snap.reload) {
+            snap.descs = dev->options.descs;
+        }
+        int reloads = dev->options.reloads;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &snap] {
+            return option_snapshot_read(dev->be, dev->handle, snap);
+        });
+        CORETURN_IF_ERROR_KEY(status, "options");
+        if (!snap.reload && (!dev->options.valid || dev->options.reloads != reloads)) {
+            // options reloaded while reading (set on another call), the
+            // values may not match the cached descriptors, read again
+            co_return co_await device_get_all_options(dev);
+        }
+        option_cache_update(dev->options, snap);
+        co_return build_response(status, "options", option_cache_to_val(dev->options));
+    }
+
+    val device_set_option(device *dev, int option, val value) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+        device_call call(dev);
+
+        // the descriptor comes from the cache (copied on the helper thread)
+        if (!dev->options.valid) {
+            option_snapshot cached;
+            SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &cached] {
+                return option_snapshot_read_descriptors(dev->be, dev->handle, cached);
+            });
+            option_cache_reload(dev->options, status, cached);
+        }
+        option_descriptor_ref desc_copy = option_cache_descriptor(dev->options, option);
+        if (!desc_copy) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+        const SANE_Option_Descriptor *desc = &desc_copy->desc;
+
+        bool set_auto = value.isNull(); // null means auto
+        std::vector<SANE_Byte> v(std::max(desc->size, 0));
+        if (!set_auto && !option_value_from_val(desc, value, v.data())) {
+            co_return build_response(SANE_STATUS_INVAL, "info");
+        }
+
+        // after setting, read back the option value (fixed values may be
+        // rounded without INEXACT) or everything on RELOAD_OPTIONS
+        option_snapshot snap;
+        snap.reload = !dev->options.valid;
+        snap.only = snap.reload ? -1 : option;
+        if (!snap.reload) {
+            snap.descs = dev->options.descs;
+        }
+        int reloads = dev->options.reloads;
+        SANE_Int info = 0;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, set_auto, &v, &info, &snap] {
+            SANE_Status status = set_auto
+                ? dev->be->control_option(dev->handle, option, SANE_ACTION_SET_AUTO, NULL, &info)
+                : dev->be->control_option(dev->handle, option, SANE_ACTION_SET_VALUE, v.empty() ? NULL : v.data(), &info);
+            if (status != SANE_STATUS_GOOD) {
+                return status;
+            }
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                snap.reload = true;
+                snap.only = -1;
+            }
+            return option_snapshot_read(dev->be, dev->handle, snap);
+        });
+        if (status != SANE_STATUS_GOOD) {
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                dev->options.valid = false;
+            }
+            co_return build_response(status, "info");
+        }
+        if (!snap.reload && (!dev->options.valid || dev->options.reloads != reloads)) {
+            // options reloaded meanwhile (set on another call), the whole
+            // cache must be compared again
+            snap.reload = true;
+            snap.only = -1;
+            status = co_await run_on_thread(*dev->thread, [dev, &snap] {
+                return option_snapshot_read(dev->be, dev->handle, snap);
+            });
+            CORETURN_IF_ERROR_KEY(status, "info");
+        }
+
+        val response = build_response(status, "info", bitmap_info_to_val(info));
+        response.set("count", (int) snap.descs.size());
+        response.set("changes", option_cache_update(dev->options, snap, option));
+        co_return response;
+    }
+
+    val device_control_options_apply(device *dev, val profile) {
+        if (!dev || dev->closing || !dev->handle || profile.typeOf().as<std::string>() != "object" || profile.isNull()) {
+            co_return build_response(SANE_STATUS_INVAL, "options");
+        }
+        device_call call(dev);
+
+        std::vector<option_profile_entry> entries;
+        for (const std::string &name : vecFromJSArray<std::string>(val::global("Object").call<val>("keys", profile))) {
+            entries.push_back(option_profile_entry_from_val(name, profile[name]));
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const option_profile_entry &a, const option_profile_entry &b) {
+            return a.rank < b.rank;
+        });
+
+        // set everything, then read all options once
+        option_snapshot snap;
+        snap.reload = true;
+        SANE_Int info = 0;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &entries, &info, &snap] {
+            option_profile_apply(dev->be, dev->handle, entries, info);
+            return option_snapshot_read(dev->be, dev->handle, snap);
+        });
+        if (status != SANE_STATUS_GOOD) {
+            dev->options.valid = false;
+            co_return build_response(status, "options");
+        }
+        option_cache_update(dev->options, snap);
+
+        // final values (null if not readable), inexact and rejected options
+        val values = val::object();
+        val inexact = val::array();
+        val rejected = val::array();
+        for (const option_profile_entry &entry : entries) {
+            val value = val::null();
+            for (size_t i = 0; i < dev->options.descs.size(); i++) {
+                const SANE_Option_Descriptor *desc = &dev->options.descs[i]->desc;
+                if (desc->name && entry.name == desc->name && !dev->options.values[i].empty()) {
+                    value = option_value_to_val(desc, dev->options.values[i].data());
+                    break;
+                }
+            }
+            values.set(entry.name, value);
+            if (entry.status != SANE_STATUS_GOOD) {
+                val reject = val::object();
+                reject.set("name", entry.name);
+                reject.set("status", (int) entry.status);
+                rejected.call<void>("push", reject);
+            } else if (entry.inexact) {
+                inexact.call<void>("push", entry.name);
+            }
+        }
+
+        val response = build_response(status, "info", bitmap_info_to_val(info));
+        response.set("options", option_cache_to_val(dev->options));
+        response.set("values", values);
+        response.set("inexact", inexact);
+        response.set("rejected", rejected);
+        co_return response;
+    }
+
+    val device_get_parameters(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "parameters");
+        }
+        device_call call(dev);
+        if (dev->parameters_valid) {
+            co_return build_response(SANE_STATUS_GOOD, "parameters", sane_parameters_to_val(dev->parameters));
+        }
 
-#define RETURN_IF_ERROR(status) if (status != SANE_STATUS_GOOD) return build_response(status);
-#define RETURN_IF_ERROR_KEY(status, key) if (status != SANE_STATUS_GOOD) return build_response(status, key);
-#define CORETURN_IF_ERROR(status) if (status != SANE_STATUS_GOOD) co_return build_response(status);
-#define CORETURN_IF_ERROR_KEY(status, key) if (status != SANE_STATUS_GOOD) co_return build_response(status, key);
+        SANE_Parameters params;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &params] {
+            return dev->be->get_parameters(dev->handle, &params);
+        });
+        CORETURN_IF_ERROR_KEY(status, "parameters");
+        co_return build_response(status, "parameters", sane_parameters_to_val(params));
+    }
 
-val bitmap_cap_to_val(SANE_Int cap) {
-    val obj = val::object();
-    obj.set("SOFT_SELECT", (bool) ((cap & SANE_CAP_SOFT_SELECT) != 0));
-    obj.set("HARD_SELECT", (bool) ((cap & SANE_CAP_HARD_SELECT) != 0));
-    obj.set("SOFT_DETECT", (bool) ((cap & SANE_CAP_SOFT_DETECT) != 0));
-    obj.set("EMULATED", (bool) ((cap & SANE_CAP_EMULATED) != 0));
-    obj.set("AUTOMATIC", (bool) ((cap & SANE_CAP_AUTOMATIC) != 0));
-    obj.set("INACTIVE", (bool) ((cap & SANE_CAP_INACTIVE) != 0));
-    obj.set("ADVANCED", (bool) ((cap & SANE_CAP_ADVANCED) != 0));
-    return obj;
-}
+    val device_start(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL);
+        }
+        device_call call(dev);
+
+        // the parameters are read right away, for sane_get_parameters
+        // while reading (see device.parameters)
+        SANE_Parameters params = {};
+        SANE_Status params_status = SANE_STATUS_INVAL;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &params, &params_status] {
+            SANE_Status status = dev->be->start(dev->handle);
+            if (status == SANE_STATUS_GOOD) {
+                params_status = dev->be->get_parameters(dev->handle, &params);
+            }
+            return status;
+        });
+        dev->parameters = params;
+        dev->parameters_valid = params_status == SANE_STATUS_GOOD;
+        co_return build_response(status);
+    }
 
-val bitmap_info_to_val(SANE_Int info) {
-    val obj = val::object();
-    obj.set("INEXACT", (bool) ((info & SANE_INFO_INEXACT) != 0));
-    obj.set("RELOAD_OPTIONS", (bool) ((info & SANE_INFO_RELOAD_OPTIONS) != 0));
-    obj.set("RELOAD_PARAMS", (bool) ((info & SANE_INFO_RELOAD_PARAMS) != 0));
-    return obj;
-}
+    val device_read(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "data");
+        }
+        device_call call(dev);
 
-// SANE API
+        SANE_Int len = 0;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &len] {
+            return dev->be->read(dev->handle, dev->buffer.data(), dev->buffer.size(), &len);
+        });
+        dev->parameters_valid = dev->parameters_valid && status == SANE_STATUS_GOOD; // end of frame
+        CORETURN_IF_ERROR_KEY(status, "data");
 
-namespace sane {
+        val data = val(typed_memory_view(len, dev->buffer.data()));
+        co_return build_response(status, "data", data);
+    }
 
-    // SANE_Status
-    std::map<const char *, int> SANE_STATUS = {
-        {"GOOD", SANE_STATUS_GOOD},
-        {"UNSUPPORTED", SANE_STATUS_UNSUPPORTED},
-        {"CANCELLED", SANE_STATUS_CANCELLED},
-        {"DEVICE_BUSY", SANE_STATUS_DEVICE_BUSY},
-        {"INVAL", SANE_STATUS_INVAL},
-        {"EOF", SANE_STATUS_EOF},
-        {"JAMMED", SANE_STATUS_JAMMED},
-        {"NO_DOCS", SANE_STATUS_NO_DOCS},
-        {"COVER_OPEN", SANE_STATUS_COVER_OPEN},
-        {"IO_ERROR", SANE_STATUS_IO_ERROR},
-        {"NO_MEM", SANE_STATUS_NO_MEM},
-        {"ACCESS_DENIED", SANE_STATUS_ACCESS_DENIED},
-    };
+    val device_read_blocking(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL, "data");
+        }
+        device_call call(dev);
 
-    // SANE_Value_Type
-    std::map<const char *, int> SANE_TYPE = {
-        {"BOOL", SANE_TYPE_BOOL},
-        {"INT", SANE_TYPE_INT},
-        {"FIXED", SANE_TYPE_FIXED},
-        {"STRING", SANE_TYPE_STRING},
-        {"BUTTON", SANE_TYPE_BUTTON},
-        {"GROUP", SANE_TYPE_GROUP},
-    };
+        // Same as sane_read, but it doesn't return empty reads right away.
+        // The helper thread keeps calling sane_read (sleeping a little
+        // between calls) until there is data, EOF or an error. After some
+        // time without data it returns anyway, so that the caller can still
+        // cancel the scan.
+        SANE_Int len = 0;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &len] {
+            return read_until_data(dev->be, dev->handle, dev->buffer.data(), dev->buffer.size(), &len, &dev->cancelling);
+        });
+        dev->parameters_valid = dev->parameters_valid && status == SANE_STATUS_GOOD; // end of frame
+        CORETURN_IF_ERROR_KEY(status, "data");
 
-    // SANE_Unit
-    std::map<const char *, int> SANE_UNIT = {
-        {"NONE", SANE_UNIT_NONE},
-        {"PIXEL", SANE_UNIT_PIXEL},
-        {"BIT", SANE_UNIT_BIT},
-        {"MM", SANE_UNIT_MM},
-        {"DPI", SANE_UNIT_DPI},
-        {"PERCENT", SANE_UNIT_PERCENT},
-        {"MICROSECOND", SANE_UNIT_MICROSECOND},
-    };
+        val data = val(typed_memory_view(len, dev->buffer.data()));
+        co_return build_response(status, "data", data);
+    }
 
-    // SANE_Constraint_Type
-    std::map<const char *, int> SANE_CONSTRAINT = {
-        {"NONE", SANE_CONSTRAINT_NONE},
-        {"RANGE", SANE_CONSTRAINT_RANGE},
-        {"WORD_LIST", SANE_CONSTRAINT_WORD_LIST},
-        {"STRING_LIST", SANE_CONSTRAINT_STRING_LIST},
-    };
+    val device_cancel(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return build_response(SANE_STATUS_INVAL);
+        }
+        device_call call(dev);
+
+        // a read stream must stop before sane_cancel runs on the helper
+        // thread, because the stream loop is also running there, the same
+        // for a blocking read that is waiting for data
+        bool streaming = read_stream_request_stop(dev->stream);
+        dev->cancelling = true;
+        dev->parameters_valid = false;
+        co_await run_on_thread(*dev->thread, [dev] {
+            dev->be->cancel(dev->handle);
+            return 0;
+        });
+        dev->cancelling = dev->closing; // still set while closing
+        co_await read_stream_drain{{}, dev->stream};
+        if (streaming) {
+            read_stream_free(dev->stream);
+        }
+        co_return build_response(SANE_STATUS_GOOD);
+    }
 
-    // SANE_Action not used on the exposed api
+    val device_read_stream_start(device *dev, bool batch) {
+        if (!dev || dev->closing || !dev->handle) {
+            return build_response(SANE_STATUS_INVAL);
+        }
 
-    // SANE_Frame
-    std::map<const char *, int> SANE_FRAME = {
-        {"GRAY", SANE_FRAME_GRAY},
-        {"RGB", SANE_FRAME_RGB},
-        {"RED", SANE_FRAME_RED},
-        {"GREEN", SANE_FRAME_GREEN},
-        {"BLUE", SANE_FRAME_BLUE},
-    };
+        read_stream &stream = dev->stream;
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (stream.active) {
+            return build_response(SANE_STATUS_INVAL);
+        }
 
-    val sane_get_state() {
-        val version = val::object();
-        version.set("major", SANE_VERSION_MAJOR(version_code));
-        version.set("minor", SANE_VERSION_MINOR(version_code));
-        version.set("build", SANE_VERSION_BUILD(version_code));
-        val state = val::object();
-        state.set("initialized", !!version_code);
-        state.set("version_code", version_code);
-        state.set("version", version);
-        state.set("open", !!handle);
-        return state;
+        int n = READ_STREAM_SLOTS;
+        val opt = val::module_property("sane")["readBufferSlots"];
+        if (opt.isNumber() && opt.as<int>() > 0) {
+            n = opt.as<int>();
+        }
+
+        stream.be = dev->be;
+        stream.handle = dev->handle;
+        stream.slots.assign(n, std::vector<SANE_Byte>(buffer_len));
+        stream.lengths.assign(n, 0);
+        stream.free_slots.clear();
+        stream.filled_slots.clear();
+        stream.pages.clear();
+        stream.batch = batch;
+        for (int i = 0; i < n; i++) {
+            stream.free_slots.push_back(i);
+        }
+        stream.active = true;
+        stream.running = true;
+        stream.stop = false;
+        stream.status = SANE_STATUS_GOOD;
+        stream.reads = stream.stalls = stream.waits = 0;
+        stream.bytes = 0;
+        stream.stall_ms = stream.wait_ms = 0;
+        queue.proxyAsync(dev->thread->native_handle(), [&stream] { read_stream_main(stream); });
+        return build_response(SANE_STATUS_GOOD);
     }
 
-    val sane_init() {
-        if (version_code) {
-            return build_response(SANE_STATUS_INVAL, "version_code");
+    val device_read_stream_next(device *dev) {
+        if (!dev || dev->closing || !dev->stream.active) {
+            co_return build_response(SANE_STATUS_INVAL, "data");
         }
+        device_call call(dev);
 
-        SANE_Status status = ::sane_init(&version_code, NULL);
-        RETURN_IF_ERROR_KEY(status, "version_code");
+        read_stream &stream = dev->stream;
+        read_stream_next_guard guard(stream);
+        co_await read_stream_awaiter{{}, stream};
 
-        return build_response(status, "version_code", val(version_code));
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (stream.stop || !stream.active) {
+            // stopping (close, cancel or stop), the slots are about to be freed
+            co_return build_response(SANE_STATUS_CANCELLED, "data");
+        }
+        if (stream.filled_slots.empty()) {
+            // the loop ended, no more data
+            dev->parameters_valid = false;
+            co_return build_response(stream.status, "data");
+        }
+        int slot = stream.filled_slots.front();
+        stream.filled_slots.pop_front();
+        if (slot == READ_STREAM_PAGE_END) {
+            co_return build_response(SANE_STATUS_EOF, "data");
+        }
+        if (slot == READ_STREAM_PAGE_START) {
+            val res = build_response(SANE_STATUS_GOOD, "data", val::null());
+            res.set("parameters", sane_parameters_to_val(stream.pages.front()));
+            dev->parameters = stream.pages.front();
+            dev->parameters_valid = true;
+            stream.pages.pop_front();
+            co_return res;
+        }
+        val res = build_response(SANE_STATUS_GOOD, "data", val(typed_memory_view(stream.lengths[slot], stream.slots[slot].data())));
+        res.set("slot", slot);
+        co_return res;
     }
 
-    val sane_exit() {
-        if (!version_code) {
+    val device_read_stream_release(device *dev, int slot) {
+        if (!dev) {
             return build_response(SANE_STATUS_INVAL);
         }
 
-        ::sane_exit();
-        version_code = 0;
-        handle = NULL;
+        read_stream &stream = dev->stream;
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (
+            !stream.active || slot < 0 || slot >= (int) stream.slots.size() ||
+            std::find(stream.free_slots.begin(), stream.free_slots.end(), slot) != stream.free_slots.end() ||
+            std::find(stream.filled_slots.begin(), stream.filled_slots.end(), slot) != stream.filled_slots.end()
+        ) {
+            return build_response(SANE_STATUS_INVAL);
+        }
+
+        stream.free_slots.push_back(slot);
+        stream.cond.notify_all();
         return build_response(SANE_STATUS_GOOD);
     }
 
-    val sane_get_devices() {
-        const SANE_Device **device_list;
-        SANE_Status status = ::sane_get_devices(&device_list, SANE_TRUE);
-        RETURN_IF_ERROR_KEY(status, "devices");
-
-        val devices = val::array();
-        for (int i = 0; device_list[i]; i++) {
-            val device = val::object();
-            device.set("name", device_list[i]->name);
-            device.set("vendor", device_list[i]->vendor);
-            device.set("model", device_list[i]->model);
-            device.set("type", device_list[i]->type);
-            devices.call<void>("push", device);
+    val device_read_stream_stop(device *dev) {
+        if (!dev || dev->closing || !read_stream_request_stop(dev->stream)) {
+            co_return build_response(SANE_STATUS_INVAL);
         }
-        return build_response(status, "devices", devices);
+        device_call call(dev);
+
+        co_await run_on_thread(*dev->thread, [] { return 0; }); // wait for the loop
+        co_await read_stream_drain{{}, dev->stream};
+        read_stream_free(dev->stream);
+        co_return build_response(SANE_STATUS_GOOD);
     }
 
-    val sane_open(std::string devicename) {
-        if (!version_code || handle) {
-            return build_response(SANE_STATUS_INVAL);
+    val device_read_stream_stats(device *dev) {
+        if (!dev) {
+            return val::null();
         }
 
-        SANE_Status status = ::sane_open(devicename.c_str(), &handle);
-        return build_response(status);
+        read_stream &stream = dev->stream;
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        val stats = val::object();
+        stats.set("active", stream.active);
+        stats.set("slots", (int) stream.slots.size());
+        stats.set("filled", (int) stream.filled_slots.size());
+        stats.set("reads", stream.reads);
+        stats.set("bytes", (double) stream.bytes);
+        stats.set("stalls", stream.stalls);
+        stats.set("stall_ms", stream.stall_ms);
+        stats.set("waits", stream.waits);
+        stats.set("wait_ms", stream.wait_ms);
+        return stats;
+    }
+
+    val sane_strstatus(int status) {
+        return val(::sane_strstatus((SANE_Status) status));
     }
 
-    val sane_close() {
-        if (!handle) {
+    val device_image_begin(device *dev, val parameters, int layout) {
+        if (!dev) {
             return build_response(SANE_STATUS_INVAL);
         }
 
-        ::sane_close(handle);
-        handle = NULL;
-        return build_response(SANE_STATUS_GOOD);
+        SANE_Parameters params;
+        sane_parameters_from_val(parameters, params);
+        return build_response(image_converter_begin(dev->converter, params, layout));
     }
 
-    val sane_get_option_descriptor(int option) {
-        if (!handle) {
-            return build_response(SANE_STATUS_INVAL, "option_descriptor");
+    val device_image_convert(device *dev, val data) {
+        if (!dev || !dev->converter.convert_line) {
+            return build_response(SANE_STATUS_INVAL, "data");
         }
 
-        const SANE_Option_Descriptor *desc = ::sane_get_option_descriptor(handle, option);
-        if (desc == NULL) {
-            return build_response(SANE_STATUS_GOOD, "option_descriptor");
+        image_converter &converter = dev->converter;
+        size_t len;
+        std::vector<SANE_Byte> storage;
+        const SANE_Byte *in = uint8array_data(data, len, storage);
+        int lines = image_converter_write(converter, in, len);
+
+        size_t out_bpl = (size_t) converter.params.pixels_per_line * converter.bytes_per_pixel;
+        val res = build_response(SANE_STATUS_GOOD, "data", val(typed_memory_view(lines * out_bpl, converter.output.data())));
+        res.set("line", converter.line - lines);
+        res.set("lines", lines);
+        return res;
+    }
+
+    val device_image_preview(device *dev, int width, int levels) {
+        if (!dev) {
+            return build_response(SANE_STATUS_INVAL);
         }
 
-        // convert size, we don't need to expose size in byte units
-        // for the frontend is more useful in "number of words" (items)
-        int size = desc->size;
-        switch (desc->type) {
-            case SANE_TYPE_BOOL: size = size/sizeof(SANE_Bool); break;
-            case SANE_TYPE_INT: size = size/sizeof(SANE_Int); break;
-            case SANE_TYPE_FIXED: size = size/sizeof(SANE_Fixed); break;
-            case SANE_TYPE_STRING: size = size/sizeof(SANE_Char) - 1; break;
-            case SANE_TYPE_BUTTON: break;
-            case SANE_TYPE_GROUP: break;
-        }
-
-        // decode and convert constraint
-        val constraint = val::null();
-        if (desc->constraint_type == SANE_CONSTRAINT_RANGE) {
-            constraint = val::object();
-            if (desc->type == SANE_TYPE_FIXED) {
-                constraint.set("min", SANE_UNFIX(desc->constraint.range->min));
-                constraint.set("max", SANE_UNFIX(desc->constraint.range->max));
-                constraint.set("quant", SANE_UNFIX(desc->constraint.range->quant));
-            } else {
-                constraint.set("min", desc->constraint.range->min);
-                constraint.set("max", desc->constraint.range->max);
-                constraint.set("quant", desc->constraint.range->quant);
-            }
-        } else if (desc->constraint_type == SANE_CONSTRAINT_WORD_LIST) {
-            constraint = val::array();
-            if (desc->type == SANE_TYPE_FIXED) {
-                for (int i = 1; i <= desc->constraint.word_list[0]; i++) {
-                    constraint.call<void>("push", SANE_UNFIX(desc->constraint.word_list[i]));
-                }
-            } else {
-                for (int i = 1; i <= desc->constraint.word_list[0]; i++) {
-                    constraint.call<void>("push", desc->constraint.word_list[i]);
-                }
-            }
-        } else if (desc->constraint_type == SANE_CONSTRAINT_STRING_LIST) {
-            constraint = val::array();
-            for (const SANE_String_Const *str = desc->constraint.string_list; *str != NULL; str++) {
-                constraint.call<void>("push", val(*str));
-            }
+        return build_response(image_converter_preview(dev->converter, width, levels));
+    }
+
+    val device_image_preview_get(device *dev) {
+        if (!dev || dev->converter.preview.empty()) {
+            return build_response(SANE_STATUS_INVAL, "levels");
         }
 
-        // construct final object
-        val option_descriptor = val::object();
-        option_descriptor.set("name", desc->name);
-        option_descriptor.set("title", desc->title);
-        option_descriptor.set("desc", desc->desc);
-        option_descriptor.set("type", (int) desc->type);
-        option_descriptor.set("unit", (int) desc->unit);
-        option_descriptor.set("size", size);
-        option_descriptor.set("cap", bitmap_cap_to_val(desc->cap));
-        option_descriptor.set("constraint_type", (int) desc->constraint_type);
-        option_descriptor.set("constraint", constraint);
-        return build_response(SANE_STATUS_GOOD, "option_descriptor", option_descriptor);
+        val levels = val::array();
+        for (const preview_level &lv : dev->converter.preview) {
+            val level = val::object();
+            level.set("width", lv.width);
+            level.set("height", lv.height);
+            level.set("lines", lv.lines);
+            level.set("data", val(typed_memory_view(lv.data.size(), lv.data.data())));
+            levels.call<void>("push", level);
+        }
+        return build_response(SANE_STATUS_GOOD, "levels", levels);
     }
 
-    val sane_control_option_get_value(int option) {
-        if (!handle) {
-            return build_response(SANE_STATUS_INVAL, "value");
+    val device_image_end(device *dev) {
+        if (!dev || !dev->converter.convert_line) {
+            return build_response(SANE_STATUS_INVAL);
         }
 
-        const SANE_Option_Descriptor *desc = ::sane_get_option_descriptor(handle, option);
-        if (desc == NULL) {
-            return build_response(SANE_STATUS_INVAL, "value");
+        image_converter_end(dev->converter);
+        return build_response(SANE_STATUS_GOOD);
+    }
+
+    val device_encoder_begin(device *dev, val parameters, int format, val options) {
+        if (!dev || dev->encoder.format != -1) {
+            return build_response(SANE_STATUS_INVAL, "data");
         }
 
-        void *v = NULL;
-        if (desc->size > 0) {
-            v = malloc(desc->size);
-            if (!v) {
-                return build_response(SANE_STATUS_NO_MEM, "value");
+        image_encoder &encoder = dev->encoder;
+        SANE_Parameters params;
+        sane_parameters_from_val(parameters, params);
+        int quality = 90;
+        int level = 6;
+        if (!options.isUndefined() && !options.isNull()) {
+            if (options["quality"].isNumber()) {
+                quality = options["quality"].as<int>();
+            }
+            if (options["level"].isNumber()) {
+                level = options["level"].as<int>();
             }
         }
 
-        SANE_Int info = 0; // discard
-        SANE_Status status = ::sane_control_option(handle, option, SANE_ACTION_GET_VALUE, v, &info);
-        // RETURN_IF_ERROR_KEY(status, "value");
+        SANE_Status status = image_encoder_begin(encoder, params, format, quality, level);
+        RETURN_IF_ERROR_KEY(status, "data");
+        return build_response(status, "data", val(typed_memory_view(encoder.out.size(), encoder.out.data())));
+    }
 
-        if (status != SANE_STATUS_GOOD) {
-            if (v) {
-                free(v);
-            }
-            return build_response(status, "value");
-        }
-
-        val value = val::null();
-        int n;
-        switch (desc->type) {
-            case SANE_TYPE_BOOL:
-                value = val((bool) *((SANE_Bool *) v));
-                break;
-            case SANE_TYPE_INT:
-                n = desc->size/sizeof(SANE_Int);
-                if (n == 1) {
-                    value = val(*((SANE_Int *) v));
-                } else if (n > 1) {
-                    value = val::array();
-                    for (int i = 0; i < n; i++) {
-                        value.call<void>("push", ((SANE_Int *) v)[i]);
-                    }
-                }
-                break;
-            case SANE_TYPE_FIXED:
-                n = desc->size/sizeof(SANE_Fixed);
-                if (n == 1) {
-                    value = val(SANE_UNFIX(*((SANE_Fixed *) v)));
-                } else if (n > 1) {
-                    value = val::array();
-                    for (int i = 0; i < n; i++) {
-                        value.call<void>("push", SANE_UNFIX(((SANE_Fixed *) v)[i]));
-                    }
-                }
-                break;
-            case SANE_TYPE_STRING:
-                value = val((SANE_String_Const) v);
-                break;
-            case SANE_TYPE_BUTTON:
-            case SANE_TYPE_GROUP:
-            default:
-                break;
+    val device_encoder_write(device *dev, val data) {
+        if (!dev || dev->encoder.format == -1) {
+            return build_response(SANE_STATUS_INVAL, "data");
         }
 
-        if (v) {
-            free(v);
+        image_encoder &encoder = dev->encoder;
+        size_t len;
+        std::vector<SANE_Byte> storage;
+        const SANE_Byte *in = uint8array_data(data, len, storage);
+        SANE_Status status = image_encoder_write(encoder, in, len);
+        RETURN_IF_ERROR_KEY(status, "data");
+        return build_response(status, "data", val(typed_memory_view(encoder.out.size(), encoder.out.data())));
+    }
+
+    val device_encoder_end(device *dev) {
+        if (!dev || dev->encoder.format == -1) {
+            return build_response(SANE_STATUS_INVAL, "data");
         }
 
-        return build_response(status, "value", value);
+        image_encoder &encoder = dev->encoder;
+        SANE_Status status = image_encoder_end(encoder);
+        RETURN_IF_ERROR_KEY(status, "data");
+        return build_response(status, "data", val(typed_memory_view(encoder.out.size(), encoder.out.data())));
     }
 
-    val sane_control_option_set_value(int option, val value) {
-        if (!handle) {
-            return build_response(SANE_STATUS_INVAL, "info");
-        }
+    // fast API (see fast_result), same as the regular functions but the
+    // result is written to the device's fast_result, the return value (or
+    // promise value) is its address
 
-        const SANE_Option_Descriptor *desc = ::sane_get_option_descriptor(handle, option);
-        if (desc == NULL) {
-            return build_response(SANE_STATUS_INVAL, "info");
+    val device_fast_get_parameters(device *dev) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
+        }
+        device_call call(dev);
+        if (dev->parameters_valid) {
+            int res = fast_begin(dev->fast_parameters, SANE_STATUS_GOOD);
+            fast_set_parameters(dev->fast_parameters, dev->parameters);
+            co_return val(res);
         }
 
-        void *v = NULL;
-        if (desc->size > 0) {
-            v = malloc(desc->size);
-            if (!v) {
-                return build_response(SANE_STATUS_NO_MEM, "info");
-            }
+        SANE_Parameters params;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &params] {
+            return dev->be->get_parameters(dev->handle, &params);
+        });
+        int res = fast_begin(dev->fast_parameters, status);
+        if (status == SANE_STATUS_GOOD) {
+            fast_set_parameters(dev->fast_parameters, params);
         }
+        co_return val(res);
+    }
 
-        int n;
-        bool inval = false;
-        switch (desc->type) {
-            case SANE_TYPE_BOOL:
-                if (value.isTrue()) {
-                    *((SANE_Bool *) v) = SANE_TRUE;
-                } else if (value.isFalse()) {
-                    *((SANE_Bool *) v) = SANE_FALSE;
-                } else {
-                    inval = true;
-                }
-                break;
-            case SANE_TYPE_INT:
-                n = desc->size/sizeof(SANE_Int);
-                if (n == 1) {
-                    if (value.isNumber()) {
-                        *((SANE_Int *) v) = value.as<int>();
-                    } else {
-                        inval = true;
-                    }
-                } else if (n > 1) {
-                    if (value.isArray()) {
-                        auto vec = vecFromJSArray<int>(value);
-                        for (int i = 0; i < vec.size() && i < n; i++) {
-                            ((SANE_Int *) v)[i] = vec[i];
-                        }
-                    } else {
-                        inval = true;
-                    }
-                }
-                break;
-            case SANE_TYPE_FIXED:
-                n = desc->size/sizeof(SANE_Fixed);
-                if (n == 1) {
-                    if (value.isNumber()) {
-                        *((SANE_Fixed *) v) = SANE_FIX(value.as<double>());
-                    } else {
-                        inval = true;
-                    }
-                } else if (n > 1) {
-                    if (value.isArray()) {
-                        auto vec = vecFromJSArray<double>(value);
-                        for (int i = 0; i < vec.size() && i < n; i++) {
-                            ((SANE_Fixed *) v)[i] = SANE_FIX(vec[i]);
-                        }
-                    } else {
-                        inval = true;
-                    }
-                }
-                break;
-            case SANE_TYPE_STRING:
-                if (value.isString()) {
-                    int n = desc->size/sizeof(SANE_Char) - 1;
-                    std::string str = value.as<std::string>();
-                    strncpy((char *) v, str.c_str(), n);
-                    ((char *) v)[n] = 0x00;
-                } else {
-                    inval = true;
-                }
-                break;
-            case SANE_TYPE_BUTTON:
-            case SANE_TYPE_GROUP:
-            default:
-                break;
+    val device_fast_read(device *dev, bool blocking) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
         }
+        device_call call(dev);
 
-        if (inval) {
-            if (v) {
-                free(v);
+        SANE_Int len = 0;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, blocking, &len] {
+            if (blocking) {
+                return read_until_data(dev->be, dev->handle, dev->buffer.data(), dev->buffer.size(), &len, &dev->cancelling);
             }
-            return build_response(SANE_STATUS_INVAL, "info");
+            return dev->be->read(dev->handle, dev->buffer.data(), dev->buffer.size(), &len);
+        });
+        dev->parameters_valid = dev->parameters_valid && status == SANE_STATUS_GOOD; // end of frame
+        int res = fast_begin(dev->fast, status);
+        if (status == SANE_STATUS_GOOD) {
+            fast_set_data(dev->fast, dev->buffer.data(), len);
         }
+        co_return val(res);
+    }
 
-        SANE_Int info = 0;
-        SANE_Status status = ::sane_control_option(handle, option, SANE_ACTION_SET_VALUE, v, &info);
-
-        if (v) {
-            free(v);
+    val device_fast_read_stream_next(device *dev) {
+        if (!dev || dev->closing || !dev->stream.active) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
         }
+        device_call call(dev);
 
-        RETURN_IF_ERROR_KEY(status, "info");
+        read_stream &stream = dev->stream;
+        read_stream_next_guard guard(stream);
+        co_await read_stream_awaiter{{}, stream};
 
-        return build_response(status, "info", bitmap_info_to_val(info));
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (stream.stop || !stream.active) {
+            co_return val(fast_begin(dev->fast_stream, SANE_STATUS_CANCELLED));
+        }
+        if (stream.filled_slots.empty()) {
+            dev->parameters_valid = false;
+            co_return val(fast_begin(dev->fast_stream, stream.status));
+        }
+        int slot = stream.filled_slots.front();
+        stream.filled_slots.pop_front();
+        if (slot == READ_STREAM_PAGE_END) {
+            co_return val(fast_begin(dev->fast_stream, SANE_STATUS_EOF));
+        }
+        int res = fast_begin(dev->fast_stream, SANE_STATUS_GOOD);
+        if (slot == READ_STREAM_PAGE_START) {
+            fast_set_parameters(dev->fast_stream, stream.pages.front());
+            dev->parameters = stream.pages.front();
+            dev->parameters_valid = true;
+            stream.pages.pop_front();
+            co_return val(res);
+        }
+        fast_set_data(dev->fast_stream, stream.slots[slot].data(), stream.lengths[slot]);
+        dev->fast_stream.words[FAST_SLOT] = slot;
+        co_return val(res);
     }
 
-    val sane_control_option_set_auto(int option) {
-        SANE_Int info = 0;
-        SANE_Status status = ::sane_control_option(handle, option, SANE_ACTION_SET_AUTO, NULL, &info);
-        RETURN_IF_ERROR_KEY(status, "info");
-        return build_response(status, "info", bitmap_info_to_val(info));
+    val device_fast_control_option_get_value(device *dev, int option) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
+        }
+        device_call call(dev);
+
+        SANE_Option_Descriptor desc = {}; // copied on the helper thread
+        std::vector<SANE_Byte> v;
+        SANE_Int info = 0; // discard
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, &desc, &v, &info] {
+            const SANE_Option_Descriptor *d = dev->be->get_option_descriptor(dev->handle, option);
+            if (!d) {
+                return SANE_STATUS_INVAL;
+            }
+            desc = *d;
+            v.resize(std::max(desc.size, 0));
+            return dev->be->control_option(dev->handle, option, SANE_ACTION_GET_VALUE, v.empty() ? NULL : v.data(), &info);
+        });
+        int res = fast_begin(dev->fast, status);
+        if (status == SANE_STATUS_GOOD) {
+            dev->fast_value.swap(v);
+            fast_set_value(dev->fast, &desc, dev->fast_value.empty() ? NULL : dev->fast_value.data());
+        }
+        co_return val(res);
     }
 
-    val sane_get_parameters() {
-        if (!handle) {
-            return build_response(SANE_STATUS_INVAL, "parameters");
+    val device_fast_control_option_set_value(device *dev, int option, val value) {
+        if (!dev || dev->closing || !dev->handle) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
+        }
+        device_call call(dev);
+
+        // the descriptor comes from the cache (copied on the helper thread)
+        if (!dev->options.valid) {
+            option_snapshot cached;
+            SANE_Status status = co_await run_on_thread(*dev->thread, [dev, &cached] {
+                return option_snapshot_read_descriptors(dev->be, dev->handle, cached);
+            });
+            option_cache_reload(dev->options, status, cached);
+        }
+        option_descriptor_ref desc_copy = option_cache_descriptor(dev->options, option);
+        if (!desc_copy) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
         }
+        const SANE_Option_Descriptor *desc = &desc_copy->desc;
 
-        SANE_Parameters params;
-        SANE_Status status = ::sane_get_parameters(handle, &params);
-        RETURN_IF_ERROR_KEY(status, "parameters");
+        bool set_auto = value.isNull(); // null means auto
+        std::vector<SANE_Byte> v(std::max(desc->size, 0));
+        if (!set_auto && !option_value_from_val(desc, value, v.data())) {
+            co_return val(fast_error(SANE_STATUS_INVAL));
+        }
 
-        val parameters = val::object();
-        parameters.set("format", (int) params.format);
-        parameters.set("last_frame", (bool) params.last_frame);
-        parameters.set("bytes_per_line", params.bytes_per_line);
-        parameters.set("pixels_per_line", params.pixels_per_line);
-        parameters.set("lines", params.lines);
-        parameters.set("depth", params.depth);
-        return build_response(status, "parameters", parameters);
+        SANE_Int info = 0;
+        option_snapshot snap;
+        SANE_Status snap_status = SANE_STATUS_GOOD;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [dev, option, set_auto, &v, &info, &snap, &snap_status] {
+            SANE_Status status = set_auto
+                ? dev->be->control_option(dev->handle, option, SANE_ACTION_SET_AUTO, NULL, &info)
+                : dev->be->control_option(dev->handle, option, SANE_ACTION_SET_VALUE, v.empty() ? NULL : v.data(), &info);
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                snap_status = option_snapshot_read_descriptors(dev->be, dev->handle, snap);
+            }
+            return status;
+        });
+        if (info & SANE_INFO_RELOAD_OPTIONS) {
+            option_cache_reload(dev->options, snap_status, snap);
+        }
+        int res = fast_begin(dev->fast, status);
+        if (status == SANE_STATUS_GOOD) {
+            dev->fast.words[FAST_INFO] = info;
+        }
+        co_return val(res);
     }
 
-    val sane_start() {
-        if (!handle) {
-            return build_response(SANE_STATUS_INVAL);
+    int device_fast_image_convert(device *dev, int data, int length) {
+        if (!dev || !dev->converter.convert_line || length < 0) {
+            return fast_error(SANE_STATUS_INVAL);
         }
 
-        SANE_Status status = ::sane_start(handle);
-        return build_response(status);
+        image_converter &converter = dev->converter;
+        int lines = image_converter_write(converter, (const SANE_Byte *) (uintptr_t) data, length);
+        size_t out_bpl = (size_t) converter.params.pixels_per_line * converter.bytes_per_pixel;
+        int res = fast_begin(dev->fast_sync, SANE_STATUS_GOOD);
+        fast_set_data(dev->fast_sync, converter.output.data(), lines * out_bpl);
+        dev->fast_sync.words[FAST_LINE] = converter.line - lines;
+        dev->fast_sync.words[FAST_LINES] = lines;
+        return res;
     }
 
-    val sane_read() {
-        if (!handle) {
-            co_return build_response(SANE_STATUS_INVAL, "data");
+    int device_fast_encoder_write(device *dev, int data, int length) {
+        if (!dev || dev->encoder.format == -1 || length < 0) {
+            return fast_error(SANE_STATUS_INVAL);
         }
 
-        SANE_Int len = 0;
-        SANE_Status status = co_await run_on_helper_thread([&len] {
-            return ::sane_read(handle, buffer, BUFFER_LEN, &len);
-        });
-        CORETURN_IF_ERROR_KEY(status, "data");
+        image_encoder &encoder = dev->encoder;
+        SANE_Status status = image_encoder_write(encoder, (const SANE_Byte *) (uintptr_t) data, length);
+        int res = fast_begin(dev->fast_sync, status);
+        if (status == SANE_STATUS_GOOD) {
+            fast_set_data(dev->fast_sync, encoder.out.data(), encoder.out.size());
+        }
+        return res;
+    }
 
-        val data = val(typed_memory_view(len, buffer));
-        co_return build_response(status, "data", data);
+    // Staging buffer for fast API input that is not in the module memory,
+    // pre.js copies the data here, valid until the next call.
+    int sane_fast_input(int length) {
+        fast_input.resize(std::max(length, 1));
+        return (int) (uintptr_t) fast_input.data();
     }
 
-    val sane_cancel() {
-        if (!handle) {
-            co_return build_response(SANE_STATUS_INVAL);
+    // single handle API (uses the fixed device)
+
+    val sane_close() { return device_close(&single); }
+    val sane_get_option_descriptor(int option) { return device_get_option_descriptor(&single, option); }
+    val sane_control_option_get_value(int option) { return device_control_option_get_value(&single, option); }
+    val sane_control_option_set_value(int option, val value) { return device_control_option_set_value(&single, option, value); }
+    val sane_control_option_set_auto(int option) { return device_control_option_set_auto(&single, option); }
+    val sane_get_all_options() { return device_get_all_options(&single); }
+    val sane_set_option(int option, val value) { return device_set_option(&single, option, value); }
+    val sane_control_options_apply(val profile) { return device_control_options_apply(&single, profile); }
+    val sane_get_parameters() { return device_get_parameters(&single); }
+    val sane_start() { return device_start(&single); }
+    val sane_read() { return device_read(&single); }
+    val sane_read_blocking() { return device_read_blocking(&single); }
+    val sane_cancel() { return device_cancel(&single); }
+    val sane_read_stream_start() { return device_read_stream_start(&single, false); }
+    val sane_read_stream_start_batch() { return device_read_stream_start(&single, true); }
+    val sane_read_stream_next() { return device_read_stream_next(&single); }
+    val sane_read_stream_release(int slot) { return device_read_stream_release(&single, slot); }
+    val sane_read_stream_stop() { return device_read_stream_stop(&single); }
+    val sane_read_stream_stats() { return device_read_stream_stats(&single); }
+    val sane_image_begin(val parameters, int layout) { return device_image_begin(&single, parameters, layout); }
+    val sane_image_convert(val data) { return device_image_convert(&single, data); }
+    val sane_image_preview(int width, int levels) { return device_image_preview(&single, width, levels); }
+    val sane_image_preview_get() { return device_image_preview_get(&single); }
+    val sane_image_end() { return device_image_end(&single); }
+    val sane_encoder_begin(val parameters, int format, val options) { return device_encoder_begin(&single, parameters, format, options); }
+    val sane_encoder_write(val data) { return device_encoder_write(&single, data); }
+    val sane_encoder_end() { return device_encoder_end(&single); }
+    val sane_fast_get_parameters() { return device_fast_get_parameters(&single); }
+    val sane_fast_read() { return device_fast_read(&single, false); }
+    val sane_fast_read_blocking() { return device_fast_read(&single, true); }
+    val sane_fast_read_stream_next() { return device_fast_read_stream_next(&single); }
+    val sane_fast_control_option_get_value(int option) { return device_fast_control_option_get_value(&single, option); }
+    val sane_fast_control_option_set_value(int option, val value) { return device_fast_control_option_set_value(&single, option, value); }
+    int sane_fast_image_convert(int data, int length) { return device_fast_image_convert(&single, data, length); }
+    int sane_fast_encoder_write(int data, int length) { return device_fast_encoder_write(&single, data, length); }
+
+    // handle API (sane-wasm, not part of SANE API)
+
+    val sane_handle_open(std::string devicename) {
+        if (!version_code) {
+            co_return build_response(SANE_STATUS_INVAL, "handle");
         }
 
-        co_await run_on_helper_thread([&] {
-            ::sane_cancel(handle);
-            return NULL;
+        // the device thread is picked now, sane_open already runs on it
+        device *dev = new device();
+        dev->thread = acquire_thread();
+        SANE_Handle h = NULL;
+        option_snapshot snap;
+        SANE_Status snap_status = SANE_STATUS_INVAL;
+        SANE_Status status = co_await run_on_thread(*dev->thread, [&devicename, dev, &h, &snap, &snap_status] {
+            SANE_Status status = backends_open(devicename, &dev->be, &h);
+            if (status == SANE_STATUS_GOOD) {
+                snap_status = option_snapshot_read_descriptors(dev->be, h, snap);
+            }
+            return status;
         });
-        co_return build_response(SANE_STATUS_GOOD);
+        if (status != SANE_STATUS_GOOD) {
+            free_device(dev);
+            co_return build_response(status, "handle");
+        }
+
+        dev->handle = h;
+        option_cache_reload(dev->options, snap_status, snap);
+        dev->buffer.resize(buffer_len);
+        int handle = handles_next++;
+        handles[handle] = dev;
+        co_return build_response(status, "handle", val(handle));
     }
 
-    val sane_strstatus(int status) {
-        return val(::sane_strstatus((SANE_Status) status));
+    val sane_handle_close(int handle) {
+        device *dev = find_device(handle);
+        handles.erase(handle); // no new calls on this handle
+        return device_close(dev);
     }
 
+    val sane_handle_get_option_descriptor(int handle, int option) { return device_get_option_descriptor(find_device(handle), option); }
+    val sane_handle_control_option_get_value(int handle, int option) { return device_control_option_get_value(find_device(handle), option); }
+    val sane_handle_control_option_set_value(int handle, int option, val value) { return device_control_option_set_value(find_device(handle), option, value); }
+    val sane_handle_control_option_set_auto(int handle, int option) { return device_control_option_set_auto(find_device(handle), option); }
+    val sane_handle_get_all_options(int handle) { return device_get_all_options(find_device(handle)); }
+    val sane_handle_set_option(int handle, int option, val value) { return device_set_option(find_device(handle), option, value); }
+    val sane_handle_control_options_apply(int handle, val profile) { return device_control_options_apply(find_device(handle), profile); }
+    val sane_handle_get_parameters(int handle) { return device_get_parameters(find_device(handle)); }
+    val sane_handle_start(int handle) { return device_start(find_device(handle)); }
+    val sane_handle_read(int handle) { return device_read(find_device(handle)); }
+    val sane_handle_read_blocking(int handle) { return device_read_blocking(find_device(handle)); }
+    val sane_handle_cancel(int handle) { return device_cancel(find_device(handle)); }
+    val sane_handle_read_stream_start(int handle) { return device_read_stream_start(find_device(handle), false); }
+    val sane_handle_read_stream_start_batch(int handle) { return device_read_stream_start(find_device(handle), true); }
+    val sane_handle_read_stream_next(int handle) { return device_read_stream_next(find_device(handle)); }
+    val sane_handle_read_stream_release(int handle, int slot) { return device_read_stream_release(find_device(handle), slot); }
+    val sane_handle_read_stream_stop(int handle) { return device_read_stream_stop(find_device(handle)); }
+    val sane_handle_read_stream_stats(int handle) { return device_read_stream_stats(find_device(handle)); }
+    val sane_handle_image_begin(int handle, val parameters, int layout) { return device_image_begin(find_device(handle), parameters, layout); }
+    val sane_handle_image_convert(int handle, val data) { return device_image_convert(find_device(handle), data); }
+    val sane_handle_image_preview(int handle, int width, int levels) { return device_image_preview(find_device(handle), width, levels); }
+    val sane_handle_image_preview_get(int handle) { return device_image_preview_get(find_device(handle)); }
+    val sane_handle_image_end(int handle) { return device_image_end(find_device(handle)); }
+    val sane_handle_encoder_begin(int handle, val parameters, int format, val options) { return device_encoder_begin(find_device(handle), parameters, format, options); }
+    val sane_handle_encoder_write(int handle, val data) { return device_encoder_write(find_device(handle), data); }
+    val sane_handle_encoder_end(int handle) { return device_encoder_end(find_device(handle)); }
+    val sane_handle_fast_get_parameters(int handle) { return device_fast_get_parameters(find_device(handle)); }
+    val sane_handle_fast_read(int handle) { return device_fast_read(find_device(handle), false); }
+    val sane_handle_fast_read_blocking(int handle) { return device_fast_read(find_device(handle), true); }
+    val sane_handle_fast_read_stream_next(int handle) { return device_fast_read_stream_next(find_device(handle)); }
+    val sane_handle_fast_control_option_get_value(int handle, int option) { return device_fast_control_option_get_value(find_device(handle), option); }
+    val sane_handle_fast_control_option_set_value(int handle, int option, val value) { return device_fast_control_option_set_value(find_device(handle), option, value); }
+    int sane_handle_fast_image_convert(int handle, int data, int length) { return device_fast_image_convert(find_device(handle), data, length); }
+    int sane_handle_fast_encoder_write(int handle, int data, int length) { return device_fast_encoder_write(find_device(handle), data, length); }
 }
 
 /*
@@ -611,7 +3447,30 @@ int main() {
     module_set("SANE_UNIT", map_to_val_object(sane::SANE_UNIT).as_handle());
     module_set("SANE_CONSTRAINT", map_to_val_object(sane::SANE_CONSTRAINT).as_handle());
     module_set("SANE_FRAME", map_to_val_object(sane::SANE_FRAME).as_handle());
+    module_set("SANE_IMAGE_LAYOUT", map_to_val_object(sane::SANE_IMAGE_LAYOUT).as_handle());
+    module_set("SANE_IMAGE_FORMAT", map_to_val_object(sane::SANE_IMAGE_FORMAT).as_handle());
+    metrics_enabled = val::module_property("sane")["metrics"].isTrue();
     helper = std::thread(helper_thread_main);
+    discovery = std::thread(helper_thread_main);
+    single.thread = &helper;
+    val opt = val::module_property("sane")["readBufferSize"];
+    if (opt.isNumber() && opt.as<int>() > 0) {
+        buffer_len = opt.as<int>();
+    }
+    single.buffer.resize(buffer_len);
+    opt = val::module_property("sane")["readIdleMax"];
+    if (opt.isNumber() && opt.as<double>() > 0) {
+        read_idle_max_ms = opt.as<double>();
+    }
+    // handle API device threads, more are created if needed
+    int n = THREAD_POOL_SIZE;
+    opt = val::module_property("sane")["threadPoolSize"];
+    if (opt.isNumber() && opt.as<int>() >= 0) {
+        n = opt.as<int>();
+    }
+    for (int i = 0; i < n; i++) {
+        idle_threads.push_back(new std::thread(helper_thread_main));
+    }
     return 0;
 }
 
@@ -619,21 +3478,89 @@ EMSCRIPTEN_BINDINGS(sane_bindings) {
     constant("SANE_WASM_COMMIT", val(SANE_WASM_COMMIT));
     constant("SANE_WASM_VERSION", val(SANE_WASM_VERSION));
     constant("SANE_WASM_BACKENDS", val(SANE_WASM_BACKENDS));
+    constant("SANE_WASM_INITIAL_MEMORY", SANE_WASM_INITIAL_MEMORY);
     constant("SANE_CURRENT_MAJOR", SANE_CURRENT_MAJOR);
     constant("SANE_CURRENT_MINOR", SANE_CURRENT_MINOR);
     function("sane_get_state", &sane::sane_get_state);
+    function("sane_get_metrics", &sane::sane_get_metrics);
+    function("sane_reset_metrics", &sane::sane_reset_metrics);
+    function("sane_get_memory_stats", &sane::sane_get_memory_stats);
     function("sane_init", &sane::sane_init);
     function("sane_exit", &sane::sane_exit);
     function("sane_get_devices", &sane::sane_get_devices);
+    function("sane_discovery_probe", &sane::sane_discovery_probe);
     function("sane_open", &sane::sane_open);
     function("sane_close", &sane::sane_close);
     function("sane_get_option_descriptor", &sane::sane_get_option_descriptor);
     function("sane_control_option_get_value", &sane::sane_control_option_get_value);
     function("sane_control_option_set_value", &sane::sane_control_option_set_value);
     function("sane_control_option_set_auto", &sane::sane_control_option_set_auto);
+    function("sane_get_all_options", &sane::sane_get_all_options);
+    function("sane_set_option", &sane::sane_set_option);
+    function("sane_control_options_apply", &sane::sane_control_options_apply);
     function("sane_get_parameters", &sane::sane_get_parameters);
     function("sane_start", &sane::sane_start);
     function("sane_read", &sane::sane_read);
+    function("sane_read_blocking", &sane::sane_read_blocking);
     function("sane_cancel", &sane::sane_cancel);
+    function("sane_read_stream_start", &sane::sane_read_stream_start);
+    function("sane_read_stream_start_batch", &sane::sane_read_stream_start_batch);
+    function("sane_read_stream_next", &sane::sane_read_stream_next);
+    function("sane_read_stream_release", &sane::sane_read_stream_release);
+    function("sane_read_stream_stop", &sane::sane_read_stream_stop);
+    function("sane_read_stream_stats", &sane::sane_read_stream_stats);
     function("sane_strstatus", &sane::sane_strstatus);
+    function("sane_image_begin", &sane::sane_image_begin);
+    function("sane_image_convert", &sane::sane_image_convert);
+    function("sane_image_preview", &sane::sane_image_preview);
+    function("sane_image_preview_get", &sane::sane_image_preview_get);
+    function("sane_image_end", &sane::sane_image_end);
+    function("sane_encoder_begin", &sane::sane_encoder_begin);
+    function("sane_encoder_write", &sane::sane_encoder_write);
+    function("sane_encoder_end", &sane::sane_encoder_end);
+    function("sane_fast_get_parameters", &sane::sane_fast_get_parameters);
+    function("sane_fast_read", &sane::sane_fast_read);
+    function("sane_fast_read_blocking", &sane::sane_fast_read_blocking);
+    function("sane_fast_read_stream_next", &sane::sane_fast_read_stream_next);
+    function("sane_fast_control_option_get_value", &sane::sane_fast_control_option_get_value);
+    function("sane_fast_control_option_set_value", &sane::sane_fast_control_option_set_value);
+    function("sane_fast_image_convert", &sane::sane_fast_image_convert);
+    function("sane_fast_encoder_write", &sane::sane_fast_encoder_write);
+    function("sane_fast_input", &sane::sane_fast_input);
+    function("sane_handle_open", &sane::sane_handle_open);
+    function("sane_handle_close", &sane::sane_handle_close);
+    function("sane_handle_get_option_descriptor", &sane::sane_handle_get_option_descriptor);
+    function("sane_handle_control_option_get_value", &sane::sane_handle_control_option_get_value);
+    function("sane_handle_control_option_set_value", &sane::sane_handle_control_option_set_value);
+    function("sane_handle_control_option_set_auto", &sane::sane_handle_control_option_set_auto);
+    function("sane_handle_get_all_options", &sane::sane_handle_get_all_options);
+    function("sane_handle_set_option", &sane::sane_handle_set_option);
+    function("sane_handle_control_options_apply", &sane::sane_handle_control_options_apply);
+    function("sane_handle_get_parameters", &sane::sane_handle_get_parameters);
+    function("sane_handle_start", &sane::sane_handle_start);
+    function("sane_handle_read", &sane::sane_handle_read);
+    function("sane_handle_read_blocking", &sane::sane_handle_read_blocking);
+    function("sane_handle_cancel", &sane::sane_handle_cancel);
+    function("sane_handle_read_stream_start", &sane::sane_handle_read_stream_start);
+    function("sane_handle_read_stream_start_batch", &sane::sane_handle_read_stream_start_batch);
+    function("sane_handle_read_stream_next", &sane::sane_handle_read_stream_next);
+    function("sane_handle_read_stream_release", &sane::sane_handle_read_stream_release);
+    function("sane_handle_read_stream_stop", &sane::sane_handle_read_stream_stop);
+    function("sane_handle_read_stream_stats", &sane::sane_handle_read_stream_stats);
+    function("sane_handle_image_begin", &sane::sane_handle_image_begin);
+    function("sane_handle_image_convert", &sane::sane_handle_image_convert);
+    function("sane_handle_image_preview", &sane::sane_handle_image_preview);
+    function("sane_handle_image_preview_get", &sane::sane_handle_image_preview_get);
+    function("sane_handle_image_end", &sane::sane_handle_image_end);
+    function("sane_handle_encoder_begin", &sane::sane_handle_encoder_begin);
+    function("sane_handle_encoder_write", &sane::sane_handle_encoder_write);
+    function("sane_handle_encoder_end", &sane::sane_handle_encoder_end);
+    function("sane_handle_fast_get_parameters", &sane::sane_handle_fast_get_parameters);
+    function("sane_handle_fast_read", &sane::sane_handle_fast_read);
+    function("sane_handle_fast_read_blocking", &sane::sane_handle_fast_read_blocking);
+    function("sane_handle_fast_read_stream_next", &sane::sane_handle_fast_read_stream_next);
+    function("sane_handle_fast_control_option_get_value", &sane::sane_handle_fast_control_option_get_value);
+    function("sane_handle_fast_control_option_set_value", &sane::sane_handle_fast_control_option_set_value);
+    function("sane_handle_fast_image_convert", &sane::sane_handle_fast_image_convert);
+    function("sane_handle_fast_encoder_write", &sane::sane_handle_fast_encoder_write);
 }
@@ -1,7 +1,34 @@
-if (globalThis.window && globalThis.window.document) {
-    // browser environment (e.g. webpack)
+if ((globalThis.window && globalThis.window.document) || typeof importScripts === 'function') {
+    // browser environment (e.g. webpack), also web workers (libsaneWorker)
     module.exports = require('./loader.js');
 } else {
     // local environment (e.g. node)
-    module.exports = eval('require')('../build/libsane.js');
+    // use the JSPI build (build/jspi, opt-in with the jspi option) or the
+    // release build (build/simd) if they exist and are supported, fallback
+    // to the compatibility build
+    const req = eval('require');
+    const factoryPath = (jspi) => {
+        const paths = [
+            ...(jspi && require('./jspi.js')() ? ['../build/jspi/libsane.js'] : []),
+            ...(require('./simd.js')() ? ['../build/simd/libsane.js'] : []),
+        ];
+        for (const path of paths) {
+            try {
+                return req.resolve(path);
+            } catch (e) {
+                // not built
+            }
+        }
+        return '../build/libsane.js';
+    };
+    // compiled wasm modules, shared by all instances on this process
+    const wasmCache = new Map();
+    module.exports = (options) => {
+        options = options || {};
+        const factory = req(factoryPath(options.sane && options.sane.jspi));
+        return factory({
+            ...options,
+            sane: { wasmCache, ...(options.sane || {}) },
+        });
+    };
 }
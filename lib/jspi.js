@@ -0,0 +1,6 @@
+// Detects JavaScript Promise Integration (JSPI) support, the current API
+// (WebAssembly.Suspending and WebAssembly.promising), used by the JSPI build.
+// https://github.com/WebAssembly/js-promise-integration
+module.exports = () => typeof WebAssembly === 'object' &&
+    typeof WebAssembly.Suspending === 'function' &&
+    typeof WebAssembly.promising === 'function';
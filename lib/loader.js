@@ -1,4 +1,6 @@
 const { version } = require('../package.json');
+const simdSupported = require('./simd.js');
+const jspiSupported = require('./jspi.js');
 
 // we cannot use unpkg as a CDN because they don't set CORP
 // Cross-Origin-Resource-Policy: cross-origin
@@ -10,6 +12,10 @@ const cdnURL = `https://cdn.jsdelivr.net/npm/sane-wasm@${version}/build`;
 let libPromise = null;
 
 function loadScript(src) {
+    if (typeof importScripts === 'function') {
+        // web worker (libsaneWorker)
+        return new Promise(resolve => resolve(importScripts(src)));
+    }
     return new Promise((resolve, reject) => {
         document.head.append(Object.assign(
             document.createElement('script'),
@@ -23,25 +29,41 @@ function fetchFileToBlobURL(src) {
 }
 
 async function prepareLib(options) {
-    const jsURL = `${options.sane.loaderURL}/libsane.js`;
-    const jsWorkerURL = `${options.sane.loaderURL}/libsane.worker.js`;
-    const jsWasmURL = `${options.sane.loaderURL}/libsane.wasm`;
+    const start = performance.now();
+    // pick the JSPI build (opt-in) or the release build (SIMD) when supported
+    let baseURL = options.sane.loaderURL;
+    if (options.sane.jspi && jspiSupported()) {
+        baseURL = `${baseURL}/jspi`;
+    } else if (options.sane.loaderSIMD && simdSupported()) {
+        baseURL = `${baseURL}/simd`;
+    }
+    // slim variant (build.sh --slim), only the backends of one family
+    if (options.sane.loaderFamily) {
+        baseURL = `${baseURL}/slim/${options.sane.loaderFamily}`;
+    }
+    const jsURL = `${baseURL}/libsane.js`;
+    const jsWorkerURL = `${baseURL}/libsane.worker.js`;
+    const jsWasmURL = `${baseURL}/libsane.wasm`;
+    const dataURL = `${baseURL}/libsane.data`;
 
     const filesToPrefetch = options.sane.loaderPrefetchToBlob ? [
         // because of security restrictions around the Worker constructor
         // we need to prefetch the worker js and serve it from a blob
         // see: https://github.com/emscripten-core/emscripten/issues/8338
         jsWorkerURL,
+        // the config files bundle (/etc/sane.d), small
+        dataURL,
         // since we are already doing all this work to fetch the files in
-        // parallel, might as well prefetch the wasm file
-        jsWasmURL,
+        // parallel, might as well prefetch the wasm file, not in streaming
+        // mode, it's compiled while downloading (see pre.js)
+        ...(options.sane.loaderStreaming ? [] : [jsWasmURL]),
     ] : [];
 
     const [lib, prefetchResult] = await Promise.all([
         loadScript(jsURL).then(() => {
-            const lib = window.LibSANE;
+            const lib = globalThis.LibSANE;
             if (options.sane.loaderRemoveGlobal) {
-                window.LibSANE = undefined; // nuke global variable
+                globalThis.LibSANE = undefined; // nuke global variable
             }
             return lib;
         }),
@@ -53,7 +75,7 @@ async function prepareLib(options) {
         return obj;
     }, {});
 
-    return { lib, preFetchedFiles };
+    return { lib, baseURL, jsURL, preFetchedFiles, timing: { start, fetch: performance.now() - start } };
 }
 
 module.exports = async (options) => {
@@ -62,6 +84,9 @@ module.exports = async (options) => {
         loaderURL: cdnURL,
         loaderPrefetchToBlob: true,
         loaderRemoveGlobal: true,
+        loaderSIMD: true,
+        loaderFamily: null,
+        loaderStreaming: false,
         ...(options.sane || {}),
     };
 
@@ -69,11 +94,20 @@ module.exports = async (options) => {
         libPromise = prepareLib(options);
     }
 
-    const { lib, preFetchedFiles } = await libPromise;
+    const { lib, baseURL, jsURL, preFetchedFiles, timing } = await libPromise;
+    if (!timing.used) {
+        // only the first instance waits for the loader
+        timing.used = true;
+        options.sane.loaderTiming = options.sane.loaderTiming || timing;
+    }
+    // locate the files from baseURL, not from the script location (prefix),
+    // on a web worker (libsaneWorker) that is the location of the worker
+    // script, the pthreads also need the script URL for the same reason
     return lib({
+        mainScriptUrlOrBlob: jsURL,
         ...(options || {}),
         locateFile: (path, prefix) => {
-            const fullUrl = `${prefix}${path}`;
+            const fullUrl = `${baseURL}/${path}`;
             return preFetchedFiles[fullUrl] ? preFetchedFiles[fullUrl] : (options.locateFile ? options.locateFile(path, prefix) : fullUrl);
         },
     });
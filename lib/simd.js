@@ -0,0 +1,20 @@
+// Detects WebAssembly SIMD (simd128) support by validating a tiny module
+// that uses SIMD instructions (i8x16.splat + i8x16.popcnt).
+// https://github.com/GoogleChromeLabs/wasm-feature-detect
+const simdModule = new Uint8Array([
+    0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10,
+    1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
+
+let supported = null;
+
+module.exports = () => {
+    if (supported === null) {
+        try {
+            supported = typeof WebAssembly === 'object' && WebAssembly.validate(simdModule);
+        } catch (e) {
+            supported = false;
+        }
+    }
+    return supported;
+};
@@ -51,4 +51,13 @@
             globalThis.navigator.usb = require('usb').webusb;
         }
     }
+
+    // USB API replacement (e.g. USBRecorder/USBReplay, see src/usb-trace.ts),
+    // libusb always uses navigator.usb (on the main thread)
+    if (Module.sane.usb && !ENVIRONMENT_IS_PTHREAD) {
+        if (!globalThis.navigator) {
+            globalThis.navigator = {};
+        }
+        Object.defineProperty(globalThis.navigator, 'usb', { value: Module.sane.usb, configurable: true, writable: true });
+    }
 }
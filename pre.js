@@ -56,6 +56,88 @@
     }
     EnumSANE.reverseObject = Symbol("reverseObject");
 
+    // The fast API functions (sane_fast_*) return the address of packed
+    // int32 words (see fast_result on glue.cpp, same layout). The words are
+    // copied right away (the next call overwrites them), the usual result
+    // properties (info, parameters, value) are only built when used.
+    // Data views are over the module memory and only valid until the next
+    // call, same as the regular functions.
+    const FAST_STATUS = 0;
+    const FAST_INFO = 1;
+    const FAST_DATA = 2;
+    const FAST_LENGTH = 3;
+    const FAST_SLOT = 4;
+    const FAST_LINE = 5;
+    const FAST_LINES = 6;
+    const FAST_VALUE_TYPE = 7;
+    const FAST_VALUE_COUNT = 8;
+    const FAST_PARAMETERS = 9;
+    const FAST_WORDS = 16;
+
+    class FastResult {
+        constructor(ptr) {
+            this._w = HEAP32.slice(ptr >> 2, (ptr >> 2) + FAST_WORDS);
+        }
+
+        get status() {
+            return this._w[FAST_STATUS];
+        }
+
+        get info() {
+            const info = this._w[FAST_INFO];
+            return this.status ? null : {
+                INEXACT: (info & 1) !== 0, // SANE_INFO_INEXACT
+                RELOAD_OPTIONS: (info & 2) !== 0, // SANE_INFO_RELOAD_OPTIONS
+                RELOAD_PARAMS: (info & 4) !== 0, // SANE_INFO_RELOAD_PARAMS
+            };
+        }
+
+        get data() {
+            const ptr = this._w[FAST_DATA];
+            return ptr ? HEAPU8.subarray(ptr, ptr + this._w[FAST_LENGTH]) : null;
+        }
+
+        get slot() {
+            const slot = this._w[FAST_SLOT];
+            return slot < 0 ? null : slot;
+        }
+
+        get line() {
+            return this._w[FAST_LINE];
+        }
+
+        get lines() {
+            return this._w[FAST_LINES];
+        }
+
+        get parameters() {
+            const w = this._w;
+            const i = FAST_PARAMETERS + 1;
+            return w[FAST_PARAMETERS] ? {
+                format: w[i],
+                last_frame: !!w[i + 1],
+                bytes_per_line: w[i + 2],
+                pixels_per_line: w[i + 3],
+                lines: w[i + 4],
+                depth: w[i + 5],
+            } : null;
+        }
+
+        get value() {
+            const type = this._w[FAST_VALUE_TYPE];
+            const n = this._w[FAST_VALUE_COUNT];
+            const ptr = this._w[FAST_DATA];
+            const words = HEAP32.subarray(ptr >> 2, (ptr >> 2) + n);
+            switch (type) {
+                case 0: return words[0] !== 0; // SANE_TYPE_BOOL
+                case 1: return n === 1 ? words[0] : Array.from(words); // SANE_TYPE_INT
+                case 2: return n === 1 ? words[0] / 65536 : Array.from(words, w => w / 65536); // SANE_TYPE_FIXED
+                case 3: return UTF8ToString(ptr, this._w[FAST_LENGTH]); // SANE_TYPE_STRING
+            }
+            return null;
+        }
+    }
+
     // Many SANE functions are expected to return a promise, even though
     // they originally are blocking calls. This happens because we use
     // emscripten's asyncify feature.
@@ -77,29 +159,349 @@
         sane_init: false, // sync?
         sane_exit: true, // async, exiting when device is open
         sane_get_devices: true, // async
+        sane_discovery_probe: true, // same as sane_get_devices
         sane_open: true, // async
         sane_close: true, // async
         sane_get_option_descriptor: false, // sync
         sane_control_option_get_value: true, // some options are async
         sane_control_option_set_value: true, // some options are async
         sane_control_option_set_auto: true, // suspected of possibly being async
+        sane_get_all_options: true, // async, implemented in glue.cpp
+        sane_set_option: true, // async, implemented in glue.cpp
+        sane_control_options_apply: true, // async, implemented in glue.cpp
         sane_get_parameters: true, // async, on some backends
         sane_start: true, // async, on some backends
         sane_read: true, // async, waits for scan completion
+        sane_read_blocking: true, // async, implemented in glue.cpp
+        sane_read_stream_start: false, // sync, implemented in glue.cpp
+        sane_read_stream_start_batch: false, // sync, implemented in glue.cpp
+        sane_read_stream_next: true, // async, implemented in glue.cpp
+        sane_read_stream_release: false, // sync, implemented in glue.cpp
+        sane_read_stream_stop: true, // async, implemented in glue.cpp
+        sane_read_stream_stats: false, // sync, implemented in glue.cpp
         sane_cancel: true, // async, waits for scan completion
         sane_strstatus: false, // sync
+        sane_image_begin: false, // sync, implemented in glue.cpp
+        sane_image_convert: false, // sync, implemented in glue.cpp
+        sane_image_preview: false, // sync, implemented in glue.cpp
+        sane_image_preview_get: false, // sync, implemented in glue.cpp
+        sane_image_end: false, // sync, implemented in glue.cpp
+        sane_encoder_begin: false, // sync, implemented in glue.cpp
+        sane_encoder_write: false, // sync, implemented in glue.cpp
+        sane_encoder_end: false, // sync, implemented in glue.cpp
+        sane_fast_get_parameters: true, // same as sane_get_parameters
+        sane_fast_read: true, // same as sane_read
+        sane_fast_read_blocking: true, // same as sane_read_blocking
+        sane_fast_read_stream_next: true, // same as sane_read_stream_next
+        sane_fast_control_option_get_value: true, // same as sane_control_option_get_value
+        sane_fast_control_option_set_value: true, // same as sane_control_option_set_value
+        sane_fast_image_convert: false, // sync, implemented in glue.cpp
+        sane_fast_encoder_write: false, // sync, implemented in glue.cpp
+        sane_get_metrics: false, // sync, implemented in glue.cpp
+        sane_reset_metrics: false, // sync, implemented in glue.cpp
+        sane_get_memory_stats: false, // sync, implemented in glue.cpp
+        sane_handle_open: true, // same as sane_open
+        sane_handle_close: true, // async, implemented in glue.cpp
+        sane_handle_get_option_descriptor: false, // same as sane_get_option_descriptor
+        sane_handle_control_option_get_value: true, // same as sane_control_option_get_value
+        sane_handle_control_option_set_value: true, // same as sane_control_option_set_value
+        sane_handle_control_option_set_auto: true, // same as sane_control_option_set_auto
+        sane_handle_get_all_options: true, // async, implemented in glue.cpp
+        sane_handle_set_option: true, // async, implemented in glue.cpp
+        sane_handle_control_options_apply: true, // async, implemented in glue.cpp
+        sane_handle_get_parameters: true, // same as sane_get_parameters
+        sane_handle_start: true, // same as sane_start
+        sane_handle_read: true, // async, implemented in glue.cpp
+        sane_handle_read_blocking: true, // async, implemented in glue.cpp
+        sane_handle_cancel: true, // async, implemented in glue.cpp
+        sane_handle_read_stream_start: false, // sync, implemented in glue.cpp
+        sane_handle_read_stream_start_batch: false, // sync, implemented in glue.cpp
+        sane_handle_read_stream_next: true, // async, implemented in glue.cpp
+        sane_handle_read_stream_release: false, // sync, implemented in glue.cpp
+        sane_handle_read_stream_stop: true, // async, implemented in glue.cpp
+        sane_handle_read_stream_stats: false, // sync, implemented in glue.cpp
+        sane_handle_image_begin: false, // sync, implemented in glue.cpp
+        sane_handle_image_convert: false, // sync, implemented in glue.cpp
+        sane_handle_image_preview: false, // sync, implemented in glue.cpp
+        sane_handle_image_preview_get: false, // sync, implemented in glue.cpp
+        sane_handle_image_end: false, // sync, implemented in glue.cpp
+        sane_handle_encoder_begin: false, // sync, implemented in glue.cpp
+        sane_handle_encoder_write: false, // sync, implemented in glue.cpp
+        sane_handle_encoder_end: false, // sync, implemented in glue.cpp
+        sane_handle_fast_get_parameters: true, // same as sane_fast_get_parameters
+        sane_handle_fast_read: true, // same as sane_fast_read
+        sane_handle_fast_read_blocking: true, // same as sane_fast_read_blocking
+        sane_handle_fast_read_stream_next: true, // same as sane_fast_read_stream_next
+        sane_handle_fast_control_option_get_value: true, // same as sane_fast_control_option_get_value
+        sane_handle_fast_control_option_set_value: true, // same as sane_fast_control_option_set_value
+        sane_handle_fast_image_convert: false, // same as sane_fast_image_convert
+        sane_handle_fast_encoder_write: false, // same as sane_fast_encoder_write
+    }
+
+    // Resource used by each function, for the scheduler (see below). Calls
+    // on the same resource run one at a time and in order, calls on
+    // different resources run at the same time (the blocking SANE calls run
+    // on helper threads, see glue.cpp). 'global' calls run alone. null means
+    // no resource (sane-wasm state or cheap calls), those never wait.
+    // Handle functions (sane_handle_*) use the same resources but one set
+    // for each handle (e.g. 'device:1'), so devices don't wait for each other.
+    const libFunctionsResource = {
+        sane_get_state: null,
+        sane_init: 'global',
+        sane_exit: 'global',
+        sane_get_devices: 'discovery',
+        sane_discovery_probe: 'discovery',
+        sane_open: 'device',
+        sane_close: 'device',
+        sane_get_option_descriptor: null, // from the options cache (glue.cpp)
+        sane_control_option_get_value: 'device',
+        sane_control_option_set_value: 'device',
+        sane_control_option_set_auto: 'device',
+        sane_get_all_options: 'device',
+        sane_set_option: 'device',
+        sane_control_options_apply: 'device',
+        sane_get_parameters: 'parameters', // cached while scanning (glue.cpp), not behind reads
+        sane_start: 'device',
+        sane_read: 'device',
+        sane_read_blocking: 'device',
+        sane_read_stream_start: null,
+        sane_read_stream_start_batch: null,
+        sane_read_stream_next: 'stream',
+        sane_read_stream_release: null,
+        sane_read_stream_stop: 'device', // not 'stream', it ends a waiting sane_read_stream_next
+        sane_read_stream_stats: null,
+        sane_cancel: 'device',
+        sane_strstatus: null,
+        sane_image_begin: null,
+        sane_image_convert: null,
+        sane_image_preview: null,
+        sane_image_preview_get: null,
+        sane_image_end: null,
+        sane_encoder_begin: null,
+        sane_encoder_write: null,
+        sane_encoder_end: null,
+        sane_fast_get_parameters: 'parameters',
+        sane_fast_read: 'device',
+        sane_fast_read_blocking: 'device',
+        sane_fast_read_stream_next: 'stream',
+        sane_fast_control_option_get_value: 'device',
+        sane_fast_control_option_set_value: 'device',
+        sane_fast_image_convert: null,
+        sane_fast_encoder_write: null,
+        sane_get_metrics: null,
+        sane_reset_metrics: null,
+        sane_get_memory_stats: null,
+        sane_handle_open: null,
+    }
+
+    // Calls that skip ahead of the queued calls on their resource, they also
+    // start while another call is running there (glue.cpp makes in progress
+    // reads return early).
+    const libFunctionsPriority = {
+        sane_cancel: true,
+        sane_handle_cancel: true,
+    }
+
+    const libFunctionResource = (name, args) => {
+        if (name in libFunctionsResource) {
+            return libFunctionsResource[name];
+        }
+        const resource = libFunctionsResource[name.replace(/^sane_handle_/, "sane_")];
+        return resource && `${resource}:${args[0]}`;
     }
 
+    // Persistent storage for the discovery cache (see below), IndexedDB on
+    // browsers and a JSON file on Node.js. The cache is only an optimization,
+    // storage errors are ignored.
+    const DISCOVERY_CACHE_MAX = 8; // number of USB device sets kept
+
+    const idbRequest = (req) => new Promise((resolve, reject) => {
+        req.onsuccess = () => resolve(req.result);
+        req.onerror = () => reject(req.error);
+    });
+
+    const idbStore = async (mode) => {
+        const req = indexedDB.open("sane-wasm", 1);
+        req.onupgradeneeded = () => req.result.createObjectStore("cache");
+        const db = await idbRequest(req);
+        return db.transaction("cache", mode).objectStore("cache");
+    };
+
+    const discoveryCacheFile = () => {
+        const path = require('path');
+        return Module.sane.discoveryCacheFile || path.join(require('os').homedir(), '.cache', 'sane-wasm', 'devices.json');
+    };
+
+    const discoveryStorage = {
+        async load() {
+            try {
+                if (ENVIRONMENT_IS_NODE) {
+                    return JSON.parse(require('fs').readFileSync(discoveryCacheFile(), 'utf8'));
+                }
+                return await idbRequest((await idbStore("readonly")).get("devices")) || {};
+            } catch (e) {
+                return {};
+            }
+        },
+        async save(data) {
+            try {
+                if (ENVIRONMENT_IS_NODE) {
+                    const fs = require('fs');
+                    const file = discoveryCacheFile();
+                    fs.mkdirSync(require('path').dirname(file), { recursive: true });
+                    fs.writeFileSync(file, JSON.stringify(data));
+                } else {
+                    await idbRequest((await idbStore("readwrite")).put(data, "devices"));
+                }
+            } catch (e) {
+                // ignore
+            }
+        },
+    };
+
+    // Startup (sane-wasm, not part of SANE API). The wasm module is compiled
+    // here (Module.instantiateWasm) instead of by emscripten, so that it's
+    // compiled while downloading (WebAssembly.compileStreaming) and reused
+    // from Module.sane.wasmCache if set. Browsers don't store a
+    // WebAssembly.Module (IndexedDB fails with DataCloneError), they keep
+    // their own code cache for compileStreaming, so there is no cache by
+    // default. lib/index.js passes an in-process cache on Node.js (the
+    // compiled module can't be persisted there). The time spent on each
+    // step is kept for sane_startup_timing.
+    const startup = {
+        start: performance.now(),
+        fetch: 0,
+        compile: 0,
+        instantiate: 0,
+        init: 0,
+        instantiated: 0, // timestamp
+        cached: false,
+    };
+
+    const wasmCompile = async (url) => {
+        // blob URLs (loader prefetch) change on every load, don't cache
+        const cache = Module.sane.wasmCache;
+        const key = cache && !url.startsWith("blob:") ? `wasm:${url}` : null;
+        if (key) {
+            const module = await cache.get(key);
+            if (module instanceof WebAssembly.Module) {
+                startup.cached = true;
+                return module;
+            }
+        }
+        let t = performance.now();
+        let module;
+        if (ENVIRONMENT_IS_NODE) {
+            const bytes = require('fs').readFileSync(url);
+            startup.fetch += performance.now() - t;
+            t = performance.now();
+            module = await WebAssembly.compile(bytes);
+        } else {
+            // with compileStreaming, fetch is only the time to the response
+            // headers, the download overlaps with the compilation
+            const res = await fetch(url, { credentials: "same-origin" });
+            if (!res.ok) {
+                throw new Error(`failed to fetch '${url}' (${res.status})`);
+            }
+            startup.fetch += performance.now() - t;
+            t = performance.now();
+            if (WebAssembly.compileStreaming) {
+                try {
+                    module = await WebAssembly.compileStreaming(res);
+                } catch (e) {
+                    // not served as application/wasm, fetch again
+                    module = await WebAssembly.compile(await (await fetch(url, { credentials: "same-origin" })).arrayBuffer());
+                }
+            } else {
+                module = await WebAssembly.compile(await res.arrayBuffer());
+            }
+        }
+        startup.compile += performance.now() - t;
+        if (key) {
+            cache.set(key, module);
+        }
+        return module;
+    };
+
+    // Vendor/product IDs ("vvvv:pppp") of the attached USB devices (the ones
+    // that libusb sees), sorted. Only the devices that navigator.usb returns,
+    // on Node.js node-usb's webusb returns none unless they were requested
+    // (the key is then always "none").
+    const usbDeviceIds = async () => {
+        const usb = globalThis.navigator && globalThis.navigator.usb;
+        const devices = usb ? await usb.getDevices() : [];
+        const hex = (n) => n.toString(16).padStart(4, "0");
+        return devices.map(d => `${hex(d.vendorId)}:${hex(d.productId)}`).sort();
+    };
+
+    // The USB IDs plus the backend options, used as the discovery cache key.
+    const usbDevicesKey = (ids) => {
+        const key = ids.join(",") || "none";
+        const { backends, deviceHints } = Module.sane;
+        return backends || deviceHints ? `${key}|${backends || ""}|${deviceHints || ""}` : key;
+    };
+
     Module.sane = {
         debugSANE: false,
         debugUSB: false,
         debugFunctionCalls: false,
         debugTestDevices: 0,
+        readBufferSlots: 4,
+        readBufferSize: 2 * 1024 * 1024,
+        readIdleMax: 250,
+        memoryLimit: null,
+        threadPoolSize: 2,
         promisify: true,
         promisifyQueue: true,
+        discoveryCache: false,
+        discoveryCacheFile: null,
+        backends: null,
+        deviceHints: null,
+        metrics: false,
+        usb: null,
+        wasmCache: null,
         ...(Module.sane || {})
     };
 
+    // the loader passes its own timings (script and wasm prefetch)
+    if (Module.sane.loaderTiming) {
+        startup.start = Module.sane.loaderTiming.start;
+        startup.fetch += Module.sane.loaderTiming.fetch;
+    }
+
+    // Memory cap, the module memory is created here (instead of by the
+    // runtime) with a maximum size. Growing past it fails like running out
+    // of memory (the module aborts), size it with sane_get_memory_stats()
+    // high-water marks. It must be shared
+    // (pthreads) and at least the initial size the module was built with
+    // (SANE_WASM_INITIAL_MEMORY, from build.sh).
+    if (Module.sane.memoryLimit && !Module.wasmMemory && !ENVIRONMENT_IS_PTHREAD) {
+        const WASM_PAGE = 64 * 1024;
+        const initial = SANE_WASM_INITIAL_MEMORY / WASM_PAGE;
+        Module.wasmMemory = new WebAssembly.Memory({
+            initial,
+            maximum: Math.max(initial, Math.ceil(Module.sane.memoryLimit / WASM_PAGE)),
+            shared: true,
+        });
+    }
+
+    // pthreads get the compiled module from the main thread (emscripten sets
+    // their instantiateWasm)
+    if (!Module.instantiateWasm && !ENVIRONMENT_IS_PTHREAD) {
+        Module.instantiateWasm = (imports, receiveInstance) => {
+            wasmCompile(locateFile("libsane.wasm")).then(async module => {
+                const t = performance.now();
+                const instance = await WebAssembly.instantiate(module, imports);
+                startup.instantiated = performance.now();
+                startup.instantiate += startup.instantiated - t;
+                receiveInstance(instance, module);
+            }).catch(e => {
+                abort(`failed to load libsane.wasm: ${e}`);
+            });
+            return {}; // async
+        };
+    }
+
     Module.preRun = Module.preRun || [];
     Module.postRun = Module.postRun || [];
 
@@ -125,8 +527,24 @@
     // The library just starts working when we call sane_init externally.
 
     Module.postRun.push(() => {
+        // runtime init (config bundle, main, thread pool), after instantiate
+        const ready = performance.now();
+        if (startup.instantiated) {
+            startup.init = ready - startup.instantiated;
+        }
+
+        // startup timings (sane-wasm, not part of SANE API)
+        Module.sane_startup_timing = () => ({
+            fetch_ms: startup.fetch,
+            compile_ms: startup.compile,
+            instantiate_ms: startup.instantiate,
+            init_ms: startup.init,
+            total_ms: ready - startup.start,
+            cached: startup.cached,
+        });
+
         // promote enums to more useful objects
-        ["SANE_STATUS", "SANE_TYPE", "SANE_UNIT", "SANE_CONSTRAINT", "SANE_FRAME"].forEach(s => {
+        ["SANE_STATUS", "SANE_TYPE", "SANE_UNIT", "SANE_CONSTRAINT", "SANE_FRAME", "SANE_IMAGE_LAYOUT", "SANE_IMAGE_FORMAT"].forEach(s => {
             EnumSANE.promote(Module[s]);
         });
 
@@ -148,6 +566,28 @@
             Module.FS.writeFile("/etc/sane.d/test.conf", buf);
         }
 
+        // decode the fast API results, the sync functions (image/encoder)
+        // take the data address, data that is not in the module memory is
+        // copied to a staging buffer first
+        const fastInput = Module.sane_fast_input;
+        Object.keys(libFunctionsAsync).filter(name => /^sane_(handle_)?fast_/.test(name)).forEach(name => {
+            const fn = Module[name];
+            const wrapped = libFunctionsAsync[name] ? (...args) => {
+                const res = fn(...args);
+                return res instanceof Promise ? res.then(ptr => new FastResult(ptr)) : new FastResult(res);
+            } : (...args) => {
+                const data = args.pop();
+                let ptr = data.byteOffset;
+                if (data.buffer !== HEAPU8.buffer) {
+                    ptr = fastInput(data.length);
+                    HEAPU8.set(data, ptr);
+                }
+                return new FastResult(fn(...args, ptr, data.length));
+            };
+            Object.defineProperty(wrapped, 'name', { value: fn.name }); // for debugFunctionCalls
+            Module[name] = wrapped;
+        });
+
         // enable debug for sane function calls
         if (Module.sane.debugFunctionCalls) {
             const wrap = (fn) => (...args) => {
@@ -174,39 +614,197 @@
             });
         }
 
-        // wrap sane functions using promise queue to prevent further calls
-        // while other async functions are still running (not supported)
-        if (Module.sane.promisify && Module.sane.promisifyQueue) {
-            const queue = [];
-            let busy = false;
-            const dequeue = () => {
-                if (queue.length) {
-                    queue.shift()();
-                } else {
-                    busy = false;
+        // wrap sane functions using the scheduler, it queues calls while
+        // other calls on the same resource (see libFunctionsResource) are
+        // still running, sync functions throw in that case
+        const scheduler = {
+            running: {}, // resource => number of running calls
+            queue: [],
+            global: false, // a global call is running
+            stats: { calls: 0, running: 0, max_queued: 0, waits: 0, wait_ms: 0 },
+        };
+        const canStart = (call, index) => {
+            const { running, queue, stats } = scheduler;
+            if (scheduler.global) {
+                return false;
+            }
+            if (call.resource === 'global') {
+                return stats.running === 0 && index === 0;
+            }
+            for (let i = 0; i < index; i++) {
+                // in order, global calls or on the same resource
+                const r = queue[i].resource;
+                if (r === 'global' || (call.resource !== null && r === call.resource)) {
+                    return false;
                 }
             }
-            const enqueue = (fn) => {
-                return new Promise((resolve, reject) => {
-                    queue.push(() => fn().then(resolve, reject).finally(dequeue));
-                });
+            return call.resource === null || call.priority || !running[call.resource];
+        };
+        const run = (call) => {
+            const { running, stats } = scheduler;
+            stats.running++;
+            if (call.resource === 'global') {
+                scheduler.global = true;
             }
-            const wrap = (fn) => (...args) => {
-                if (busy) {
-                    return enqueue(() => fn(...args));
+            if (call.resource !== null) {
+                running[call.resource] = (running[call.resource] || 0) + 1;
+            }
+            let promise;
+            try {
+                promise = call.fn();
+            } catch (e) {
+                promise = Promise.reject(e);
+            }
+            return promise.finally(() => {
+                stats.running--;
+                if (call.resource === 'global') {
+                    scheduler.global = false;
+                }
+                if (call.resource !== null && !--running[call.resource]) {
+                    delete running[call.resource];
                 }
-                busy = true;
-                return fn(...args).finally(dequeue);
+                dispatch();
+            });
+        };
+        const dispatch = () => {
+            const { queue, stats } = scheduler;
+            for (let i = 0; i < queue.length; i++) {
+                if (canStart(queue[i], i)) {
+                    const [call] = queue.splice(i--, 1);
+                    stats.waits++;
+                    stats.wait_ms += performance.now() - call.time;
+                    run(call).then(call.resolve, call.reject);
+                }
+            }
+        };
+        if (Module.sane.promisify && Module.sane.promisifyQueue) {
+            const wrap = (name, fn) => (...args) => {
+                const { queue, stats } = scheduler;
+                const call = {
+                    resource: libFunctionResource(name, args),
+                    priority: !!libFunctionsPriority[name],
+                    fn: () => fn(...args),
+                };
+                stats.calls++;
+                let index = queue.length;
+                if (call.priority) {
+                    const i = queue.findIndex(c => c.resource === call.resource);
+                    index = i === -1 ? index : i;
+                }
+                if (canStart(call, index)) {
+                    return run(call);
+                }
+                return new Promise((resolve, reject) => {
+                    call.time = performance.now();
+                    call.resolve = resolve;
+                    call.reject = reject;
+                    queue.splice(index, 0, call);
+                    stats.max_queued = Math.max(stats.max_queued, queue.length);
+                });
             };
-            const wrapSync = (fn) => (...args) => {
-                if (busy) {
+            const wrapSync = (name, fn) => (...args) => {
+                const resource = libFunctionResource(name, args);
+                if (resource !== null && (
+                    scheduler.global || scheduler.running[resource] ||
+                    (resource === 'global' && scheduler.stats.running)
+                )) {
                     throw new Error("There is an async operation in progress");
                 }
                 return fn(...args);
             };
             Object.keys(libFunctionsAsync).forEach(name => {
-                Module[name] = (libFunctionsAsync[name] ? wrap : wrapSync)(Module[name]);
+                Module[name] = (libFunctionsAsync[name] ? wrap : wrapSync)(name, Module[name]);
+            });
+        }
+
+        // scheduler statistics (sane-wasm, not part of SANE API)
+        Module.sane_scheduler_stats = () => {
+            if (!Module.sane.promisify || !Module.sane.promisifyQueue) {
+                return null;
+            }
+            const { running, queue, stats } = scheduler;
+            const resources = {};
+            Object.keys(running).forEach(r => {
+                resources[r] = { running: running[r], queued: 0 };
+            });
+            queue.forEach(c => {
+                const r = c.resource === null ? "none" : c.resource;
+                resources[r] = resources[r] || { running: 0, queued: 0 };
+                resources[r].queued++;
+            });
+            return { ...stats, queued: queue.length, resources };
+        };
+
+        // The discovery cache (sane-wasm, not part of SANE API), sane_get_devices
+        // initializes and probes every backend, that can take seconds. With
+        // the cache enabled, the devices found are kept (and persisted, see
+        // discoveryStorage) for each set of attached USB devices. If the same
+        // devices are attached, sane_get_devices only probes the backends
+        // that found devices last time and the ones that support the
+        // attached USB devices (sane_discovery_probe), the devices returned
+        // are always verified. Then a full discovery runs in the background
+        // (on the discovery thread) and replaces the cache entry, that finds
+        // the devices of other backends (e.g. a new network scanner) and
+        // drops the ones that are gone. The probe result never replaces the
+        // entry (it only has a subset of the backends). Opening a device
+        // waits for the background discovery, backends are not thread-safe.
+        // The key is the whole set of USB IDs (see usbDeviceIds).
+        // XXX: The dll backend can't probe a subset of the backends, with the
+        //      cache enabled and no backend selection sane_init selects all
+        //      the backends and calls them directly. The device names and
+        //      order are the same as through the dll backend (dll.conf is
+        //      empty, every backend is preloaded), dll.aliases is not used.
+        const discovery = {
+            entries: null, // loaded on first use
+            refresh: null, // background discovery (promise)
+        };
+        const discoveryUpdate = (key, res) => {
+            if (res.status !== Module.SANE_STATUS.GOOD) {
+                return;
+            }
+            discovery.entries[key] = { devices: res.devices, time: Date.now() };
+            const keys = Object.keys(discovery.entries).sort((a, b) => discovery.entries[b].time - discovery.entries[a].time);
+            keys.slice(DISCOVERY_CACHE_MAX).forEach(k => delete discovery.entries[k]);
+            discoveryStorage.save(discovery.entries);
+        };
+        if (Module.sane.discoveryCache) {
+            const getDevices = Module.sane_get_devices;
+            Module.sane_get_devices = async () => {
+                if (!discovery.entries) {
+                    discovery.entries = await discoveryStorage.load();
+                }
+                const ids = await usbDeviceIds();
+                const key = usbDevicesKey(ids);
+                const entry = discovery.entries[key];
+                if (!entry) {
+                    const res = await getDevices();
+                    discoveryUpdate(key, res);
+                    return res;
+                }
+                // names are "backend:device" (backends called directly)
+                const backends = entry.devices.map(d => d.name.split(":")[0]);
+                const res = await Module.sane_discovery_probe(backends, ids);
+                if (!discovery.refresh) {
+                    discovery.refresh = Promise.resolve(getDevices()).then(res => {
+                        discoveryUpdate(key, res);
+                        return res;
+                    }, () => null).finally(() => {
+                        discovery.refresh = null;
+                    });
+                }
+                return res.status === Module.SANE_STATUS.GOOD ? { ...res, cached: true } : res;
+            };
+            ["sane_open", "sane_handle_open"].forEach(name => {
+                const fn = Module[name];
+                Module[name] = (...args) => discovery.refresh ? discovery.refresh.then(() => fn(...args)) : fn(...args);
             });
         }
+
+        Module.sane_discovery_cache_wait = () => discovery.refresh || Promise.resolve(null);
+
+        Module.sane_discovery_cache_clear = async () => {
+            discovery.entries = {};
+            await discoveryStorage.save(discovery.entries);
+        };
     });
 }
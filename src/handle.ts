@@ -0,0 +1,65 @@
+import { LibSANE } from ".";
+
+const handleFunctions = [
+    'close',
+    'get_option_descriptor',
+    'control_option_get_value',
+    'control_option_set_value',
+    'control_option_set_auto',
+    'get_all_options',
+    'set_option',
+    'control_options_apply',
+    'get_parameters',
+    'start',
+    'read',
+    'read_blocking',
+    'cancel',
+    'read_stream_start',
+    'read_stream_start_batch',
+    'read_stream_next',
+    'read_stream_release',
+    'read_stream_stop',
+    'read_stream_stats',
+    'image_begin',
+    'image_convert',
+    'image_preview',
+    'image_preview_get',
+    'image_end',
+    'encoder_begin',
+    'encoder_write',
+    'encoder_end',
+    'fast_get_parameters',
+    'fast_read',
+    'fast_read_blocking',
+    'fast_read_stream_next',
+    'fast_control_option_get_value',
+    'fast_control_option_set_value',
+    'fast_image_convert',
+    'fast_encoder_write',
+] as const;
+
+/**
+ * Bind a handle from {@link LibSANE.sane_handle_open} to a library object.
+ * The single handle functions of the returned object (e.g. `sane_start`)
+ * call the equivalent handle functions (e.g. `sane_handle_start`) with the
+ * given handle, everything else is the same library.
+ *
+ * Use it to run {@link ScanOptions} and the scan readers on a handle, and
+ * to scan from multiple devices at the same time.
+ *
+ * This is provided by sane-wasm, it's not part of SANE API.
+ *
+ * @example
+ * ```
+ * const { handle } = await lib.sane_handle_open('test:0');
+ * const reader = new ScanImageReader(bindHandle(lib, handle));
+ * ```
+ */
+export function bindHandle(lib: LibSANE, handle: number): LibSANE {
+    const bound = Object.create(lib);
+    for (const name of handleFunctions) {
+        const fn = lib[`sane_handle_${name}`] as (handle: number, ...args: any[]) => any;
+        bound[`sane_${name}`] = (...args: any[]) => fn(handle, ...args);
+    }
+    return bound;
+}
@@ -1,3 +1,5 @@
+import type { USBLike } from './usb-trace';
+
 /**
  * Equivalent to the SANE API C enum `SANE_Status`.
  * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#status-type}
@@ -67,6 +69,61 @@ export enum SANEFrame {
     BLUE,
 }
 
+/**
+ * Image layout for {@link LibSANE.sane_image_begin}. This is provided by
+ * sane-wasm, it's not part of SANE API.
+ *
+ * All layouts use 8-bit channels.
+ */
+export enum SANEImageLayout {
+    RGBA = 0,
+    BGRA,
+    RGB,
+    GRAY,
+}
+
+/**
+ * Preview level from {@link LibSANE.sane_image_preview_get}. This is
+ * provided by sane-wasm, it's not part of SANE API.
+ */
+export type SANEImagePreviewLevel = {
+    width: number;
+    height: number;
+    /**
+     * Completed lines.
+     */
+    lines: number;
+    data: Uint8Array;
+};
+
+/**
+ * Compressed image format for {@link LibSANE.sane_encoder_begin}. This is
+ * provided by sane-wasm, it's not part of SANE API.
+ */
+export enum SANEImageFormat {
+    JPEG = 0,
+    PNG,
+}
+
+/**
+ * Encoder options for {@link LibSANE.sane_encoder_begin}. This is provided
+ * by sane-wasm, it's not part of SANE API.
+ */
+export type SANEEncoderOptions = {
+    /**
+     * JPEG quality (1-100).
+     *
+     * @defaultvalue `90`
+     */
+    quality?: number;
+    /**
+     * PNG (zlib) compression level (0-9).
+     *
+     * @defaultvalue `6`
+     */
+    level?: number;
+};
+
 /**
  * Library state. This is provided by sane-wasm, it's not part of SANE API.
  */
@@ -93,6 +150,246 @@ export type SANEState = {
      * Is a device open with {@link LibSANE.sane_open}?
      */
     open: boolean;
+    /**
+     * Number of devices open with {@link LibSANE.sane_handle_open}.
+     */
+    handles: number;
+    /**
+     * Backends selected on {@link LibSANE.sane_init} (see
+     * {@link LibSANEOptions.backends}), `null` when all backends are used
+     * through SANE's dll backend. With {@link LibSANEOptions.discoveryCache}
+     * and no selection, it lists all the backends (called directly).
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    backends: string[] | null;
+}
+
+/**
+ * Function type of the handle API, same as the single handle function `F`
+ * with the extra `handle` argument. This is provided by sane-wasm, it's not
+ * part of SANE API.
+ */
+export type SANEHandleFunction<F> = F extends (...args: infer A) => infer R ? (handle: number, ...args: A) => R : never;
+
+/**
+ * Startup timings, see {@link LibSANE.sane_startup_timing}. This is provided
+ * by sane-wasm, it's not part of SANE API.
+ */
+export type SANEStartupTiming = {
+    /**
+     * Time fetching the wasm file, including the loader's prefetch. With
+     * streaming compilation only the time to the response headers, the
+     * download overlaps with the compilation.
+     */
+    fetch_ms: number;
+    /**
+     * Time compiling the wasm module, `0` when reused from the cache.
+     */
+    compile_ms: number;
+    /**
+     * Time instantiating the wasm module.
+     */
+    instantiate_ms: number;
+    /**
+     * Time initializing the runtime after instantiation (config files, thread
+     * pool), until the library is ready.
+     */
+    init_ms: number;
+    /**
+     * Total time until the library is ready, from the loader start (or from
+     * libsane.js start).
+     */
+    total_ms: number;
+    /**
+     * Was the compiled module reused from the cache
+     * (see {@link LibSANEOptions.wasmCache})?
+     */
+    cached: boolean;
+}
+
+/**
+ * Scheduler statistics, see {@link LibSANE.sane_scheduler_stats}. This is
+ * provided by sane-wasm, it's not part of SANE API.
+ */
+export type SANESchedulerStats = {
+    /**
+     * Total number of scheduled (async) calls.
+     */
+    calls: number;
+    /**
+     * Number of calls in progress.
+     */
+    running: number;
+    /**
+     * Number of calls waiting for their resource.
+     */
+    queued: number;
+    /**
+     * Maximum number of calls waiting at the same time.
+     */
+    max_queued: number;
+    /**
+     * Number of calls that had to wait.
+     */
+    waits: number;
+    /**
+     * Total time calls waited for their resource.
+     */
+    wait_ms: number;
+    /**
+     * Running and queued calls by resource (e.g. `'device'`, `'stream:1'`).
+     */
+    resources: Record<string, { running: number; queued: number; }>;
+}
+
+/**
+ * Read stream statistics, see {@link LibSANE.sane_read_stream_stats}. This is
+ * provided by sane-wasm, it's not part of SANE API.
+ */
+export type SANEReadStreamStats = {
+    /**
+     * Is the stream active (started and not stopped)?
+     */
+    active: boolean;
+    /**
+     * Number of read buffers (slots).
+     */
+    slots: number;
+    /**
+     * Number of filled slots waiting for {@link LibSANE.sane_read_stream_next}.
+     */
+    filled: number;
+    /**
+     * Number of reads with data.
+     */
+    reads: number;
+    /**
+     * Total bytes read.
+     */
+    bytes: number;
+    /**
+     * Number of times the helper thread waited for a free slot (JS was not
+     * releasing slots fast enough).
+     */
+    stalls: number;
+    /**
+     * Total time the helper thread waited for free slots.
+     */
+    stall_ms: number;
+    /**
+     * Number of times {@link LibSANE.sane_read_stream_next} waited for data.
+     */
+    waits: number;
+    /**
+     * Total time {@link LibSANE.sane_read_stream_next} waited for data.
+     */
+    wait_ms: number;
+}
+
+/**
+ * Memory usage, see {@link LibSANE.sane_get_memory_stats}. This is provided
+ * by sane-wasm, it's not part of SANE API.
+ */
+export type SANEMemoryStats = {
+    /**
+     * Size of the module memory (WASM heap). It never shrinks, this is
+     * also its high-water mark.
+     */
+    heap_size: number;
+    /**
+     * Bytes currently allocated (malloc).
+     */
+    malloc_used: number;
+    /**
+     * Memory currently managed by malloc (allocated and free).
+     */
+    malloc_footprint: number;
+    /**
+     * Most memory managed by malloc at any time (high-water mark).
+     */
+    malloc_footprint_peak: number;
+    /**
+     * Size of the read buffers (see {@link LibSANEOptions.readBufferSize}).
+     */
+    read_buffer_size: number;
+}
+
+/**
+ * Log2 histogram of a metric, see {@link SANEMetrics}. Index 0 counts the
+ * values below 1 (us or bytes), index `i` counts the values in
+ * `[2^(i-1), 2^i)`, the last index also counts everything above.
+ */
+export type SANEMetricsHistogram = number[];
+
+/**
+ * Metrics collected when enabled (see {@link LibSANEOptions.metrics}), see
+ * {@link LibSANE.sane_get_metrics}. This is provided by sane-wasm, it's not
+ * part of SANE API.
+ */
+export type SANEMetrics = {
+    /**
+     * Latency of the SANE function calls, measured around the backend
+     * itself (excludes the sane-wasm and JS overhead). Only the called
+     * functions are included (e.g. `sane_read`).
+     */
+    functions: Record<string, { calls: number; total_ms: number; max_ms: number; histogram_us: SANEMetricsHistogram; }>;
+    /**
+     * Time the blocking SANE calls spend being proxied to their helper
+     * thread (`queue`) and back to the main thread (`resume`).
+     */
+    proxy: Record<'queue' | 'resume', { calls: number; total_ms: number; max_ms: number; histogram_us: SANEMetricsHistogram; }>;
+    /**
+     * Sizes of the `sane_read` calls with `SANEStatus.GOOD`, `empty` is the
+     * number of calls that returned no data.
+     */
+    reads: { calls: number; bytes: number; max_bytes: number; histogram_bytes: SANEMetricsHistogram; empty: number; };
+    /**
+     * USB transfers by type and direction (e.g. `bulk_in`,
+     * `control_out`). Only the used types are included.
+     */
+    usb: Record<string, { transfers: number; bytes: number; max_bytes: number; histogram_bytes: SANEMetricsHistogram; errors: number; }>;
+}
+
+/**
+ * Result of the fast API functions (e.g. {@link LibSANE.sane_fast_read}).
+ * The result is packed in the module memory, the properties are decoded
+ * when used, read only the ones needed. Properties that don't apply to the
+ * function are `null` (or `0`). This is provided by sane-wasm, it's not
+ * part of SANE API.
+ *
+ * `data` (and `value` with strings) point to the module memory, use them
+ * before the next call on the same device, copy them if needed.
+ */
+export interface SANEFastResult {
+    readonly status: SANEStatus;
+    /**
+     * Option set info, `null` if `status` is not GOOD.
+     */
+    readonly info: SANEInfo | null;
+    /**
+     * Read data, option value bytes or converted/encoded data.
+     */
+    readonly data: Uint8Array | null;
+    /**
+     * Read stream slot of `data`, see {@link LibSANE.sane_read_stream_next}.
+     */
+    readonly slot: number | null;
+    /**
+     * First image line of `data`, see {@link LibSANE.sane_image_convert}.
+     */
+    readonly line: number;
+    /**
+     * Number of full lines in `data`, see {@link LibSANE.sane_image_convert}.
+     */
+    readonly lines: number;
+    /**
+     * Scan parameters (get parameters or a new page on batch read streams).
+     */
+    readonly parameters: SANEParameters | null;
+    /**
+     * Option value.
+     */
+    readonly value: any;
 }
 
 /**
@@ -209,6 +506,12 @@ export interface LibSANE {
      */
     SANE_WASM_BACKENDS: string;
 
+    /**
+     * Initial size of the module memory (WASM heap), in bytes. The
+     * {@link LibSANEOptions.memoryLimit} is never below it.
+     */
+    SANE_WASM_INITIAL_MEMORY: number;
+
     /**
      * SANE API version code (major).
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#version-control}
@@ -276,6 +579,20 @@ export interface LibSANE {
      */
     SANE_FRAME: SANEEnum<typeof SANEFrame, SANEFrame>;
 
+    /**
+     * @deprecated Consider using the SANEImageLayout enum directly.
+     *
+     * Provided for consistency with the other enum objects.
+     */
+    SANE_IMAGE_LAYOUT: SANEEnum<typeof SANEImageLayout, SANEImageLayout>;
+
+    /**
+     * @deprecated Consider using the SANEImageFormat enum directly.
+     *
+     * Provided for consistency with the other enum objects.
+     */
+    SANE_IMAGE_FORMAT: SANEEnum<typeof SANEImageFormat, SANEImageFormat>;
+
     /**
      * Get the current state of the library.
      *
@@ -299,7 +616,37 @@ export interface LibSANE {
      * Equivalent to the SANE API C function `sane_get_devices`.
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-get-devices}
      */
-    sane_get_devices: () => Promise<{ status: SANEStatus.GOOD; devices: SANEDevice[] } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; devices: null }>;
+    sane_get_devices: () => Promise<{ status: SANEStatus.GOOD; devices: SANEDevice[]; cached?: true } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; devices: null }>;
+
+    /**
+     * Same as {@link LibSANE.sane_get_devices}, but only probes the given
+     * backends plus the ones that support the given USB IDs
+     * (`"vvvv:pppp"`), out of the selected backends (see
+     * {@link LibSANEOptions.backends}). Returns `status = SANEStatus.INVAL`
+     * without a backend selection. Used by the discovery cache, see
+     * {@link LibSANEOptions.discoveryCache}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_discovery_probe: (backends: string[], usbIds: string[]) => Promise<{ status: SANEStatus.GOOD; devices: SANEDevice[]; } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; devices: null }>;
+
+    /**
+     * Wait for the background discovery started by
+     * {@link LibSANE.sane_get_devices} when it uses the cache (see
+     * {@link LibSANEOptions.discoveryCache}). Resolves with the fresh result,
+     * or `null` if there is no background discovery running.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_discovery_cache_wait: () => Promise<Awaited<ReturnType<LibSANE['sane_get_devices']>> | null>;
+
+    /**
+     * Clear the discovery cache (also the persisted one), see
+     * {@link LibSANEOptions.discoveryCache}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_discovery_cache_clear: () => Promise<void>;
 
     /**
      * Equivalent to the SANE API C function `sane_open`.
@@ -319,6 +666,11 @@ export interface LibSANE {
      * The result `option_descriptor` can be null even with
      * `status = SANEStatus.GOOD`, it signals invalid option index.
      *
+     * The descriptors are read on the device's thread when the device is
+     * opened and after a set call returns `RELOAD_OPTIONS`, this returns
+     * the cached descriptor (shared, don't modify it). `status =
+     * SANEStatus.INVAL` if the descriptors could not be read.
+     *
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-get-option-descriptor}
      */
     sane_get_option_descriptor: (option: number) => { status: SANEStatus; option_descriptor: SANEOptionDescriptor | null };
@@ -350,8 +702,53 @@ export interface LibSANE {
      */
     sane_control_option_set_auto: (option: number) => Promise<{ status: SANEStatus.GOOD; info: SANEInfo } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; info: null }>;
 
+    /**
+     * Get all option descriptors and values in a single call, same result
+     * as calling {@link LibSANE.sane_get_option_descriptor} and
+     * {@link LibSANE.sane_control_option_get_value} for each option. The
+     * value is `null` for options that are inactive, buttons or not readable.
+     *
+     * The descriptors are cached until a set call returns `RELOAD_OPTIONS`,
+     * the descriptor objects are shared between calls, don't modify them.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_get_all_options: () => Promise<{ status: SANEStatus.GOOD; options: { index: number; descriptor: SANEOptionDescriptor; value: any; }[] } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; options: null }>;
+
+    /**
+     * Set option value (use `null` for automatic) and get the options that
+     * changed, compared with the last {@link LibSANE.sane_get_all_options}
+     * or `sane_set_option` call. `changes` always includes the option that
+     * was set (with the value read back from the backend), `count` is the
+     * new number of options (it may change with `RELOAD_OPTIONS`).
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_set_option: (option: number, value: any) => Promise<{ status: SANEStatus.GOOD; info: SANEInfo; count: number; changes: { index: number; descriptor: SANEOptionDescriptor; value: any; }[] } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; info: null }>;
+
+    /**
+     * Set many options in a single call (e.g. a saved scan profile), a map
+     * of option names to values (`null` for automatic).
+     *
+     * The options are set in dependency order (`source`, `mode`, `depth`,
+     * `resolution`, the other options in the given order and the scan area
+     * last), options that fail (e.g. still inactive) are retried after each
+     * `RELOAD_OPTIONS`. All options are read once at the end, `options` is
+     * the same as {@link LibSANE.sane_get_all_options}, `values` has the
+     * final value of each given option. `info` combines the info of all the
+     * options set. Options that were not set (unknown, inactive, invalid
+     * value or an error status from the backend) are on `rejected`, they
+     * don't fail the call.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_control_options_apply: (profile: Record<string, any>) => Promise<{ status: SANEStatus.GOOD; info: SANEInfo; options: { index: number; descriptor: SANEOptionDescriptor; value: any; }[]; values: Record<string, any>; inexact: string[]; rejected: { name: string; status: SANEStatus; }[] } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; options: null }>;
+
     /**
      * Equivalent to the SANE API C function `sane_get_parameters`.
+     * From {@link LibSANE.sane_start} (or a new page of a batch read stream)
+     * until the end of the frame, the parameters are cached and it doesn't
+     * wait for the reads in progress.
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-get-parameters}
      */
     sane_get_parameters: () => Promise<{ status: SANEStatus.GOOD; parameters: SANEParameters } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; parameters: null }>;
@@ -368,17 +765,513 @@ export interface LibSANE {
      */
     sane_read: () => Promise<{ status: SANEStatus.GOOD; data: Uint8Array } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null }>;
 
+    /**
+     * Same as {@link LibSANE.sane_read}, but waits on the helper thread until
+     * there is data, EOF or an error (instead of returning empty reads).
+     *
+     * The helper thread polls the backend (sleeping 1-16ms between empty
+     * reads), it may still return empty reads after some time without data
+     * (see {@link LibSANEOptions.readIdleMax}), to give the caller a chance
+     * to cancel the scan.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_blocking: () => Promise<{ status: SANEStatus.GOOD; data: Uint8Array } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null }>;
+
     /**
      * Equivalent to the SANE API C function `sane_cancel`.
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-cancel}
      */
     sane_cancel: () => Promise<{ status: SANEStatus; }>;
 
+    /**
+     * Start a read stream, after a successful {@link LibSANE.sane_start}.
+     *
+     * The helper thread keeps reading into a ring of buffers (see
+     * {@link LibSANEOptions.readBufferSlots}), use
+     * {@link LibSANE.sane_read_stream_next} to get the data. The stream is
+     * stopped with {@link LibSANE.sane_read_stream_stop},
+     * {@link LibSANE.sane_cancel} or {@link LibSANE.sane_close}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_start: () => { status: SANEStatus; };
+
+    /**
+     * Start a read stream in batch mode (document feeders), after a
+     * successful {@link LibSANE.sane_start}.
+     *
+     * Same as {@link LibSANE.sane_read_stream_start}, but the stream doesn't
+     * end at the end of a page, {@link LibSANE.sane_read_stream_next} returns
+     * EOF and the helper thread calls `sane_start` for the next page right
+     * away (the next sheet is fed while the previous one is processed). Then
+     * `sane_read_stream_next` returns GOOD with no `data` and the
+     * `parameters` of the new page. The stream ends with NO_DOCS (no more
+     * pages), an error or CANCELLED.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_start_batch: () => { status: SANEStatus; };
+
+    /**
+     * Get the next chunk of data from the read stream.
+     *
+     * The result `data` is a view over the read buffer `slot` (no copies),
+     * it must be released with {@link LibSANE.sane_read_stream_release}
+     * when no longer needed, don't use it after that. When there is no more
+     * data, the `status` is the final status of the stream (EOF, an error or
+     * CANCELLED). See {@link LibSANE.sane_read_stream_start_batch} for the
+     * page events in batch mode.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_next: () => Promise<{ status: SANEStatus.GOOD; data: Uint8Array; slot: number } | { status: SANEStatus.GOOD; data: null; parameters: SANEParameters } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null }>;
+
+    /**
+     * Release a read buffer (slot) returned by
+     * {@link LibSANE.sane_read_stream_next}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_release: (slot: number) => { status: SANEStatus; };
+
+    /**
+     * Stop the read stream and free the read buffers.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_stop: () => Promise<{ status: SANEStatus; }>;
+
+    /**
+     * Get read stream statistics (of the current or last stream).
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_read_stream_stats: () => SANEReadStreamStats;
+
     /**
      * Equivalent to the SANE API C function `sane_strstatus`.
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-strstatus}
      */
     sane_strstatus: (status: SANEStatus) => string;
+
+    /**
+     * Get the scheduler statistics, the scheduler queues calls that use the
+     * same resource (global, device or read stream), `null` if disabled
+     * (see {@link LibSANEOptions.promisifyQueue}). `sane_cancel` skips
+     * ahead of the queued calls.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_scheduler_stats: () => SANESchedulerStats | null;
+
+    /**
+     * Get the startup timings (fetch, compile, instantiate and init of the
+     * wasm module).
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_startup_timing: () => SANEStartupTiming;
+
+    /**
+     * Get the collected metrics (SANE function latency, thread proxying,
+     * read sizes and USB transfers), `null` if disabled
+     * (see {@link LibSANEOptions.metrics}).
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_get_metrics: () => SANEMetrics | null;
+
+    /**
+     * Reset the collected metrics.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_reset_metrics: () => void;
+
+    /**
+     * Get the module memory usage and high-water marks.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_get_memory_stats: () => SANEMemoryStats;
+
+    /**
+     * Prepare the native image converter for a new scan.
+     *
+     * Supports GRAY and RGB single-pass frames with 1, 8 or 16-bit depth,
+     * returns `SANEStatus.UNSUPPORTED` for other parameters.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_image_begin: (parameters: SANEParameters, layout: SANEImageLayout) => { status: SANEStatus; };
+
+    /**
+     * Convert raw scan data (as returned by {@link LibSANE.sane_read}) to
+     * the layout selected with {@link LibSANE.sane_image_begin}.
+     *
+     * Partial lines are kept until the next call. The result `data` contains
+     * `lines` full lines starting at image line `line`, it's a view over the
+     * module memory that is only valid until the next call, copy it.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_image_convert: (data: Uint8Array) => { status: SANEStatus.GOOD; data: Uint8Array; line: number; lines: number } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null };
+
+    /**
+     * Enable the preview pyramid of the native image converter, call after
+     * {@link LibSANE.sane_image_begin} (before converting any data).
+     *
+     * Downsampled versions of the image (same layout) are built as the data
+     * is converted. Level 0 is at most `width` pixels wide (each pixel is the
+     * average of an area of the image), each next level is half of the
+     * previous one, up to `levels` levels. Returns `SANEStatus.UNSUPPORTED`
+     * if the number of lines is unknown.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_image_preview: (width: number, levels: number) => { status: SANEStatus; };
+
+    /**
+     * Get the preview pyramid enabled with {@link LibSANE.sane_image_preview}.
+     *
+     * Each level has `lines` completed lines (of `height`). The `data` of
+     * each level is a view over the module memory with the full level image,
+     * it's only valid until the next call to the converter, copy it.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_image_preview_get: () => { status: SANEStatus.GOOD; levels: SANEImagePreviewLevel[] } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; levels: null };
+
+    /**
+     * Release the native image converter.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_image_end: () => { status: SANEStatus; };
+
+    /**
+     * Prepare the native image encoder for a new scan. Raw scan data is
+     * compressed while it's read, the uncompressed image is never kept.
+     *
+     * Supports the same parameters as {@link LibSANE.sane_image_begin}, the
+     * image is encoded as 8-bit GRAY or RGB. The result `data` is the start
+     * of the file (headers).
+     *
+     * All `data` results from the encoder functions are views over the module
+     * memory that are only valid until the next call, copy them.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_encoder_begin: (parameters: SANEParameters, format: SANEImageFormat, options: SANEEncoderOptions) => { status: SANEStatus.GOOD; data: Uint8Array; } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null };
+
+    /**
+     * Encode raw scan data (as returned by {@link LibSANE.sane_read}), the
+     * result `data` is the next part of the file, it may be empty.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_encoder_write: (data: Uint8Array) => { status: SANEStatus.GOOD; data: Uint8Array; } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null };
+
+    /**
+     * Finish the file and release the native image encoder, the result
+     * `data` is the last part of the file. Missing lines (e.g. cancelled
+     * scan) are filled with white.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_encoder_end: () => { status: SANEStatus.GOOD; data: Uint8Array; } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; data: null };
+
+    /**
+     * Fast version of {@link LibSANE.sane_get_parameters}, the result is
+     * packed in the module memory instead of new objects, see
+     * {@link SANEFastResult}. Use the fast functions on hot paths.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_get_parameters: () => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_read}, see {@link SANEFastResult}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_read: () => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_read_blocking}, see
+     * {@link SANEFastResult}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_read_blocking: () => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_read_stream_next}, see
+     * {@link SANEFastResult}. `data` and `slot` are set for data, only
+     * `parameters` is set for a new page (batch mode).
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_read_stream_next: () => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_control_option_get_value}, see
+     * {@link SANEFastResult}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_control_option_get_value: (option: number) => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_control_option_set_value}, use
+     * `null` as `value` for automatic, see {@link SANEFastResult}.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_control_option_set_value: (option: number, value: any) => Promise<SANEFastResult>;
+
+    /**
+     * Fast version of {@link LibSANE.sane_image_convert}, see
+     * {@link SANEFastResult}. Data in the module memory (e.g. from
+     * {@link LibSANE.sane_fast_read}) is used in place.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_image_convert: (data: Uint8Array) => SANEFastResult;
+
+    /**
+     * Fast version of {@link LibSANE.sane_encoder_write}, see
+     * {@link SANEFastResult}. Data in the module memory (e.g. from
+     * {@link LibSANE.sane_fast_read}) is used in place.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_fast_encoder_write: (data: Uint8Array) => SANEFastResult;
+
+    /**
+     * Open a device and return a new handle, the handle API
+     * (`sane_handle_*` functions) can hold several open devices at the same
+     * time. Each handle has its own read buffer and helper thread, reads from
+     * different handles run in parallel. Use {@link bindHandle} to use a
+     * handle with the scan readers and options.
+     *
+     * The single handle API ({@link LibSANE.sane_open} etc.) is still
+     * available and independent from the handle API.
+     *
+     * This is provided by sane-wasm, it's not part of SANE API.
+     */
+    sane_handle_open: (devicename: string) => Promise<{ status: SANEStatus.GOOD; handle: number; } | { status: Exclude<SANEStatus, SANEStatus.GOOD>; handle: null; }>;
+
+    /**
+     * Same as {@link LibSANE.sane_close}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_close: SANEHandleFunction<LibSANE['sane_close']>;
+
+    /**
+     * Same as {@link LibSANE.sane_get_option_descriptor}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_get_option_descriptor: SANEHandleFunction<LibSANE['sane_get_option_descriptor']>;
+
+    /**
+     * Same as {@link LibSANE.sane_control_option_get_value}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_control_option_get_value: SANEHandleFunction<LibSANE['sane_control_option_get_value']>;
+
+    /**
+     * Same as {@link LibSANE.sane_control_option_set_value}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_control_option_set_value: SANEHandleFunction<LibSANE['sane_control_option_set_value']>;
+
+    /**
+     * Same as {@link LibSANE.sane_control_option_set_auto}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_control_option_set_auto: SANEHandleFunction<LibSANE['sane_control_option_set_auto']>;
+
+    /**
+     * Same as {@link LibSANE.sane_get_all_options}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_get_all_options: SANEHandleFunction<LibSANE['sane_get_all_options']>;
+
+    /**
+     * Same as {@link LibSANE.sane_set_option}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_set_option: SANEHandleFunction<LibSANE['sane_set_option']>;
+
+    /**
+     * Same as {@link LibSANE.sane_control_options_apply}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_control_options_apply: SANEHandleFunction<LibSANE['sane_control_options_apply']>;
+
+    /**
+     * Same as {@link LibSANE.sane_get_parameters}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_get_parameters: SANEHandleFunction<LibSANE['sane_get_parameters']>;
+
+    /**
+     * Same as {@link LibSANE.sane_start}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_start: SANEHandleFunction<LibSANE['sane_start']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read: SANEHandleFunction<LibSANE['sane_read']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_blocking}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_blocking: SANEHandleFunction<LibSANE['sane_read_blocking']>;
+
+    /**
+     * Same as {@link LibSANE.sane_cancel}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_cancel: SANEHandleFunction<LibSANE['sane_cancel']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_start}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_start: SANEHandleFunction<LibSANE['sane_read_stream_start']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_start_batch}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_start_batch: SANEHandleFunction<LibSANE['sane_read_stream_start_batch']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_next}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_next: SANEHandleFunction<LibSANE['sane_read_stream_next']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_release}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_release: SANEHandleFunction<LibSANE['sane_read_stream_release']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_stop}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_stop: SANEHandleFunction<LibSANE['sane_read_stream_stop']>;
+
+    /**
+     * Same as {@link LibSANE.sane_read_stream_stats}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_read_stream_stats: SANEHandleFunction<LibSANE['sane_read_stream_stats']>;
+
+    /**
+     * Same as {@link LibSANE.sane_image_begin}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_image_begin: SANEHandleFunction<LibSANE['sane_image_begin']>;
+
+    /**
+     * Same as {@link LibSANE.sane_image_convert}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_image_convert: SANEHandleFunction<LibSANE['sane_image_convert']>;
+
+    /**
+     * Same as {@link LibSANE.sane_image_preview}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_image_preview: SANEHandleFunction<LibSANE['sane_image_preview']>;
+
+    /**
+     * Same as {@link LibSANE.sane_image_preview_get}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_image_preview_get: SANEHandleFunction<LibSANE['sane_image_preview_get']>;
+
+    /**
+     * Same as {@link LibSANE.sane_image_end}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_image_end: SANEHandleFunction<LibSANE['sane_image_end']>;
+
+    /**
+     * Same as {@link LibSANE.sane_encoder_begin}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_encoder_begin: SANEHandleFunction<LibSANE['sane_encoder_begin']>;
+
+    /**
+     * Same as {@link LibSANE.sane_encoder_write}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_encoder_write: SANEHandleFunction<LibSANE['sane_encoder_write']>;
+
+    /**
+     * Same as {@link LibSANE.sane_encoder_end}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_encoder_end: SANEHandleFunction<LibSANE['sane_encoder_end']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_get_parameters}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_get_parameters: SANEHandleFunction<LibSANE['sane_fast_get_parameters']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_read}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_read: SANEHandleFunction<LibSANE['sane_fast_read']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_read_blocking}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_read_blocking: SANEHandleFunction<LibSANE['sane_fast_read_blocking']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_read_stream_next}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_read_stream_next: SANEHandleFunction<LibSANE['sane_fast_read_stream_next']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_control_option_get_value}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_control_option_get_value: SANEHandleFunction<LibSANE['sane_fast_control_option_get_value']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_control_option_set_value}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_control_option_set_value: SANEHandleFunction<LibSANE['sane_fast_control_option_set_value']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_image_convert}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_image_convert: SANEHandleFunction<LibSANE['sane_fast_image_convert']>;
+
+    /**
+     * Same as {@link LibSANE.sane_fast_encoder_write}, for a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    sane_handle_fast_encoder_write: SANEHandleFunction<LibSANE['sane_fast_encoder_write']>;
 }
 
 /**
@@ -411,6 +1304,50 @@ export type LibSANEOptions = {
      * @defaultvalue `true`
      */
     loaderRemoveGlobal?: boolean;
+    /**
+     * Should the loader use the release build (`${loaderURL}/simd`) when
+     * WebAssembly SIMD is supported? The compatibility build (no SIMD) is
+     * used otherwise. Disable this when serving only the compatibility build.
+     *
+     * The loader is only used on web environments.
+     *
+     * @defaultvalue `true`
+     */
+    loaderSIMD?: boolean;
+    /**
+     * Load a slim variant (`${loaderURL}/slim/${loaderFamily}`, see
+     * `build.sh --slim`), with only the backends of one family (e.g.
+     * `"canon"`). The full build is used when not set.
+     *
+     * The loader is only used on web environments.
+     *
+     * @defaultvalue `null`
+     */
+    loaderFamily?: string | null;
+    /**
+     * Compile the wasm file while it downloads
+     * (`WebAssembly.compileStreaming`) instead of prefetching it to a Blob
+     * URL. The server must serve it as `application/wasm` (the CDN does),
+     * otherwise it's fetched again and compiled normally. Browsers keep the
+     * compiled code in their own cache for streaming compilation.
+     *
+     * The loader is only used on web environments.
+     *
+     * @defaultvalue `false`
+     */
+    loaderStreaming?: boolean;
+    /**
+     * Use the JSPI build (`build/jspi`, see `build.sh --jspi`) when the
+     * runtime supports JavaScript Promise Integration
+     * (`WebAssembly.Suspending`), it doesn't have the ASYNCIFY
+     * instrumentation (smaller and faster). Falls back to the other builds
+     * elsewhere. Used by the loader (`${loaderURL}/jspi`) and on Node.js.
+     *
+     * Experimental, the JSPI build has not been verified yet.
+     *
+     * @defaultvalue `false`
+     */
+    jspi?: boolean;
     /**
      * Enables SANE low-level debug messages, this can be quite verbose.
      *
@@ -435,6 +1372,140 @@ export type LibSANEOptions = {
      * @defaultvalue `0`
      */
     debugTestDevices?: number;
+    /**
+     * Number of read buffers (slots) used by
+     * {@link LibSANE.sane_read_stream_start}. Each buffer has
+     * {@link LibSANEOptions.readBufferSize} bytes.
+     *
+     * @defaultvalue `4`
+     */
+    readBufferSlots?: number;
+    /**
+     * Size of the read buffers, the most data returned by each read. Each
+     * device has one, plus the read stream slots. Smaller buffers bound the
+     * memory used while scanning (also the image conversion buffers), at
+     * the cost of more reads.
+     *
+     * @defaultvalue `2097152` (2MiB)
+     */
+    readBufferSize?: number;
+    /**
+     * Longest time (in milliseconds) that {@link LibSANE.sane_read_blocking}
+     * (and the read streams) keep polling the backend without data before
+     * returning an empty read, so that the caller can stop reading.
+     * {@link LibSANE.sane_cancel} ends the wait right away.
+     *
+     * @defaultvalue `250`
+     */
+    readIdleMax?: number;
+    /**
+     * Maximum size of the module memory (WASM heap), in bytes. The module
+     * memory grows as needed and never shrinks, growing past this limit
+     * fails like running out of memory (the module aborts). Use
+     * {@link LibSANE.sane_get_memory_stats} to find the high-water mark of
+     * the scans and {@link ScanImageReaderOptions.keepImage} to scan
+     * without keeping the full image. No limit when not set (the build's
+     * limit, 2GiB). Values below the initial size
+     * ({@link LibSANE.SANE_WASM_INITIAL_MEMORY}) are raised to it.
+     *
+     * @defaultvalue `null`
+     */
+    memoryLimit?: number | null;
+    /**
+     * Number of device threads created at startup for the handle API
+     * ({@link LibSANE.sane_handle_open}), each open handle uses one. More
+     * threads are created if needed, but that is slower (new workers). Also
+     * sizes the pthread pool (plus the threads used by the single handle
+     * API, device discovery and the backends).
+     *
+     * @defaultvalue `2`
+     */
+    threadPoolSize?: number;
+    /**
+     * Enables the discovery cache. {@link LibSANE.sane_get_devices} keeps
+     * the device list for each set of attached USB devices (vendor/product
+     * IDs), when the same devices are attached it only probes the backends
+     * that found devices last time and the ones that support the attached
+     * devices (see {@link LibSANE.sane_discovery_probe}), instead of every
+     * backend. The result has `cached: true`, the devices are verified.
+     * Then a full discovery runs in the background and replaces the cached
+     * list (new devices of other backends, e.g. a network scanner, show up
+     * on the next call and the ones that are gone are dropped), see
+     * {@link LibSANE.sane_discovery_cache_wait}. Opening a device waits for
+     * the background discovery.
+     *
+     * The USB devices are the ones that `navigator.usb.getDevices()`
+     * returns (the ones libusb sees). On Node.js, node-usb's `webusb`
+     * returns none unless they were requested, so there is a single cached
+     * list for all the USB devices attached.
+     *
+     * SANE's dll backend can't probe some of the backends, with no
+     * {@link LibSANEOptions.backends} or {@link LibSANEOptions.deviceHints},
+     * {@link LibSANE.sane_init} selects all of them and calls them directly
+     * (same device names, SANE's `dll.aliases` is not used).
+     *
+     * The cache is persisted, in IndexedDB on web environments and on a file
+     * on Node.js (see {@link LibSANEOptions.discoveryCacheFile}).
+     *
+     * @defaultvalue `false`
+     */
+    discoveryCache?: boolean;
+    /**
+     * Discovery cache file, on Node.js.
+     *
+     * @defaultvalue `~/.cache/sane-wasm/devices.json`
+     */
+    discoveryCacheFile?: string;
+    /**
+     * Backends used after {@link LibSANE.sane_init}, only these are
+     * initialized (on first use) and probed by
+     * {@link LibSANE.sane_get_devices}. Device names are prefixed with the
+     * backend name (`backend:device`), like with all backends. Set before
+     * calling {@link LibSANE.sane_init}, an unknown backend makes it fail
+     * with `INVAL`. All backends are used when not set (or empty).
+     *
+     * The available backends are listed on {@link LibSANE.SANE_WASM_BACKENDS}.
+     *
+     * @defaultvalue `null`
+     */
+    backends?: string[] | null;
+    /**
+     * USB IDs (`"vvvv:pppp"`, hex) of the devices that will be used, the
+     * backends that support them (from SANE's backend descriptions) are
+     * added to {@link LibSANEOptions.backends}. IDs not known by any backend
+     * are ignored.
+     *
+     * @defaultvalue `null`
+     */
+    deviceHints?: string[] | null;
+    /**
+     * Enables the metrics, see {@link LibSANE.sane_get_metrics}. Adds a
+     * small overhead to every SANE call and USB transfer.
+     *
+     * @defaultvalue `false`
+     */
+    metrics?: boolean;
+    /**
+     * USB API used by libusb instead of `navigator.usb` (e.g.
+     * {@link USBRecorder} or {@link USBReplay}). It replaces
+     * `navigator.usb` on this environment (shared by all instances) and
+     * can't be used with {@link libsaneWorker} (not cloneable), use it on
+     * the worker.
+     *
+     * @defaultvalue `null`
+     */
+    usb?: USBLike | null;
+    /**
+     * Cache for the compiled wasm module, keyed by URL (use versioned URLs).
+     * On Node.js (lib/index.js) the module is reused by the instances on
+     * the same process. None by default on web environments, browsers
+     * can't store compiled modules (e.g. in IndexedDB), they keep their own
+     * code cache for streaming compilation (see
+     * {@link LibSANEOptions.loaderStreaming}). Set to `null` to disable.
+     *
+     * @defaultvalue `null` (an in-process cache on Node.js)
+     */
+    wasmCache?: { get(key: string): WebAssembly.Module | null | undefined | Promise<WebAssembly.Module | null | undefined>; set(key: string, module: WebAssembly.Module): void; } | null;
     /**
      * Enables sane-wasm "promisify" to normalize the API. See pre.js for more
      * information.
@@ -447,9 +1518,11 @@ export type LibSANEOptions = {
      */
     promisify?: boolean;
     /**
-     * Enables sane-wasm "promisify" queue that queues function calls to
-     * prevent issues with calling multiple asynchronous functions. See pre.js
-     * for more information.
+     * Enables sane-wasm "promisify" queue (scheduler) that queues function
+     * calls while other calls on the same resource (global, device or read
+     * stream) are in progress. Calls on different resources run at the same
+     * time, see {@link LibSANE.sane_scheduler_stats}. See pre.js for more
+     * information.
      *
      * @deprecated You want this option enabled! This option may be removed in
      * the future.
@@ -484,5 +1557,8 @@ export const libsane = require('../lib') as LibSANEFactory;
  */
 export default libsane;
 
+export * from './handle';
 export * from './options';
 export * from './readers';
+export * from './usb-trace';
+export * from './worker';
@@ -1,4 +1,4 @@
-import { LibSANE, SANEOptionDescriptor, SANEStatus, SANEValueType } from ".";
+import { LibSANE, SANEOptionDescriptor, SANEStatus } from ".";
 
 export interface ScanOption<T = any> {
     index: number;
@@ -75,28 +75,16 @@ export abstract class ScanOptionsBase implements IScanOptions {
     }
 
     protected static async _getOpts(lib: LibSANE) {
-        const opts: Array<ScanOption> = [];
-        let desc: SANEOptionDescriptor | null = null;
-        for (let i = 0, n = -1; desc || i === 0; i++) {
-            ({ option_descriptor: desc } = lib.sane_get_option_descriptor(i));
-            if (desc) {
-                if (!desc.cap.INACTIVE && desc.cap.SOFT_DETECT && desc.type !== SANEValueType.BUTTON) {
-                    const { status, value } = await lib.sane_control_option_get_value(i);
-                    if (status !== SANEStatus.GOOD) {
-                        throw new Error(`Unexpected status ${SANEStatus[status]} while getting option value.`);
-                    }
-                    opts.push({ index: i, descriptor: desc, value });
-                    if (i === 0) {
-                        n = value; // option 0 contains total number of options
-                    }
-                } else {
-                    opts.push({ index: i, descriptor: desc, value: null });
-                }
-            } else if (!desc && i !== n) {
-                throw new Error('Unexpected number of options.');
-            }
+        // all descriptors and values in a single call (cached descriptors)
+        const { status, options } = await lib.sane_get_all_options();
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Unexpected status ${SANEStatus[status]} while getting options.`);
+        }
+        if (options.length !== options[0].value) {
+            // option 0 contains total number of options
+            throw new Error('Unexpected number of options.');
         }
-        return opts;
+        return options as Array<ScanOption>;
     }
 
     protected constructor(lib: LibSANE, opts: Array<ScanOption>) {
@@ -123,33 +111,36 @@ export abstract class ScanOptionsBase implements IScanOptions {
     }
 
     protected async _setValue(index: number, value: any) {
-        const auto = value === null; // null means auto
-        const { status, info } = auto ? await this._lib.sane_control_option_set_auto(index) : await this._lib.sane_control_option_set_value(index, value);
-        if (status !== SANEStatus.GOOD) {
-            return { status, info, opts: null };
+        // null means auto, the library reads back the value and returns
+        // only the options that changed (also on RELOAD_OPTIONS)
+        const res = await this._lib.sane_set_option(index, value);
+        if (res.status !== SANEStatus.GOOD) {
+            return { status: res.status, info: res.info, opts: null };
         }
-        if (info.RELOAD_OPTIONS) {
-            return { status, info, opts: await ScanOptionsBase._getOpts(this._lib) };
+        const { status, info, count, changes } = res;
+        const opts = this.options.slice(0, count);
+        for (const option of changes) {
+            opts[option.index] = option;
         }
-        if (info.INEXACT || typeof value === 'number' || auto) {
-            // auto triggers get value... ok
-            // number triggers get value... this is a quirk for fixed numbers
-            // because the conversion from floating to fixed point happens
-            // on the library side, we might get INEXACT == false but in
-            // reality there were some small difference
-            // XXX: this could probably be fixed on the C side
-            const { status, value: v } = await this._lib.sane_control_option_get_value(index);
-            if (status !== SANEStatus.GOOD) {
-                throw new Error(`Unexpected status ${SANEStatus[status]} while getting option value.`);
-            }
-            value = v;
+        if (opts.length !== count || opts[0].value !== count) {
+            throw new Error('Unexpected number of options.');
         }
-        // update value
-        const opts = [...this.options];
-        opts[index] = { ...opts[index], value };
         return { status, info, opts };
     }
 
+    protected async _apply(profile: Record<string, any>) {
+        // all options set and read back in a single call
+        const res = await this._lib.sane_control_options_apply(profile);
+        if (res.status !== SANEStatus.GOOD) {
+            return { status: res.status, info: null, values: null, inexact: null, rejected: null, opts: null };
+        }
+        const { status, info, options, values, inexact, rejected } = res;
+        if (options.length !== options[0].value) {
+            throw new Error('Unexpected number of options.');
+        }
+        return { status, info, values, inexact, rejected, opts: options as Array<ScanOption> };
+    }
+
     /**
      * Get class instance (with all scanning options).
      */
@@ -161,6 +152,13 @@ export abstract class ScanOptionsBase implements IScanOptions {
      * @see {@link https://sane-project.gitlab.io/standard/1.06/api.html#sane-control-option}
      */
     abstract setValue(index: number, value: any): any;
+
+    /**
+     * Set many options by name (e.g. a saved scan profile), see
+     * {@link LibSANE.sane_control_options_apply}. Use `null` as value for
+     * automatic.
+     */
+    abstract apply(profile: Record<string, any>): any;
 }
 
 /**
@@ -184,6 +182,14 @@ export class ScanOptionsMutable extends ScanOptionsBase {
         return { status, info };
     }
 
+    async apply(profile: Record<string, any>) {
+        const { opts, ...res } = await this._apply(profile);
+        if (opts) {
+            this._setOpts(opts);
+        }
+        return res;
+    }
+
 }
 
 /**
@@ -206,4 +212,9 @@ export class ScanOptions extends ScanOptionsBase {
         return { status, info, updated: null };
     }
 
+    async apply(profile: Record<string, any>) {
+        const { opts, ...res } = await this._apply(profile);
+        return { ...res, updated: opts ? new ScanOptions(this._lib, opts) : null };
+    }
+
 }
@@ -1,4 +1,4 @@
-import { LibSANE, SANEFrame, SANEParameters, SANEStatus } from ".";
+import { LibSANE, SANEEncoderOptions, SANEFrame, SANEImageFormat, SANEImageLayout, SANEParameters, SANEStatus } from ".";
 
 abstract class EventBaseClass<T extends Record<keyof T, any[]>> {
 
@@ -41,21 +41,66 @@ abstract class EventBaseClass<T extends Record<keyof T, any[]>> {
  */
 export interface ScanDataReaderEventMap extends Record<string, any[]> {
     /**
-     * Scanning stop event.
+     * Scanning start event.
      */
     start: [parameters: SANEParameters];
     /**
-     * Scanning start event.
+     * Scanning end event, with the reader's stage timings.
      */
-    stop: [parameters: SANEParameters, error: Error | null];
+    stop: [parameters: SANEParameters, error: Error | null, timing: ScanReaderTiming];
     /**
      * Raw image data event.
      */
     data: [parameters: SANEParameters, data: Uint8Array];
 }
 
+/**
+ * Per-stage timings of a scan reader, see {@link ScanDataReader.timing}.
+ */
+export type ScanReaderTiming = {
+    /**
+     * Number of reads (including empty reads).
+     */
+    reads: number;
+    /**
+     * Time waiting for the reads (SANE, helper thread and proxying).
+     */
+    read_ms: number;
+    /**
+     * Time converting or encoding the data (native, on
+     * {@link ScanImageReader} and {@link ScanEncodedReader}).
+     */
+    convert_ms: number;
+    /**
+     * Time on the `data` event listeners, without the conversion.
+     */
+    fire_ms: number;
+}
+
+/**
+ * Options for {@link ScanDataReader}.
+ */
+export type ScanDataReaderOptions = {
+    /**
+     * How to wait for scan data:
+     *
+     * - `'stream'`: uses {@link LibSANE.sane_read_stream_start}, the helper
+     *   thread keeps reading into a ring of buffers while the data is
+     *   processed;
+     * - `'blocking'`: uses {@link LibSANE.sane_read_blocking}, the helper
+     *   thread waits for data, there are no timers involved;
+     * - `'poll'`: uses {@link LibSANE.sane_read} with `setTimeout()` between
+     *   reads (10ms after data, 200ms after an empty read), this is the
+     *   original read mode.
+     *
+     * @defaultvalue `'stream'`
+     */
+    readMode?: 'stream' | 'blocking' | 'poll';
+}
+
 /**
  * Raw data reader that automatically handles SANE's read code flow.
+ * It reads a single page, use {@link ScanBatchReader} for document feeders.
  *
  * Use {@link ScanDataReader.on} to listen to events, available event types
  * are declared on {@link ScanDataReaderEventMap}.
@@ -70,39 +115,91 @@ export interface ScanDataReaderEventMap extends Record<string, any[]> {
  * {@link https://sane-project.gitlab.io/standard/1.06/api.html#code-flow}
  */
 export class ScanDataReader<T extends ScanDataReaderEventMap = ScanDataReaderEventMap> extends EventBaseClass<T> {
-    private _lib: LibSANE;
+    protected _lib: LibSANE;
     private _used: boolean = false;
     private _killed: Error | boolean = false;
+    private _readMode: 'stream' | 'blocking' | 'poll';
 
-    constructor(lib: LibSANE) {
+    /**
+     * Stage timings of the scan, updated while reading (also passed to the
+     * `stop` event).
+     */
+    readonly timing: ScanReaderTiming = { reads: 0, read_ms: 0, convert_ms: 0, fire_ms: 0 };
+
+    private _pending: Promise<unknown> | null = null;
+
+    constructor(lib: LibSANE, options: ScanDataReaderOptions = {}) {
         super();
         this._lib = lib;
+        this._readMode = options.readMode ?? 'stream';
     }
 
     private _readPromise(parameters: SANEParameters | null) {
         return new Promise<void>((resolve, reject) => {
+            // reads are non-blocking because of how emscripten works
+            // this causes sane_read() to immediately return with
+            // 0 bytes of data, this goes against the SANE spec,
+            // blocking I/O by default
+            // on 'poll' mode we poll the read using setTimeout(), this is
+            // not ideal, on 'blocking' and 'stream' modes the helper thread
+            // (glue.cpp) waits for the data and we just read again right away
+            // https://github.com/emscripten-core/emscripten/issues/13214
+            const poll = this._readMode === 'poll';
+            const stream = this._readMode === 'stream';
+            let streaming = false;
+            const next = (delay: number) => {
+                if (poll) {
+                    setTimeout(read, delay);
+                } else {
+                    read();
+                }
+            };
             const read = async () => {
                 try {
                     if (this._killed) {
-                        await this._lib.sane_cancel(); // ignore status
+                        await this._lib.sane_cancel(); // ignore status, also stops the read stream
+                        streaming = false;
+                    } else if (stream && !streaming) {
+                        const { status } = this._lib.sane_read_stream_start();
+                        if (status !== SANEStatus.GOOD) {
+                            throw new Error(`Status ${SANEStatus[status]} during sane_read_stream_start().`);
+                        }
+                        streaming = true;
                     }
 
-                    // reads are non-blocking because of how emscripten works
-                    // this causes sane_read() to immediately return with
-                    // 0 bytes of data, this goes against the SANE spec,
-                    // blocking I/O by default
-                    // the only option right now is to poll the read using
-                    // setTimeout(), this is not ideal
-                    // currently even emscripten's asyncify does not help here,
-                    // but in the future it might help support blocking I/O
-                    // XXX: are we in the future now? can we improve this
-                    // https://github.com/emscripten-core/emscripten/issues/13214
-
-                    const { status, data } = await this._lib.sane_read(); // non-blocking
+                    // fast API, the result is decoded as needed (no new
+                    // objects for each read)
+                    const t0 = performance.now();
+                    const res = await (
+                        streaming ? this._lib.sane_fast_read_stream_next() :
+                        poll ? this._lib.sane_fast_read() : this._lib.sane_fast_read_blocking()
+                    );
+                    const { status, data } = res;
+                    this.timing.reads++;
+                    this.timing.read_ms += performance.now() - t0;
 
                     if (status === SANEStatus.GOOD) {
-                        if (parameters && data.length) {
-                            this.fire('data', parameters, data);
+                        const { slot } = res;
+                        const t1 = performance.now();
+                        const convert = this.timing.convert_ms;
+                        try {
+                            if (parameters && data && data.length) {
+                                this.fire('data', parameters, data);
+                            }
+                        } finally {
+                            this.timing.fire_ms += performance.now() - t1 - (this.timing.convert_ms - convert);
+                            if (slot !== null) {
+                                // data is a view over the slot, listeners
+                                // had their chance to use it
+                                this._lib.sane_read_stream_release(slot); // ignore status
+                            }
+                        }
+                        if (this._pending) {
+                            // back-pressure (e.g. a slow sink), the helper
+                            // thread keeps reading until the slots are full
+                            const pending = this._pending;
+                            this._pending = null;
+                            await pending;
                         }
 
                     } else if (
@@ -129,12 +226,13 @@ export class ScanDataReader<T extends ScanDataReaderEventMap = ScanDataReaderEve
                         this._killed = true;
 
                     } else {
-                        // TODO: handle document feeder / multi-page scans
+                        // single page, document feeders (multi-page) use
+                        // ScanBatchReader, NO_DOCS is an error here too
                         this._killed = new Error(`Status ${SANEStatus[status]} during sane_read().`);
 
                     }
 
-                    setTimeout(read, data && data.length > 0 ? 10 : 200);
+                    next(data && data.length > 0 ? 10 : 200);
                 } catch (e) {
                     const ee = e instanceof Error ? e : new Error("Unknown error while scanning.");
                     if (this._killed) {
@@ -143,13 +241,25 @@ export class ScanDataReader<T extends ScanDataReaderEventMap = ScanDataReaderEve
                         return;
                     }
                     this._killed = ee;
-                    setTimeout(read, 200);
+                    next(200);
                 }
             };
-            setTimeout(read, 200);
+            next(200);
         });
     }
 
+    /**
+     * Wait for `promise` before the next read, and before the scan promise
+     * settles (back-pressure).
+     */
+    protected _wait(promise: Promise<unknown> | null) {
+        if (promise) {
+            const pending = this._pending ? Promise.all([this._pending, promise]) : promise;
+            pending.catch(() => {}); // handled when awaited
+            this._pending = pending;
+        }
+    }
+
     /**
      * Start scanning operation.
      */
@@ -191,7 +301,8 @@ export class ScanDataReader<T extends ScanDataReaderEventMap = ScanDataReaderEve
         return {
             status, parameters,
             promise: this._readPromise(parameters).finally(() => {
-                this.fire('stop', parameters, this._killed instanceof Error ? this._killed : null);
+                this.fire('stop', parameters, this._killed instanceof Error ? this._killed : null, this.timing);
+                return this._pending;
             }),
         };
     }
@@ -211,20 +322,185 @@ export class ScanDataReader<T extends ScanDataReaderEventMap = ScanDataReaderEve
  */
 export interface ScanImageReaderEventMap extends ScanDataReaderEventMap {
     /**
-     * Image line event, one or more full lines of RGBA data.
+     * Image line event, one or more full lines of image data (RGBA by
+     * default, see {@link ScanImageReaderOptions.layout}). The data is a view
+     * into the full image (same buffer as the `image` event), don't modify
+     * it, copy it if needed after the scan. Without the full image (see
+     * {@link ScanImageReaderOptions.keepImage}) it's a view over the module
+     * memory, only valid during the event.
      */
     line: [parameters: SANEParameters, data: Uint8ClampedArray, line: number];
     /**
-     * Full image event (end of scan), RGBA data.
+     * Full image event (end of scan), image data (RGBA by default, see
+     * {@link ScanImageReaderOptions.layout}). Not fired without the full
+     * image (see {@link ScanImageReaderOptions.keepImage}).
      */
     image: [parameters: SANEParameters, data: Uint8ClampedArray];
+    /**
+     * Preview event, new lines of a preview level (see
+     * {@link ScanImageReaderOptions.preview}).
+     */
+    preview: [parameters: SANEParameters, preview: ScanImagePreview];
 }
 
+/**
+ * Preview update, see {@link ScanImageReaderEventMap.preview}.
+ */
+export type ScanImagePreview = {
+    /**
+     * Preview level, 0 is the largest.
+     */
+    level: number;
+    width: number;
+    height: number;
+    /**
+     * First new line.
+     */
+    line: number;
+    /**
+     * Number of new lines.
+     */
+    lines: number;
+    /**
+     * Full level image (same layout as the image), updated in place, only
+     * the lines up to `line + lines` are complete. Don't modify it.
+     */
+    data: Uint8ClampedArray;
+}
+
+/**
+ * Options for {@link ScanImageReader}.
+ */
+export type ScanImageReaderOptions = ScanDataReaderOptions & {
+    /**
+     * Layout of the generated image data.
+     *
+     * @defaultvalue `SANEImageLayout.RGBA`
+     */
+    layout?: SANEImageLayout;
+    /**
+     * Keep the full image (for the `image` event). Without it, the memory
+     * used while scanning doesn't depend on the image size, use the `line`
+     * event or {@link ScanImageReaderOptions.sink} to get the data.
+     *
+     * @defaultvalue `true`
+     */
+    keepImage?: boolean;
+    /**
+     * Where to write the image lines as they are converted (raw image data,
+     * no headers), a `WritableStream` or a Node.js `Writable` (e.g.
+     * `fs.createWriteStream()`). Reading waits for the sink when it's not
+     * ready for more data. The sink is closed at the end of the scan
+     * (aborted/destroyed on errors).
+     *
+     * @defaultvalue `null`
+     */
+    sink?: ScanSink | null;
+    /**
+     * Build a downsampled preview of the image while scanning, level 0 is
+     * at most `width` pixels wide, each next level is half of the previous
+     * one (up to `levels`, default 1). The preview is built natively with
+     * the image conversion (see {@link LibSANE.sane_image_preview}), the
+     * `preview` event has the new lines of each level, a small update that
+     * can be drawn right away (e.g. a thumbnail that fills in as the scan
+     * progresses).
+     *
+     * @defaultvalue `null`
+     */
+    preview?: { width: number; levels?: number } | null;
+}
+
+/**
+ * Node.js `Writable` (the parts used by {@link ScanSink}).
+ */
+export type ScanNodeWritable = {
+    write(chunk: Uint8Array): boolean;
+    end(): unknown;
+    destroy(): unknown;
+    once(event: string, listener: (...args: any[]) => void): unknown;
+    removeListener(event: string, listener: (...args: any[]) => void): unknown;
+}
+
+/**
+ * Destination for scan data, see {@link ScanImageReaderOptions.sink}.
+ */
+export type ScanSink = WritableStream<Uint8Array> | ScanNodeWritable;
+
+class ScanSinkWriter {
+
+    private _writer: WritableStreamDefaultWriter<Uint8Array> | null = null;
+    private _node: ScanNodeWritable | null = null;
+    private _error: Error | null = null;
+
+    constructor(sink: ScanSink) {
+        if ('getWriter' in sink) {
+            this._writer = sink.getWriter();
+        } else {
+            this._node = sink;
+            // without a listener, Node.js throws the error
+            this._node.once('error', (e: Error) => { this._error = e; });
+        }
+    }
+
+    /**
+     * Write a chunk, returns a promise to wait for when the sink is not
+     * ready for more data.
+     */
+    write(chunk: Uint8Array): Promise<void> | null {
+        if (this._writer) {
+            return this._writer.write(chunk);
+        }
+        if (this._error) {
+            throw this._error;
+        }
+        return this._node!.write(chunk) ? null : this._event('drain');
+    }
+
+    close(error: Error | null): Promise<void> {
+        if (this._writer) {
+            return error ? this._writer.abort(error) : this._writer.close();
+        }
+        if (error || this._error) {
+            this._node!.destroy();
+            return this._error ? Promise.reject(this._error) : Promise.resolve();
+        }
+        const finished = this._event('finish');
+        this._node!.end();
+        return finished;
+    }
+
+    private _event(type: string) {
+        const node = this._node!;
+        return new Promise<void>((resolve, reject) => {
+            const done = () => {
+                node.removeListener('error', fail);
+                resolve();
+            };
+            const fail = (e: Error) => {
+                node.removeListener(type, done);
+                reject(e);
+            };
+            node.once(type, done);
+            node.once('error', fail);
+        });
+    }
+}
+
+const imageLayoutBytesPerPixel = {
+    [SANEImageLayout.RGBA]: 4,
+    [SANEImageLayout.BGRA]: 4,
+    [SANEImageLayout.RGB]: 3,
+    [SANEImageLayout.GRAY]: 1,
+};
+
 /**
  * Image reader that automatically generates RGBA data while reading from
  * SANE's API using {@link ScanDataReader}. It supports the most common scan
  * modes and image formats. More formats can be added in the future.
  *
+ * The conversion is done natively by sane-wasm, see
+ * {@link LibSANE.sane_image_convert}.
+ *
  * Use {@link ScanImageReader.on} to listen to events, available event types
  * are declared on {@link ScanImageReaderEventMap}.
  *
@@ -239,12 +515,21 @@ export interface ScanImageReaderEventMap extends ScanDataReaderEventMap {
  */
 export class ScanImageReader<T extends ScanImageReaderEventMap = ScanImageReaderEventMap> extends ScanDataReader<T> {
 
-    private _line: number = 0;
+    private _layout: SANEImageLayout;
+    private _keepImage: boolean;
+    private _sink: ScanSink | null;
+    private _sinkWriter: ScanSinkWriter | null = null;
     private _allData: Uint8ClampedArray = new Uint8ClampedArray();
-    private _remainder = new Uint8ClampedArray();
+    private _preview: { width: number; levels?: number } | null;
+    private _previewData: Uint8ClampedArray[] = [];
+    private _previewLines: number[] = [];
 
-    constructor(lib: LibSANE) {
-        super(lib);
+    constructor(lib: LibSANE, options: ScanImageReaderOptions = {}) {
+        super(lib, options);
+        this._layout = options.layout ?? SANEImageLayout.RGBA;
+        this._keepImage = options.keepImage ?? true;
+        this._sink = options.sink ?? null;
+        this._preview = options.preview ?? null;
         this.on('start', this._onStart);
         this.on('data', this._onData);
         this.on('stop', this._onStop);
@@ -254,7 +539,7 @@ export class ScanImageReader<T extends ScanImageReaderEventMap = ScanImageReader
         if (parameters.format !== SANEFrame.GRAY && parameters.format !== SANEFrame.RGB) {
             throw new Error(`Invalid format (${JSON.stringify(parameters)}).`);
         }
-        if (parameters.depth !== 1 && parameters.depth !== 8) {
+        if (parameters.depth !== 1 && parameters.depth !== 8 && parameters.depth !== 16) {
             throw new Error(`Invalid bit depth (${JSON.stringify(parameters)}).`);
         }
         if (!parameters.last_frame) {
@@ -272,84 +557,522 @@ export class ScanImageReader<T extends ScanImageReaderEventMap = ScanImageReader
             throw new Error(`Unexpected byte count (${JSON.stringify(parameters)}).`);
         }
         // what do we support then?
-        // we support GRAY and RGB single-pass, 1 and 8-bit, known height
+        // we support GRAY and RGB single-pass, 1, 8 and 16-bit, known height
         // that should cover most modern scanners
-        this._allData = new Uint8ClampedArray(parameters.lines * parameters.pixels_per_line * 4);
+        const { status } = this._lib.sane_image_begin(parameters, this._layout);
+        if (status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[status]} during sane_image_begin() (${JSON.stringify(parameters)}).`);
+        }
+        if (this._preview) {
+            const { status } = this._lib.sane_image_preview(this._preview.width, this._preview.levels ?? 1);
+            if (status !== SANEStatus.GOOD) {
+                throw new Error(`Status ${SANEStatus[status]} during sane_image_preview().`);
+            }
+        }
+        if (this._keepImage) {
+            this._allData = new Uint8ClampedArray(parameters.lines * parameters.pixels_per_line * imageLayoutBytesPerPixel[this._layout]);
+        }
+        if (this._sink) {
+            this._sinkWriter = new ScanSinkWriter(this._sink);
+        }
     }
 
     private _onData(parameters: SANEParameters, data: Uint8Array) {
-        const dataIn = new Uint8ClampedArray(this._remainder.length + data.length);
-        dataIn.set(this._remainder, 0);
-        dataIn.set(data, this._remainder.length);
-
-        // line count, number of full available lines
-        const lc = Math.floor(dataIn.length / parameters.bytes_per_line);
-        if (!lc) {
+        const t0 = performance.now();
+        const res = this._lib.sane_fast_image_convert(data);
+        this.timing.convert_ms += performance.now() - t0;
+        if (res.status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[res.status]} during sane_fast_image_convert().`);
+        }
+        const { line, lines } = res;
+        if (!lines) {
             // not enough data for a full line
-            this._remainder = dataIn;
             return;
         }
+        // the converted data is a view over the module memory, copy it to
+        // its final position in the full image right away, listeners get a
+        // view of that position (no extra copies)
+        const converted = res.data!;
+        let data: Uint8ClampedArray;
+        if (this._keepImage) {
+            const offset = line * parameters.pixels_per_line * imageLayoutBytesPerPixel[this._layout];
+            this._allData.set(converted, offset);
+            data = this._allData.subarray(offset, offset + converted.length);
+        } else {
+            data = new Uint8ClampedArray(converted.buffer, converted.byteOffset, converted.length);
+        }
+        this.fire('line', parameters, data, line);
+        if (this._sinkWriter) {
+            // the sink may keep the chunk, only copy the module memory
+            this._wait(this._sinkWriter.write(this._keepImage ? new Uint8Array(data.buffer, data.byteOffset, data.length) : converted.slice()));
+        }
+        if (this._preview) {
+            this._updatePreview(parameters);
+        }
+    }
 
-        const dataOut = new Uint8ClampedArray(lc * parameters.pixels_per_line * 4); // RGBA (8-bit)
-        let ik = 0; // consumed data on dataIn
-        if (parameters.depth === 8) {
-            if (parameters.format === SANEFrame.GRAY) {
-                // 8-bit / 1 channel
-                for (let l = 0, o = 0; l < lc; l++, ik += parameters.bytes_per_line) { // for lines
-                    for (let p = 0, i = ik; p < parameters.pixels_per_line; p++, i++, o += 4) { // for pixels
-                        dataOut[o] = dataOut[o + 1] = dataOut[o + 2] = dataIn[i];
-                        dataOut[o + 3] = 0xff; // alpha
-                    }
-                }
-            } else {
-                // 8-bit / 3 channels
-                for (let l = 0, o = 0; l < lc; l++, ik += parameters.bytes_per_line) { // for lines
-                    for (let p = 0, i = ik; p < parameters.pixels_per_line; p++, i += 3, o += 4) { // for pixels
-                        dataOut.set(dataIn.subarray(i, i + 3), o);
-                        dataOut[o + 3] = 0xff; // alpha
-                    }
-                }
+    private _updatePreview(parameters: SANEParameters) {
+        const t0 = performance.now();
+        const res = this._lib.sane_image_preview_get();
+        if (res.status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[res.status]} during sane_image_preview_get().`);
+        }
+        // copy only the new lines of each level (views over the module memory)
+        const updates: ScanImagePreview[] = [];
+        res.levels!.forEach(({ width, height, lines, data }, level) => {
+            if (!this._previewData[level]) {
+                this._previewData[level] = new Uint8ClampedArray(data.length);
+                this._previewLines[level] = 0;
+            }
+            const line = this._previewLines[level];
+            if (lines > line) {
+                const bpl = width * imageLayoutBytesPerPixel[this._layout];
+                this._previewData[level].set(data.subarray(line * bpl, lines * bpl), line * bpl);
+                this._previewLines[level] = lines;
+                updates.push({ level, width, height, line, lines: lines - line, data: this._previewData[level] });
             }
-        } else { // parameters.depth == 1
-            if (parameters.format === SANEFrame.GRAY) {
-                // 1-bit / 1 channel
-                for (let l = 0, o = 0; l < lc; l++, ik += parameters.bytes_per_line) { // for lines
-                    for (let p = 0, i = ik; p < parameters.pixels_per_line; i++) { // for in bytes
-                        for (let mask = 0x80; mask !== 0 && p < parameters.pixels_per_line; mask >>= 1, p++, o += 4) { // for pixels
-                            dataOut[o] = dataOut[o + 1] = dataOut[o + 2] = dataIn[i] & mask ? 0x00 : 0xff;
-                            dataOut[o + 3] = 0xff; // alpha
+        });
+        this.timing.convert_ms += performance.now() - t0;
+        for (const preview of updates) {
+            this.fire('preview', parameters, preview);
+        }
+    }
+
+    private _onStop(parameters: SANEParameters, error: Error | null) {
+        this._lib.sane_image_end(); // ignore status
+        if (this._sinkWriter) {
+            this._wait(this._sinkWriter.close(error));
+            this._sinkWriter = null;
+        }
+        if (!error && this._keepImage) {
+            this.fire('image', parameters, this._allData);
+        }
+    }
+
+}
+
+/**
+ * @private Events types for {@link ScanEncodedReader}.
+ */
+export interface ScanEncodedReaderEventMap extends ScanDataReaderEventMap {
+    /**
+     * Encoded chunk event, the next part of the compressed file.
+     */
+    chunk: [parameters: SANEParameters, data: Uint8Array];
+    /**
+     * Full file event (end of scan), the complete compressed file.
+     */
+    file: [parameters: SANEParameters, data: Uint8Array];
+}
+
+/**
+ * Options for {@link ScanEncodedReader}.
+ */
+export type ScanEncodedReaderOptions = ScanDataReaderOptions & SANEEncoderOptions & {
+    /**
+     * Format of the generated file.
+     *
+     * @defaultvalue `SANEImageFormat.PNG`
+     */
+    format?: SANEImageFormat;
+}
+
+/**
+ * Encoded reader that automatically generates a compressed image file (JPEG
+ * or PNG) while reading from SANE's API using {@link ScanDataReader}.
+ *
+ * The encoding is done natively by sane-wasm while the data arrives, see
+ * {@link LibSANE.sane_encoder_write}, the uncompressed image is never kept.
+ *
+ * Use {@link ScanEncodedReader.on} to listen to events, available event
+ * types are declared on {@link ScanEncodedReaderEventMap}.
+ *
+ * A device should already be open with sane_open(), the reader will call
+ * sane_start() do the scanning and call sane_stop().
+ *
+ * Other SANE functions cannot be used while scanning.
+ *
+ * Scan readers are single use.
+ *
+ * {@link https://sane-project.gitlab.io/standard/1.06/api.html#code-flow}
+ */
+export class ScanEncodedReader<T extends ScanEncodedReaderEventMap = ScanEncodedReaderEventMap> extends ScanDataReader<T> {
+
+    private _format: SANEImageFormat;
+    private _encoderOptions: SANEEncoderOptions;
+    private _chunks: Uint8Array[] = [];
+
+    constructor(lib: LibSANE, options: ScanEncodedReaderOptions = {}) {
+        super(lib, options);
+        this._format = options.format ?? SANEImageFormat.PNG;
+        this._encoderOptions = { quality: options.quality, level: options.level };
+        this.on('start', this._onStart);
+        this.on('data', this._onData);
+        this.on('stop', this._onStop);
+    }
+
+    private _chunk(parameters: SANEParameters, data: Uint8Array) {
+        if (data.length) {
+            // the encoded data is a view over the module memory, copy it
+            const chunk = data.slice();
+            this._chunks.push(chunk);
+            this.fire('chunk', parameters, chunk);
+        }
+    }
+
+    private _onStart(parameters: SANEParameters) {
+        const res = this._lib.sane_encoder_begin(parameters, this._format, this._encoderOptions);
+        if (res.status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[res.status]} during sane_encoder_begin() (${JSON.stringify(parameters)}).`);
+        }
+        this._chunk(parameters, res.data);
+    }
+
+    private _onData(parameters: SANEParameters, data: Uint8Array) {
+        const t0 = performance.now();
+        const res = this._lib.sane_fast_encoder_write(data);
+        this.timing.convert_ms += performance.now() - t0;
+        if (res.status !== SANEStatus.GOOD) {
+            throw new Error(`Status ${SANEStatus[res.status]} during sane_fast_encoder_write().`);
+        }
+        this._chunk(parameters, res.data!);
+    }
+
+    private _onStop(parameters: SANEParameters, error: Error | null) {
+        const res = this._lib.sane_encoder_end();
+        if (error || res.status !== SANEStatus.GOOD) {
+            return;
+        }
+        this._chunk(parameters, res.data);
+        const file = new Uint8Array(this._chunks.reduce((n, c) => n + c.length, 0));
+        let offset = 0;
+        for (const chunk of this._chunks) {
+            file.set(chunk, offset);
+            offset += chunk.length;
+        }
+        this._chunks = [];
+        this.fire('file', parameters, file);
+    }
+
+}
+
+/**
+ * @private Events types for {@link ScanBatchReader}.
+ */
+export interface ScanBatchReaderEventMap extends Record<string, any[]> {
+    /**
+     * Page start event (pages are numbered from 0).
+     */
+    pageStart: [parameters: SANEParameters, page: number];
+    /**
+     * Raw image data event.
+     */
+    data: [parameters: SANEParameters, data: Uint8Array, page: number];
+    /**
+     * Page end event, all the page data was read.
+     */
+    pageEnd: [parameters: SANEParameters, page: number];
+    /**
+     * Batch end event, with the number of complete pages.
+     */
+    stop: [pages: number, error: Error | null];
+}
+
+/**
+ * Batch reader for document feeders (ADF), reads pages until the feeder is
+ * empty (`NO_DOCS`) using a read stream in batch mode, see
+ * {@link LibSANE.sane_read_stream_start_batch}. The next page is started by
+ * the helper thread as soon as a page ends, while the previous one is still
+ * being processed.
+ *
+ * Use {@link ScanBatchReader.on} to listen to events, available event types
+ * are declared on {@link ScanBatchReaderEventMap}. The `data` event receives
+ * views over the read buffers, same as {@link ScanDataReader}, copy the data
+ * if needed after the event.
+ *
+ * A device should already be open with sane_open() and the feeder selected
+ * (e.g. option `source`), the reader will call sane_start() do the scanning
+ * and call sane_stop().
+ *
+ * Other SANE functions cannot be used while scanning.
+ *
+ * Scan readers are single use.
+ *
+ * {@link https://sane-project.gitlab.io/standard/1.06/api.html#code-flow}
+ */
+export class ScanBatchReader<T extends ScanBatchReaderEventMap = ScanBatchReaderEventMap> extends EventBaseClass<T> {
+    protected _lib: LibSANE;
+    private _used: boolean = false;
+    private _killed: Error | boolean = false;
+    private _pages = 0;
+
+    constructor(lib: LibSANE) {
+        super();
+        this._lib = lib;
+    }
+
+    private async _readPromise(parameters: SANEParameters) {
+        let page = 0;
+        try {
+            this.fire('pageStart', parameters, page);
+            const { status } = this._lib.sane_read_stream_start_batch();
+            if (status !== SANEStatus.GOOD) {
+                throw new Error(`Status ${SANEStatus[status]} during sane_read_stream_start_batch().`);
+            }
+            while (!this._killed) {
+                const res = await this._lib.sane_fast_read_stream_next();
+                const { status, data } = res;
+                if (status === SANEStatus.GOOD) {
+                    if (data) {
+                        const slot = res.slot!;
+                        try {
+                            this.fire('data', parameters, data, page);
+                        } finally {
+                            this._lib.sane_read_stream_release(slot); // ignore status
                         }
+                    } else if (res.parameters) {
+                        // the helper thread already started the next page
+                        parameters = res.parameters;
+                        this.fire('pageStart', parameters, ++page);
                     }
+                } else if (status === SANEStatus.EOF) {
+                    this._pages = page + 1;
+                    this.fire('pageEnd', parameters, page);
+                } else if (status === SANEStatus.NO_DOCS) {
+                    // feeder empty, normal end of the batch
+                    break;
+                } else {
+                    throw new Error(`Status ${SANEStatus[status]} during sane_fast_read_stream_next().`);
                 }
+            }
+        } catch (e) {
+            if (!this._killed) {
+                this._killed = e instanceof Error ? e : new Error("Unknown error while scanning.");
+            }
+        }
+        await this._lib.sane_cancel(); // ignore status, also stops the read stream
+        if (this._killed instanceof Error) {
+            throw this._killed;
+        }
+        return this._pages;
+    }
+
+    /**
+     * Start batch scanning operation. The promise resolves with the number
+     * of complete pages.
+     */
+    async start() {
+        if (this._used) {
+            // readers are single use
+            throw new Error("Scan readers cannot be reused.");
+        }
+        const { status } = await this._lib.sane_start();
+        if (status !== SANEStatus.GOOD) {
+            // NO_DOCS here means an empty feeder
+            return {
+                status,
+                parameters: null,
+                promise: Promise.reject<number>(new Error(`Status ${SANEStatus[status]} during sane_start().`)),
+            };
+        }
+        this._used = true;
+
+        const { status: s, parameters } = await this._lib.sane_get_parameters();
+        if (s !== SANEStatus.GOOD) {
+            await this._lib.sane_cancel(); // ignore status
+            return {
+                status: s, parameters,
+                promise: Promise.reject<number>(new Error(`Status ${SANEStatus[s]} during sane_get_parameters().`)),
+            };
+        }
+
+        return {
+            status: s, parameters,
+            promise: this._readPromise(parameters).finally(() => {
+                this.fire('stop', this._pages, this._killed instanceof Error ? this._killed : null);
+            }),
+        };
+    }
+
+    /**
+     * Cancel batch scanning operation, the current page is not completed.
+     */
+    cancel() {
+        if (this._used && !this._killed) {
+            this._killed = true;
+        }
+    }
+}
+
+/**
+ * Options for {@link ScanStream}.
+ */
+export type ScanStreamOptions = {
+    /**
+     * Chunk size for readers that don't bring their own buffer (default
+     * `ReadableStream` readers and Node.js streams).
+     *
+     * @defaultvalue `65536`
+     */
+    chunkSize?: number;
+}
+
+/**
+ * Node.js `Readable` (the parts used by most consumers), see
+ * {@link ScanStream.startNode}.
+ */
+export type ScanNodeReadable = AsyncIterable<Uint8Array> & {
+    pipe<D>(destination: D, options?: { end?: boolean }): D;
+    destroy(error?: Error): unknown;
+    on(event: string, listener: (...args: any[]) => void): unknown;
+}
+
+/**
+ * Scan data as a stream (raw image data, same as the `data` event of
+ * {@link ScanDataReader}), a `ReadableStream` (byte stream) or a Node.js
+ * `Readable`. Unlike the scan readers, data is only read when the consumer
+ * asks for it (back-pressure), there is no read-ahead. BYOB readers
+ * (`stream.getReader({ mode: 'byob' })`) get the data copied straight from
+ * the read buffer into their own buffer.
+ *
+ * A device should already be open with sane_open(), the stream will call
+ * sane_start() do the scanning and call sane_cancel() at the end (or when
+ * the stream is cancelled/destroyed).
+ *
+ * Other SANE functions cannot be used while scanning.
+ *
+ * Scan streams are single use.
+ *
+ * {@link https://sane-project.gitlab.io/standard/1.06/api.html#code-flow}
+ */
+export class ScanStream {
+    protected _lib: LibSANE;
+    private _used: boolean = false;
+    private _ended: boolean = false;
+    private _chunkSize: number;
+    // rest of the last read (not read again until it's consumed), copied
+    // out of the read buffer, any other read on the device overwrites it
+    private _rest: Uint8Array | null = null;
+
+    constructor(lib: LibSANE, options: ScanStreamOptions = {}) {
+        this._lib = lib;
+        this._chunkSize = options.chunkSize ?? 65536;
+    }
+
+    /**
+     * Copy the next data to `into` (or to a new array of at most `size`
+     * bytes), `null` at the end of the scan.
+     */
+    private async _next(into: Uint8Array | null, size: number): Promise<Uint8Array | null> {
+        let data = this._rest;
+        while (!data || !data.length) {
+            if (this._ended) {
+                return null;
+            }
+            // sane_read_blocking waits for data on the helper thread, it
+            // returns empty reads from time to time (cancellation checks)
+            const res = await this._lib.sane_fast_read_blocking();
+            const { status } = res;
+            if (status === SANEStatus.GOOD) {
+                data = res.data; // view over the read buffer
+            } else if (status === SANEStatus.EOF) {
+                await this._end(); // end of the image
+                return null;
             } else {
-                // 1-bit / 3 channels
-                // niche format, probably very few (if any) scanners support this
-                // according to the test backend the bits are inverted on this format, if compared
-                // with 1-bit gray (1 channel), it remains to be seen if this is correct in the wild
-                for (let l = 0, o = 0; l < lc; l++, ik += parameters.bytes_per_line) { // for lines
-                    for (let p = 0, i = ik; p < parameters.pixels_per_line; i += 3) { // for in bytes
-                        for (let mask = 0x80; mask !== 0 && p < parameters.pixels_per_line; mask >>= 1, p++, o += 4) { // for pixels
-                            // rbg is interlaced byte-by-byte not bit-by-bit
-                            // so 3 bytes have the R-G-B for 8 pixels
-                            dataOut[o] = dataIn[i] & mask ? 0xff : 0x00;
-                            dataOut[o + 1] = dataIn[i + 1] & mask ? 0xff : 0x00;
-                            dataOut[o + 2] = dataIn[i + 2] & mask ? 0xff : 0x00;
-                            dataOut[o + 3] = 0xff; // alpha
-                        }
-                    }
-                }
+                await this._end();
+                throw new Error(`Status ${SANEStatus[status]} during sane_read().`);
             }
         }
-        this._remainder = dataIn.subarray(ik);
-        this.fire('line', parameters, dataOut, this._line);
-        this._allData.set(dataOut, this._line * parameters.pixels_per_line * 4);
-        this._line += lc;
+        const n = Math.min(data.length, into ? into.length : size);
+        const chunk = into ? into.subarray(0, n) : new Uint8Array(n);
+        chunk.set(data.subarray(0, n));
+        if (n === data.length) {
+            this._rest = null;
+        } else {
+            this._rest = data === this._rest ? data.subarray(n) : data.slice(n);
+        }
+        return chunk;
     }
 
-    private _onStop(parameters: SANEParameters, error: Error | null) {
-        if (!error) {
-            this.fire('image', parameters, this._allData);
+    private async _end() {
+        if (!this._ended) {
+            this._ended = true;
+            this._rest = null;
+            await this._lib.sane_cancel(); // ignore status
+        }
+    }
+
+    private async _start() {
+        if (this._used) {
+            // streams are single use
+            throw new Error("Scan streams cannot be reused.");
+        }
+        const { status } = await this._lib.sane_start();
+        if (status !== SANEStatus.GOOD) {
+            return { status, parameters: null };
         }
+        this._used = true;
+
+        const { status: s, parameters } = await this._lib.sane_get_parameters();
+        if (s !== SANEStatus.GOOD) {
+            await this._end();
+            return { status: s, parameters: null };
+        }
+        return { status: s, parameters };
     }
 
+    /**
+     * Start scanning operation, returns a `ReadableStream` (byte stream)
+     * with the scan data.
+     */
+    async start(): Promise<{ status: SANEStatus; parameters: SANEParameters | null; stream: ReadableStream<Uint8Array> | null; }> {
+        const { status, parameters } = await this._start();
+        if (!parameters) {
+            return { status, parameters, stream: null };
+        }
+        const stream = new ReadableStream({
+            type: 'bytes',
+            autoAllocateChunkSize: this._chunkSize,
+            pull: async (controller) => {
+                // with autoAllocateChunkSize there is always a byobRequest
+                const request = controller.byobRequest!;
+                const view = request.view!;
+                const chunk = await this._next(new Uint8Array(view.buffer, view.byteOffset, view.byteLength), 0);
+                if (chunk) {
+                    request.respond(chunk.length);
+                } else {
+                    controller.close();
+                    request.respond(0);
+                }
+            },
+            cancel: () => this._end(),
+        });
+        return { status, parameters, stream };
+    }
+
+    /**
+     * Start scanning operation, returns a Node.js `Readable` with the scan
+     * data. Only available on Node.js.
+     */
+    async startNode(): Promise<{ status: SANEStatus; parameters: SANEParameters | null; stream: ScanNodeReadable | null; }> {
+        // not imported, so bundlers don't try to include it
+        const { Readable } = eval('require')('stream');
+        const { status, parameters } = await this._start();
+        if (!parameters) {
+            return { status, parameters, stream: null };
+        }
+        const stream = new Readable({
+            highWaterMark: this._chunkSize,
+            read: (size: number) => {
+                this._next(null, Math.min(size, this._chunkSize)).then(
+                    chunk => stream.push(chunk),
+                    e => stream.destroy(e),
+                );
+            },
+            destroy: (error: Error | null, callback: (error: Error | null) => void) => {
+                this._end().then(() => callback(error), callback);
+            },
+        });
+        return { status, parameters, stream };
+    }
 }
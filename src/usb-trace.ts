@@ -0,0 +1,553 @@
+// USB trace record/replay (WebUSB), see USBRecorder and USBReplay.
+
+/**
+ * The parts of the WebUSB `USB` object (`navigator.usb`) used by libusb,
+ * see {@link LibSANEOptions.usb}.
+ */
+export type USBLike = {
+    getDevices(): Promise<any[]>;
+    requestDevice(options: { filters: any[] }): Promise<any>;
+    addEventListener?(type: string, listener: (e: any) => void): void;
+    removeEventListener?(type: string, listener: (e: any) => void): void;
+};
+
+/**
+ * Device snapshot on a {@link USBTrace} (the WebUSB `USBDevice` properties).
+ */
+export type USBTraceDevice = {
+    vendorId: number;
+    productId: number;
+    deviceClass: number;
+    deviceSubclass: number;
+    deviceProtocol: number;
+    deviceVersionMajor: number;
+    deviceVersionMinor: number;
+    deviceVersionSubminor: number;
+    usbVersionMajor: number;
+    usbVersionMinor: number;
+    usbVersionSubminor: number;
+    manufacturerName: string | null;
+    productName: string | null;
+    serialNumber: string | null;
+    /**
+     * Value of the selected configuration.
+     */
+    configuration: number | null;
+    configurations: {
+        configurationValue: number;
+        configurationName: string | null;
+        interfaces: {
+            interfaceNumber: number;
+            alternates: {
+                alternateSetting: number;
+                interfaceClass: number;
+                interfaceSubclass: number;
+                interfaceProtocol: number;
+                interfaceName: string | null;
+                endpoints: { endpointNumber: number; direction: string; type: string; packetSize: number; }[];
+            }[];
+        }[];
+    }[];
+};
+
+/**
+ * A call on a {@link USBTrace}: start time and duration (ms), device index,
+ * `USBDevice` method, arguments and result. Binary data (e.g. transfer
+ * data) is `{ $b64: string }` (base64), a failed call has `{ $error: {
+ * name, message } }` as result. Calls that never completed (e.g. pending
+ * transfers when the device was closed) have no result.
+ */
+export type USBTraceCall = [t: number, d: number, device: number, method: string, args: any[], result?: any];
+
+/**
+ * USB trace, from {@link USBRecorder.trace}, serializable as JSON.
+ */
+export type USBTrace = {
+    format: 'sane-wasm-usb-trace';
+    version: 1;
+    /**
+     * Free-form information about the trace (e.g. the scan options).
+     */
+    meta: Record<string, any>;
+    devices: USBTraceDevice[];
+    calls: USBTraceCall[];
+};
+
+// USBDevice methods that go to the device (recorded and replayed)
+const usbMethods = [
+    'open',
+    'close',
+    'forget',
+    'reset',
+    'selectConfiguration',
+    'claimInterface',
+    'releaseInterface',
+    'selectAlternateInterface',
+    'clearHalt',
+    'controlTransferIn',
+    'controlTransferOut',
+    'transferIn',
+    'transferOut',
+    'isochronousTransferIn',
+    'isochronousTransferOut',
+];
+
+const now = () => performance.now();
+const round = (ms: number) => Math.round(ms * 1000) / 1000;
+
+function toBase64(bytes: Uint8Array) {
+    let s = '';
+    for (let i = 0; i < bytes.length; i += 0x8000) {
+        s += String.fromCharCode.apply(null, bytes.subarray(i, i + 0x8000) as any);
+    }
+    return btoa(s);
+}
+
+function fromBase64(b64: string) {
+    const s = atob(b64);
+    const bytes = new Uint8Array(s.length);
+    for (let i = 0; i < s.length; i++) {
+        bytes[i] = s.charCodeAt(i);
+    }
+    return bytes;
+}
+
+// Plain JSON values from the WebUSB arguments and results, the WebUSB
+// objects have their properties on the prototype (for...in sees them).
+function serialize(value: any): any {
+    if (value instanceof ArrayBuffer) {
+        return { $b64: toBase64(new Uint8Array(value)) };
+    }
+    if (ArrayBuffer.isView(value)) {
+        return { $b64: toBase64(new Uint8Array(value.buffer, value.byteOffset, value.byteLength)) };
+    }
+    if (Array.isArray(value)) {
+        return value.map(serialize);
+    }
+    if (value && typeof value === 'object') {
+        const obj: Record<string, any> = {};
+        for (const k in value) {
+            if (typeof value[k] !== 'function') {
+                obj[k] = serialize(value[k]);
+            }
+        }
+        return obj;
+    }
+    return value;
+}
+
+// WebUSB results from the serialized results (data as DataView)
+function deserialize(value: any): any {
+    if (Array.isArray(value)) {
+        return value.map(deserialize);
+    }
+    if (value && typeof value === 'object') {
+        if (typeof value.$b64 === 'string') {
+            const bytes = fromBase64(value.$b64);
+            return new DataView(bytes.buffer);
+        }
+        const obj: Record<string, any> = {};
+        for (const k in value) {
+            obj[k] = deserialize(value[k]);
+        }
+        return obj;
+    }
+    return value;
+}
+
+function usbError(name: string, message: string) {
+    if (typeof DOMException === 'function') {
+        return new DOMException(message, name);
+    }
+    const e = new Error(message);
+    e.name = name;
+    return e;
+}
+
+function snapshotDevice(device: any): USBTraceDevice {
+    const nullable = (v: any) => v ?? null;
+    return {
+        vendorId: device.vendorId,
+        productId: device.productId,
+        deviceClass: device.deviceClass,
+        deviceSubclass: device.deviceSubclass,
+        deviceProtocol: device.deviceProtocol,
+        deviceVersionMajor: device.deviceVersionMajor,
+        deviceVersionMinor: device.deviceVersionMinor,
+        deviceVersionSubminor: device.deviceVersionSubminor,
+        usbVersionMajor: device.usbVersionMajor,
+        usbVersionMinor: device.usbVersionMinor,
+        usbVersionSubminor: device.usbVersionSubminor,
+        manufacturerName: nullable(device.manufacturerName),
+        productName: nullable(device.productName),
+        serialNumber: nullable(device.serialNumber),
+        configuration: device.configuration ? device.configuration.configurationValue : null,
+        configurations: Array.from(device.configurations || [], (c: any) => ({
+            configurationValue: c.configurationValue,
+            configurationName: nullable(c.configurationName),
+            interfaces: Array.from(c.interfaces || [], (i: any) => ({
+                interfaceNumber: i.interfaceNumber,
+                alternates: Array.from(i.alternates || [], (a: any) => ({
+                    alternateSetting: a.alternateSetting,
+                    interfaceClass: a.interfaceClass,
+                    interfaceSubclass: a.interfaceSubclass,
+                    interfaceProtocol: a.interfaceProtocol,
+                    interfaceName: nullable(a.interfaceName),
+                    endpoints: Array.from(a.endpoints || [], (e: any) => ({
+                        endpointNumber: e.endpointNumber,
+                        direction: e.direction,
+                        type: e.type,
+                        packetSize: e.packetSize,
+                    })),
+                })),
+            })),
+        })),
+    };
+}
+
+/**
+ * Records the WebUSB calls made by libusb (the backends) on the real
+ * devices, use it as {@link LibSANEOptions.usb} and save
+ * {@link USBRecorder.trace} (e.g. as JSON) after scanning. The trace can be
+ * served back by {@link USBReplay} without the device, to benchmark and
+ * test the backend and the full data path (see `bench/usb-record.js` and
+ * `bench/usb-replay.js`).
+ *
+ * Traces include all the data sent and received (e.g. the scanned image
+ * and the device serial number).
+ *
+ * This is provided by sane-wasm, it's not part of SANE API.
+ *
+ * @example
+ * ```
+ * const recorder = new USBRecorder(require('usb').webusb);
+ * const lib = await libsane({ sane: { usb: recorder } });
+ * // ... scan ...
+ * fs.writeFileSync('scan.trace.json', JSON.stringify(recorder.trace({ device: 'pixma:...' })));
+ * ```
+ */
+export class USBRecorder implements USBLike {
+
+    private _usb: USBLike;
+    private _t0 = now();
+    private _devices: USBTraceDevice[] = [];
+    private _calls: USBTraceCall[] = [];
+    private _wrapped = new Map<any, any>();
+
+    /**
+     * @param usb The real USB API, `navigator.usb` by default.
+     */
+    constructor(usb?: USBLike) {
+        this._usb = usb ?? (globalThis as any).navigator?.usb;
+        if (!this._usb) {
+            throw new Error("No USB API (navigator.usb) to record.");
+        }
+    }
+
+    private _wrap(device: any) {
+        let wrapped = this._wrapped.get(device);
+        if (!wrapped) {
+            const index = this._devices.length;
+            this._devices.push(snapshotDevice(device));
+            // the getters of the WebUSB objects need the real object as this
+            wrapped = new Proxy(device, {
+                get: (target, prop) => {
+                    const value = Reflect.get(target, prop, target);
+                    if (typeof value !== 'function') {
+                        return value;
+                    }
+                    if (usbMethods.includes(prop as string)) {
+                        return (...args: any[]) => this._record(index, prop as string, value.apply(target, args), args);
+                    }
+                    return value.bind(target);
+                },
+            });
+            this._wrapped.set(device, wrapped);
+        }
+        return wrapped;
+    }
+
+    private async _record(device: number, method: string, promise: Promise<any>, args: any[]) {
+        // added on start (calls are replayed in this order), completed later
+        const t = now();
+        const call: USBTraceCall = [round(t - this._t0), 0, device, method, serialize(args)];
+        this._calls.push(call);
+        try {
+            const result = await promise;
+            call[1] = round(now() - t);
+            call[5] = serialize(result) ?? null;
+            return result;
+        } catch (e: any) {
+            call[1] = round(now() - t);
+            call[5] = { $error: { name: e?.name ?? 'Error', message: e?.message ?? String(e) } };
+            throw e;
+        }
+    }
+
+    async getDevices() {
+        return (await this._usb.getDevices()).map(d => this._wrap(d));
+    }
+
+    async requestDevice(options: { filters: any[] }) {
+        return this._wrap(await this._usb.requestDevice(options));
+    }
+
+    addEventListener(type: string, listener: (e: any) => void) {
+        this._usb.addEventListener?.(type, listener);
+    }
+
+    removeEventListener(type: string, listener: (e: any) => void) {
+        this._usb.removeEventListener?.(type, listener);
+    }
+
+    /**
+     * The recorded trace (a copy, recording continues).
+     */
+    trace(meta: Record<string, any> = {}): USBTrace {
+        return JSON.parse(JSON.stringify({
+            format: 'sane-wasm-usb-trace',
+            version: 1,
+            meta,
+            devices: this._devices,
+            calls: this._calls,
+        }));
+    }
+
+}
+
+/**
+ * Options for {@link USBReplay}.
+ */
+export type USBReplayOptions = {
+    /**
+     * Replay speed, the recorded duration of each call is divided by it.
+     * Use `Infinity` to answer right away. The time between calls is not
+     * replayed (it's the host's time, what is being measured).
+     *
+     * @defaultvalue `1`
+     */
+    speed?: number;
+    /**
+     * Require the data sent to the device (e.g. `transferOut`) to match the
+     * recorded data. Without it, only the method and the other arguments
+     * (endpoint, setup, length) must match.
+     *
+     * @defaultvalue `true`
+     */
+    strict?: boolean;
+};
+
+type ReplayCall = {
+    call: USBTraceCall;
+    key: string;
+    used: boolean;
+};
+
+// call key for matching, without the sent data when not strict
+function callKey(method: string, args: any[], strict: boolean) {
+    return method + JSON.stringify(args, (k, v) => (!strict && v && typeof v === 'object' && '$b64' in v) ? null : v);
+}
+
+class USBReplayDevice {
+
+    private _replay: USBReplay;
+    private _index: number;
+    private _configuration: number | null;
+    private _interfaces = new Map<number, { claimed: boolean; alternate: any }>();
+    opened = false;
+
+    constructor(replay: USBReplay, index: number, snapshot: USBTraceDevice) {
+        const { configuration, ...properties } = snapshot;
+        Object.assign(this, properties);
+        this._replay = replay;
+        this._index = index;
+        this._configuration = configuration;
+    }
+
+    get configuration() {
+        const configurations: any[] = (this as any).configurations;
+        const c = configurations.find(c => c.configurationValue === this._configuration);
+        if (!c) {
+            return null;
+        }
+        return {
+            ...c,
+            interfaces: c.interfaces.map((i: any) => {
+                const state = this._interfaces.get(i.interfaceNumber);
+                return { ...i, claimed: state?.claimed ?? false, alternate: state?.alternate ?? i.alternates[0] };
+            }),
+        };
+    }
+
+    private _interface(n: number) {
+        let state = this._interfaces.get(n);
+        if (!state) {
+            const i = this.configuration?.interfaces.find((i: any) => i.interfaceNumber === n);
+            state = { claimed: false, alternate: i?.alternates[0] };
+            this._interfaces.set(n, state);
+        }
+        return state;
+    }
+
+    /**
+     * @private
+     */
+    _update(method: string, args: any[]) {
+        switch (method) {
+            case 'open':
+                this.opened = true;
+                break;
+            case 'close':
+                this.opened = false;
+                this._interfaces.clear();
+                break;
+            case 'selectConfiguration':
+                this._configuration = args[0];
+                this._interfaces.clear();
+                break;
+            case 'claimInterface':
+                this._interface(args[0]).claimed = true;
+                break;
+            case 'releaseInterface':
+                this._interface(args[0]).claimed = false;
+                break;
+            case 'selectAlternateInterface': {
+                const state = this._interface(args[0]);
+                const i = this.configuration?.interfaces.find((i: any) => i.interfaceNumber === args[0]);
+                state.alternate = i?.alternates.find((a: any) => a.alternateSetting === args[1]) ?? state.alternate;
+                break;
+            }
+        }
+    }
+
+    /**
+     * @private
+     */
+    _call(method: string, args: any[]) {
+        return this._replay._call(this, this._index, method, args);
+    }
+
+}
+
+for (const method of usbMethods) {
+    (USBReplayDevice.prototype as any)[method] = function (this: USBReplayDevice, ...args: any[]) {
+        return this._call(method, args);
+    };
+}
+
+/**
+ * Stand-in for the WebUSB `USB` object (`navigator.usb`) that serves the
+ * calls of a trace from {@link USBRecorder}, use it as
+ * {@link LibSANEOptions.usb}. Each call is matched with the next recorded
+ * call of the same device, method and arguments and answered with the
+ * recorded result after the recorded duration (see
+ * {@link USBReplayOptions.speed}). Calls that don't match fail (a USB
+ * error for the backend), see {@link USBReplay.mismatches}.
+ *
+ * The backend must do the same work as when recording (same SANE calls and
+ * options).
+ *
+ * This is provided by sane-wasm, it's not part of SANE API.
+ *
+ * @example
+ * ```
+ * const replay = new USBReplay(JSON.parse(fs.readFileSync('scan.trace.json', 'utf8')), { speed: Infinity });
+ * const lib = await libsane({ sane: { usb: replay } });
+ * // ... same scan ...
+ * ```
+ */
+export class USBReplay implements USBLike {
+
+    private _speed: number;
+    private _strict: boolean;
+    private _devices: USBReplayDevice[];
+    private _queues: ReplayCall[][];
+    private _cursors: number[];
+    private _delay = 0;
+
+    /**
+     * Calls that didn't match the trace (method and serialized arguments).
+     */
+    readonly mismatches: { device: number; method: string; args: any[]; }[] = [];
+
+    constructor(trace: USBTrace, options: USBReplayOptions = {}) {
+        if (trace.format !== 'sane-wasm-usb-trace' || trace.version !== 1) {
+            throw new Error("Invalid USB trace.");
+        }
+        this._speed = options.speed ?? 1;
+        this._strict = options.strict ?? true;
+        this._devices = trace.devices.map((d, i) => new USBReplayDevice(this, i, d));
+        this._queues = trace.devices.map(() => []);
+        this._cursors = trace.devices.map(() => 0);
+        for (const call of trace.calls) {
+            this._queues[call[2]].push({ call, key: callKey(call[3], call[4], this._strict), used: false });
+        }
+    }
+
+    /**
+     * @private
+     */
+    async _call(device: USBReplayDevice, index: number, method: string, args: any[]) {
+        const serialized = serialize(args);
+        const key = callKey(method, serialized, this._strict);
+        const queue = this._queues[index];
+        let i = this._cursors[index];
+        while (i < queue.length && (queue[i].used || queue[i].key !== key)) {
+            i++;
+        }
+        if (i === queue.length) {
+            this.mismatches.push({ device: index, method, args: serialized });
+            throw usbError('NetworkError', `USB replay: unexpected call ${method}(${JSON.stringify(serialized).slice(1, -1)}) on device ${index}.`);
+        }
+        const entry = queue[i];
+        entry.used = true;
+        while (this._cursors[index] < queue.length && queue[this._cursors[index]].used) {
+            this._cursors[index]++;
+        }
+        const [, d, , , , result] = entry.call;
+        if (entry.call.length < 6) {
+            return new Promise(() => { }); // never completed
+        }
+        if (d > 0 && this._speed !== Infinity) {
+            // timers don't go below ~1ms, short calls add up before waiting
+            this._delay += d / this._speed;
+            if (this._delay >= 1) {
+                const ms = this._delay;
+                this._delay = 0;
+                await new Promise(resolve => setTimeout(resolve, ms));
+            }
+        }
+        if (result && typeof result === 'object' && '$error' in result) {
+            throw usbError(result.$error.name, result.$error.message);
+        }
+        device._update(method, args);
+        return deserialize(result) ?? undefined;
+    }
+
+    /**
+     * Number of recorded calls not replayed yet.
+     */
+    get remaining() {
+        return this._queues.reduce((n, queue) => n + queue.filter(c => !c.used).length, 0);
+    }
+
+    async getDevices() {
+        return [...this._devices];
+    }
+
+    async requestDevice(options: { filters: any[] }) {
+        const device = this._devices.find(d => options.filters.length === 0 || options.filters.some(f => Object.keys(f).every(k => (d as any)[k] === f[k])));
+        if (!device) {
+            throw usbError('NotFoundError', "No device selected.");
+        }
+        return device;
+    }
+
+    addEventListener() {
+        // no hotplug on replays
+    }
+
+    removeEventListener() {
+    }
+
+}
@@ -0,0 +1,119 @@
+import { bindHandle, libsane, LibSANE, ScanBatchReader, ScanDataReader, ScanEncodedReader, ScanImageReader } from ".";
+
+// Worker side of libsaneWorker() (see worker.ts), this is the worker entry
+// point (web worker or Node.js worker_threads). Loads LibSANE here and runs
+// the calls and the scan readers for the main thread.
+
+const isWeb = typeof (globalThis as any).importScripts === 'function';
+const parentPort = isWeb ? null : eval('require')('worker_threads').parentPort;
+
+function post(message: any, transfer: Transferable[] = []) {
+    if (parentPort) {
+        parentPort.postMessage(message, transfer);
+    } else {
+        (globalThis as any).postMessage(message, transfer);
+    }
+}
+
+const readerClasses: Record<string, new (lib: LibSANE, options: any) => any> = {
+    data: ScanDataReader,
+    image: ScanImageReader,
+    encoded: ScanEncodedReader,
+    batch: ScanBatchReader,
+};
+
+// events that hand over their data, the reader doesn't use it anymore
+const ownedEvents = ['image', 'file'];
+
+// Typed arrays cross as transferred buffers, never cloned. Views over the
+// module memory or over part of a buffer are copied first (one copy), the
+// buffers of owned arrays (e.g. the full image) are transferred as is.
+function transferable(value: any, transfer: Transferable[], owned = false): any {
+    if (ArrayBuffer.isView(value)) {
+        let v = value as Uint8Array;
+        if (!owned || !(v.buffer instanceof ArrayBuffer) || v.byteOffset || v.byteLength !== v.buffer.byteLength) {
+            v = v.slice();
+        }
+        transfer.push(v.buffer);
+        return v;
+    }
+    if (value instanceof Error) {
+        return { $error: value.message };
+    }
+    if (value && typeof value === 'object' && Object.getPrototypeOf(value) === Object.prototype) {
+        const obj: Record<string, any> = {};
+        for (const k in value) {
+            obj[k] = transferable(value[k], transfer);
+        }
+        return obj;
+    }
+    return value;
+}
+
+let lib: LibSANE | null = null;
+const readers = new Map<number, any>();
+
+async function handle(message: any) {
+    switch (message.type) {
+        case 'init': {
+            lib = await libsane(message.options);
+            const constants: Record<string, any> = {};
+            const functions: string[] = [];
+            for (const [name, value] of Object.entries(lib)) {
+                if (typeof value === 'function') {
+                    if (name.startsWith('sane_') && !/^sane_(handle_)?fast_/.test(name)) {
+                        functions.push(name);
+                    }
+                } else if (name.startsWith('SANE_')) {
+                    constants[name] = value;
+                }
+            }
+            return { constants, functions };
+        }
+        case 'call':
+            return await (lib as any)[message.name](...message.args);
+        case 'reader_start': {
+            const id = message.reader;
+            const { status, parameters, promise } = await readers.get(id).start();
+            promise.then(
+                (value: any) => post({ type: 'reader_done', id, value }),
+                (e: any) => post({ type: 'reader_done', id, error: e instanceof Error ? e.message : "Unknown error while scanning." }),
+            ).finally(() => readers.delete(id));
+            return { status, parameters };
+        }
+    }
+}
+
+function onMessage(message: any) {
+    switch (message.type) {
+        case 'reader': {
+            const target = message.handle !== null ? bindHandle(lib!, message.handle) : lib!;
+            readers.set(message.id, new readerClasses[message.kind](target, message.options));
+            return;
+        }
+        case 'reader_on': {
+            const { id, event } = message;
+            readers.get(id)?.on(event, (...args: any[]) => {
+                const transfer: Transferable[] = [];
+                args = args.map(arg => transferable(arg, transfer, ownedEvents.includes(event)));
+                post({ type: 'reader_event', id, event, args }, transfer);
+            });
+            return;
+        }
+        case 'reader_cancel':
+            readers.get(message.id)?.cancel();
+            return;
+    }
+    handle(message).then(value => {
+        const transfer: Transferable[] = [];
+        post({ type: 'result', id: message.id, value: transferable(value, transfer) }, transfer);
+    }, e => {
+        post({ type: 'error', id: message.id, message: e instanceof Error ? e.message : String(e) });
+    });
+}
+
+if (parentPort) {
+    parentPort.on('message', onMessage);
+} else {
+    (globalThis as any).addEventListener('message', (e: MessageEvent) => onMessage(e.data));
+}
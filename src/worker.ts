@@ -0,0 +1,237 @@
+import { LibSANE, LibSANEOptions, SANEParameters, SANEStatus } from ".";
+import { ScanBatchReaderEventMap, ScanDataReaderEventMap, ScanDataReaderOptions, ScanEncodedReaderEventMap, ScanEncodedReaderOptions, ScanImageReaderEventMap, ScanImageReaderOptions } from "./readers";
+
+/**
+ * A web `Worker` or a Node.js `Worker` (worker_threads) running
+ * `sane-wasm/dist/worker-host.js`, see {@link libsaneWorker}.
+ */
+export type LibSANEWorkerLike = {
+    postMessage(message: any): void;
+    terminate(): unknown;
+} & ({
+    addEventListener(type: 'message', listener: (e: { data: any }) => void): void;
+} | {
+    on(type: 'message', listener: (data: any) => void): unknown;
+});
+
+/**
+ * Scan readers available with {@link LibSANEWorker.createReader}: options,
+ * events and result of the scan promise of each reader.
+ */
+export interface LibSANEWorkerReaders {
+    data: [options: ScanDataReaderOptions, events: ScanDataReaderEventMap, result: void];
+    image: [options: Omit<ScanImageReaderOptions, 'sink'>, events: ScanImageReaderEventMap, result: void];
+    encoded: [options: ScanEncodedReaderOptions, events: ScanEncodedReaderEventMap, result: void];
+    batch: [options: {}, events: ScanBatchReaderEventMap, result: number];
+}
+
+type Promisified<F> = F extends (...args: infer A) => infer R ? (...args: A) => Promise<Awaited<R>> : never;
+
+/**
+ * LibSANE running on a worker, see {@link libsaneWorker}. Same functions as
+ * {@link LibSANE}, but all of them return promises. The fast functions
+ * (`sane_fast_*`) are not available, they are used by the readers on the
+ * worker.
+ */
+export type LibSANEWorker = {
+    [K in keyof LibSANE as K extends `sane_${'fast' | 'handle_fast'}_${string}` ? never : K extends `sane_${string}` ? K : never]: Promisified<LibSANE[K]>;
+} & Pick<LibSANE,
+    'SANE_WASM_COMMIT' | 'SANE_WASM_VERSION' | 'SANE_WASM_BACKENDS' |
+    'SANE_CURRENT_MAJOR' | 'SANE_CURRENT_MINOR' |
+    'SANE_STATUS' | 'SANE_TYPE' | 'SANE_UNIT' | 'SANE_CONSTRAINT' |
+    'SANE_FRAME' | 'SANE_IMAGE_LAYOUT' | 'SANE_IMAGE_FORMAT'
+> & {
+    /**
+     * Create a scan reader on the worker (e.g. `'image'` for
+     * {@link ScanImageReader}), optionally on a handle from
+     * {@link LibSANE.sane_handle_open}.
+     */
+    createReader<K extends keyof LibSANEWorkerReaders>(kind: K, options?: LibSANEWorkerReaders[K][0], handle?: number | null): WorkerScanReader<LibSANEWorkerReaders[K][1], LibSANEWorkerReaders[K][2]>;
+    /**
+     * Terminate the worker.
+     */
+    terminate(): void;
+}
+
+type Pending = { resolve: (value: any) => void; reject: (error: Error) => void; };
+
+class WorkerClient {
+    private _worker: LibSANEWorkerLike;
+    private _nextId = 1;
+    private _calls = new Map<number, Pending>();
+    private _readers = new Map<number, WorkerScanReader<any, any>>();
+
+    constructor(worker: LibSANEWorkerLike) {
+        this._worker = worker;
+        if ('addEventListener' in worker) {
+            worker.addEventListener('message', (e) => this._onMessage(e.data));
+        } else {
+            worker.on('message', (data) => this._onMessage(data));
+        }
+    }
+
+    private _onMessage(message: any) {
+        if (message.type === 'result' || message.type === 'error') {
+            const call = this._calls.get(message.id);
+            this._calls.delete(message.id);
+            if (message.type === 'result') {
+                call?.resolve(message.value);
+            } else {
+                call?.reject(new Error(message.message));
+            }
+        } else if (message.type === 'reader_event' || message.type === 'reader_done') {
+            this._readers.get(message.id)?._onMessage(message);
+            if (message.type === 'reader_done') {
+                this._readers.delete(message.id);
+            }
+        }
+    }
+
+    nextId() {
+        return this._nextId++;
+    }
+
+    post(message: any) {
+        this._worker.postMessage(message);
+    }
+
+    call(type: string, message: any) {
+        const id = this.nextId();
+        return new Promise<any>((resolve, reject) => {
+            this._calls.set(id, { resolve, reject });
+            this.post({ ...message, type, id });
+        });
+    }
+
+    addReader(id: number, reader: WorkerScanReader<any, any>) {
+        this._readers.set(id, reader);
+    }
+
+    terminate() {
+        this._worker.terminate();
+        const error = new Error("Worker terminated.");
+        this._calls.forEach(call => call.reject(error));
+        this._calls.clear();
+        this._readers.forEach(reader => reader._onMessage({ type: 'reader_done', error: error.message }));
+        this._readers.clear();
+    }
+}
+
+// errors don't cross as is (see worker-host.ts)
+function fromWorker(value: any) {
+    return value && typeof value === 'object' && '$error' in value ? new Error(value.$error) : value;
+}
+
+/**
+ * Scan reader running on the worker, see {@link LibSANEWorker.createReader}.
+ * Same API as the local readers (e.g. {@link ScanImageReader}), the event
+ * data is transferred from the worker and owned by the listeners (no need
+ * to copy it).
+ */
+export class WorkerScanReader<T extends Record<keyof T, any[]>, R = void> {
+    private _client: WorkerClient;
+    private _id: number;
+    private _listeners: {
+        [K in keyof T]?: ((...args: T[K]) => void)[];
+    } = {};
+    private _done: Pending | null = null;
+
+    /**
+     * @private Use {@link LibSANEWorker.createReader}.
+     */
+    constructor(client: WorkerClient, kind: string, options: any, handle: number | null) {
+        this._client = client;
+        this._id = client.nextId();
+        client.addReader(this._id, this);
+        client.post({ type: 'reader', id: this._id, kind, options, handle });
+    }
+
+    /**
+     * @private
+     */
+    _onMessage(message: any) {
+        if (message.type === 'reader_event') {
+            const args = message.args.map(fromWorker);
+            this._listeners[message.event as keyof T]?.forEach(fn => fn.apply(this, args));
+        } else if (message.error !== undefined) {
+            this._done?.reject(new Error(message.error));
+        } else {
+            this._done?.resolve(message.value);
+        }
+    }
+
+    /**
+     * Add event listener. Only the events with listeners cross from the
+     * worker, add them before {@link WorkerScanReader.start}.
+     */
+    on<K extends keyof T>(type: K, listener: (...args: T[K]) => void) {
+        if (!this._listeners[type]) {
+            this._listeners[type] = [];
+            this._client.post({ type: 'reader_on', id: this._id, event: type });
+        }
+        this._listeners[type]?.push(listener);
+    }
+
+    /**
+     * Start scanning operation.
+     */
+    async start(): Promise<{ status: SANEStatus; parameters: SANEParameters | null; promise: Promise<R>; }> {
+        const promise = new Promise<R>((resolve, reject) => {
+            this._done = { resolve, reject };
+        });
+        const { status, parameters } = await this._client.call('reader_start', { reader: this._id });
+        return { status, parameters, promise };
+    }
+
+    /**
+     * Cancel scanning operation.
+     */
+    cancel() {
+        this._client.post({ type: 'reader_cancel', id: this._id });
+    }
+}
+
+/**
+ * Load LibSANE on a worker, the SANE calls, the scan readers and their
+ * data processing (e.g. image conversion) run there, away from the main
+ * thread (UI). Returns a proxy with the same functions (all asynchronous)
+ * and {@link LibSANEWorker.createReader} to run the scan readers. Scan
+ * data crosses back as transferred buffers (not copied again).
+ *
+ * On web environments, create the worker with
+ * `sane-wasm/dist/worker-host.js` (e.g. with webpack
+ * `new Worker(new URL('sane-wasm/dist/worker-host.js', import.meta.url))`),
+ * it uses the loader. WebUSB devices must be requested on the page
+ * (`navigator.usb.requestDevice()`), the worker sees the allowed devices.
+ * On Node.js, a worker thread is created if not given.
+ *
+ * Only cloneable options can be used (no functions, e.g. `locateFile`).
+ *
+ * This is provided by sane-wasm, it's not part of SANE API.
+ */
+export async function libsaneWorker(options: { sane?: LibSANEOptions, [k: string]: any } = {}, worker?: LibSANEWorkerLike): Promise<LibSANEWorker> {
+    if (!worker) {
+        if (!(globalThis as any).process?.versions?.node) {
+            throw new Error("A worker is required on web environments.");
+        }
+        // not imported, so bundlers don't try to include it
+        const req = eval('require');
+        const { Worker } = req('worker_threads');
+        worker = new Worker(req.resolve('./worker-host')) as LibSANEWorkerLike;
+    }
+    const client = new WorkerClient(worker);
+    let ready: { constants: Record<string, any>, functions: string[] };
+    try {
+        ready = await client.call('init', { options });
+    } catch (e) {
+        client.terminate();
+        throw e;
+    }
+    const lib: any = { ...ready.constants };
+    for (const name of ready.functions) {
+        lib[name] = (...args: any[]) => client.call('call', { name, args });
+    }
+    lib.createReader = (kind: string, options: any = {}, handle: number | null = null) => new WorkerScanReader(client, kind, options, handle);
+    lib.terminate = () => client.terminate();
+    return lib as LibSANEWorker;
+}
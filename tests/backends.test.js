@@ -0,0 +1,44 @@
+// const { webusb } = require('usb');
+const { libsane } = require('..');
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 2,
+        backends: ['test'],
+    },
+});
+
+test('sane_init (unknown backend)', async () => {
+    const l = await lib;
+    l.sane.backends = ['test', 'nope'];
+    expect(await l.sane_init()).toEqual({ status: l.SANE_STATUS.INVAL, version_code: null });
+    l.sane.backends = ['test'];
+});
+
+test('sane_init (selected backends)', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_get_state()).toMatchObject({ initialized: true, backends: ['test'] });
+});
+
+test('sane_get_devices (selected backends)', async () => {
+    const l = await lib;
+    const res = await l.sane_get_devices();
+    expect(res).toMatchObject({ status: l.SANE_STATUS.GOOD, devices: expect.toBeArrayOfSize(2) });
+    res.devices.forEach(d => expect(d.name).toStartWith('test:'));
+});
+
+test('sane_open (selected backends)', async () => {
+    const l = await lib;
+    expect(await l.sane_open('nope:0')).toEqual({ status: l.SANE_STATUS.INVAL });
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('sane_exit (selected backends)', async () => {
+    const l = await lib;
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_get_state()).toMatchObject({ initialized: false, backends: null });
+});
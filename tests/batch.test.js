@@ -0,0 +1,78 @@
+// const { webusb } = require('usb');
+const { libsane, ScanBatchReader } = require('..');
+
+const lib = libsane({ sane: { debugTestDevices: 1 } });
+
+test('sane_open (feeder)', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    await l.sane_get_devices();
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+    // small pages, the test backend's feeder holds a few of them
+    const res = await l.sane_control_options_apply({
+        source: 'Automatic Document Feeder',
+        resolution: 50,
+        'br-x': 20,
+        'br-y': 20,
+    });
+    expect(res).toMatchObject({ status: l.SANE_STATUS.GOOD, values: { source: 'Automatic Document Feeder' } });
+});
+
+test('sane_read_stream_start_batch', async () => {
+    const l = await lib;
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_read_stream_start_batch()).toEqual({ status: l.SANE_STATUS.GOOD });
+    // first page, then EOF (page end) and the next page start (parameters)
+    let res;
+    let bytes = 0;
+    for (;;) {
+        res = await l.sane_read_stream_next();
+        if (res.status !== l.SANE_STATUS.GOOD || !res.data) {
+            break;
+        }
+        bytes += res.data.length;
+        expect(l.sane_read_stream_release(res.slot)).toEqual({ status: l.SANE_STATUS.GOOD });
+    }
+    expect(res.status).toBe(l.SANE_STATUS.EOF);
+    expect(bytes).toBeGreaterThan(0);
+    res = await l.sane_read_stream_next();
+    expect(res).toMatchObject({ status: l.SANE_STATUS.GOOD, data: null, parameters: expect.toBeObject() });
+    // the second page is not read, cancel also stops the stream
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_read_stream_stats()).toMatchObject({ active: false, slots: 0 });
+});
+
+test('ScanBatchReader (until NO_DOCS)', async () => {
+    const l = await lib;
+    const reader = new ScanBatchReader(l);
+    const events = [];
+    const bytes = [];
+    reader.on('pageStart', (parameters, page) => {
+        events.push(['pageStart', page]);
+        bytes[page] = 0;
+    });
+    reader.on('data', (parameters, data, page) => {
+        bytes[page] += data.length;
+    });
+    reader.on('pageEnd', (parameters, page) => {
+        events.push(['pageEnd', page]);
+        expect(bytes[page]).toBe(parameters.bytes_per_line * parameters.lines);
+    });
+    let stop = null;
+    reader.on('stop', (pages, error) => {
+        stop = { pages, error };
+    });
+    const { status, promise } = await reader.start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    // the empty feeder (NO_DOCS) ends the batch, it's not an error
+    const pages = await promise;
+    expect(pages).toBeGreaterThan(0);
+    expect(stop).toEqual({ pages, error: null });
+    expect(events).toEqual([...Array(pages).keys()].flatMap(page => [['pageStart', page], ['pageEnd', page]]));
+});
+
+test('sane_close', async () => {
+    const l = await lib;
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
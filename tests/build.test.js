@@ -9,7 +9,8 @@ test('version', async () => {
     // test commit hash
     expect(l.SANE_WASM_COMMIT).toBe(execSync('git rev-parse HEAD', { encoding: 'utf8' }).trim());
     // test version, expect clean builds, don't include '--dirty'
-    expect(l.SANE_WASM_VERSION).toBe(execSync('git describe --tags --always', { encoding: 'utf8' }).trim());
+    // the release build (loaded when available) adds '-simd'
+    expect(l.SANE_WASM_VERSION.replace(/-simd$/, '')).toBe(execSync('git describe --tags --always', { encoding: 'utf8' }).trim());
     // test 'package.json' version
     expect(l.SANE_WASM_VERSION.split('-')[0]).toStartWith(`v${require('../package.json').version}`);
 });
@@ -0,0 +1,49 @@
+// const { webusb } = require('usb');
+const { libsane } = require('..');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const file = path.join(os.tmpdir(), `sane-wasm-devices-${process.pid}.json`);
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 2,
+        discoveryCache: true,
+        discoveryCacheFile: file,
+    },
+});
+
+afterAll(() => {
+    fs.rmSync(file, { force: true });
+});
+
+test('sane_get_devices (cached)', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    const res1 = await l.sane_get_devices();
+    expect(res1).toMatchObject({ status: l.SANE_STATUS.GOOD, devices: expect.toBeArrayOfSize(2) });
+    expect(res1.cached).toBeUndefined();
+    res1.devices.forEach(d => expect(d.name).toStartWith('test:'));
+    expect(await l.sane_discovery_cache_wait()).toBeNull();
+    // same usb devices, only the test backend is probed, then a full
+    // discovery in the background replaces the cached list
+    const res2 = await l.sane_get_devices();
+    expect(res2).toEqual({ ...res1, cached: true });
+    expect(await l.sane_discovery_cache_wait()).toEqual(res1);
+    expect(Object.values(JSON.parse(fs.readFileSync(file, 'utf8')))[0].devices).toEqual(res1.devices);
+});
+
+test('sane_discovery_probe', async () => {
+    const l = await lib;
+    expect(l.sane_get_state().backends).toContain('test');
+    expect(await l.sane_discovery_probe(['test'], [])).toMatchObject({ status: l.SANE_STATUS.GOOD, devices: expect.toBeArrayOfSize(2) });
+    expect(await l.sane_discovery_probe([], [])).toEqual({ status: l.SANE_STATUS.GOOD, devices: [] });
+});
+
+test('sane_discovery_cache_clear', async () => {
+    const l = await lib;
+    await l.sane_discovery_cache_clear();
+    expect((await l.sane_get_devices()).cached).toBeUndefined();
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
@@ -9,6 +9,8 @@ const tsEnumsToSane = {
     SANEUnit: 'SANE_UNIT',
     SANEConstraintType: 'SANE_CONSTRAINT',
     SANEFrame: 'SANE_FRAME',
+    SANEImageLayout: 'SANE_IMAGE_LAYOUT',
+    SANEImageFormat: 'SANE_IMAGE_FORMAT',
 };
 
 test('ts enums match sane enums', async () => {
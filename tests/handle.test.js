@@ -0,0 +1,135 @@
+// const { webusb } = require('usb');
+const { libsane } = require('..');
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 2,
+    },
+});
+
+const handles = [];
+
+test('sane_handle_open', async () => {
+    const l = await lib;
+    expect(await l.sane_handle_open('test:0')).toMatchObject({
+        status: l.SANE_STATUS.INVAL,
+        handle: null,
+    });
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    for (const name of ['test:0', 'test:1']) {
+        const res = await l.sane_handle_open(name);
+        expect(res).toMatchObject({
+            status: l.SANE_STATUS.GOOD,
+            handle: expect.toBePositive(),
+        });
+        handles.push(res.handle);
+    }
+    expect(handles[0]).not.toBe(handles[1]);
+    expect(l.sane_get_state()).toMatchObject({ open: false, handles: 2 });
+});
+
+test('sane_handle_get_parameters', async () => {
+    const l = await lib;
+    for (const handle of handles) {
+        expect(await l.sane_handle_get_parameters(handle)).toMatchObject({
+            status: l.SANE_STATUS.GOOD,
+            parameters: expect.toBeObject(),
+        });
+    }
+    expect(await l.sane_handle_get_parameters(999)).toEqual({
+        status: l.SANE_STATUS.INVAL,
+        parameters: null,
+    });
+});
+
+test('sane_handle_fast_get_parameters', async () => {
+    const l = await lib;
+    const { parameters } = await l.sane_handle_get_parameters(handles[0]);
+    const res = await l.sane_handle_fast_get_parameters(handles[0]);
+    expect(res.status).toBe(l.SANE_STATUS.GOOD);
+    expect(res.parameters).toEqual(parameters);
+    expect(res.data).toBeNull();
+    expect((await l.sane_handle_fast_get_parameters(999)).status).toBe(l.SANE_STATUS.INVAL);
+});
+
+test('sane_handle_fast_control_option', async () => {
+    const l = await lib;
+    const { options } = await l.sane_handle_get_all_options(handles[1]);
+    const resolution = options.find((o) => o.descriptor.name === 'resolution');
+    const set = await l.sane_handle_fast_control_option_set_value(handles[1], resolution.index, 150);
+    expect(set.status).toBe(l.SANE_STATUS.GOOD);
+    expect(set.info).toMatchObject({ RELOAD_OPTIONS: false });
+    const get = await l.sane_handle_fast_control_option_get_value(handles[1], resolution.index);
+    expect(get.value).toBe(150);
+    expect((await l.sane_handle_fast_control_option_get_value(handles[1], 0)).value).toBe(options.length);
+});
+
+test('sane_scheduler_stats', async () => {
+    const l = await lib;
+    const before = l.sane_scheduler_stats();
+    // calls on different handles run at the same time, sync calls without
+    // a resource don't throw while they are in progress
+    const promises = handles.map((handle) => l.sane_handle_get_parameters(handle));
+    expect(l.sane_get_state()).toMatchObject({ handles: 2 });
+    expect(l.sane_scheduler_stats()).toMatchObject({ running: 2, queued: 0 });
+    // calls on the same handle wait
+    promises.push(l.sane_handle_get_parameters(handles[0]));
+    expect(l.sane_scheduler_stats()).toMatchObject({ queued: 1 });
+    expect(l.sane_scheduler_stats().resources[`device:${handles[0]}`]).toEqual({ running: 1, queued: 1 });
+    await Promise.all(promises);
+    expect(l.sane_scheduler_stats()).toMatchObject({
+        calls: before.calls + 3,
+        running: 0,
+        queued: 0,
+        waits: before.waits + 1,
+        resources: {},
+    });
+});
+
+test('sane_handle_get_all_options', async () => {
+    const l = await lib;
+    const res1 = await l.sane_handle_get_all_options(handles[0]);
+    expect(res1).toMatchObject({
+        status: l.SANE_STATUS.GOOD,
+        options: expect.toBeArray(),
+    });
+    expect(res1.options).toBeArrayOfSize(res1.options[0].value);
+    expect(res1.options[0]).toMatchObject({ index: 0, descriptor: expect.toBeObject() });
+    // descriptors are cached
+    const res2 = await l.sane_handle_get_all_options(handles[0]);
+    expect(res2.options[1].descriptor).toBe(res1.options[1].descriptor);
+});
+
+test('sane_handle_set_option', async () => {
+    const l = await lib;
+    const { options } = await l.sane_handle_get_all_options(handles[0]);
+    const find = (name) => options.find((o) => o.descriptor.name === name);
+    const resolution = find('resolution');
+    const res1 = await l.sane_handle_set_option(handles[0], resolution.index, 100);
+    expect(res1).toMatchObject({
+        status: l.SANE_STATUS.GOOD,
+        info: expect.toBeObject(),
+        count: options.length,
+    });
+    expect(res1.changes).toContainEqual({ ...resolution, value: 100 });
+    // enabling the test options reloads (and activates) other options
+    const enable = find('enable-test-options');
+    const res2 = await l.sane_handle_set_option(handles[0], enable.index, true);
+    expect(res2).toMatchObject({ status: l.SANE_STATUS.GOOD, info: { RELOAD_OPTIONS: true } });
+    expect(res2.changes.length).toBeGreaterThan(1);
+    expect(res2.changes.map((o) => o.index)).not.toContain(0);
+    const { options: after } = await l.sane_handle_get_all_options(handles[0]);
+    for (const option of res2.changes) {
+        expect(after[option.index]).toEqual(option);
+    }
+});
+
+test('sane_handle_close', async () => {
+    const l = await lib;
+    for (const handle of handles) {
+        expect(await l.sane_handle_close(handle)).toEqual({ status: l.SANE_STATUS.GOOD });
+        expect(await l.sane_handle_close(handle)).toEqual({ status: l.SANE_STATUS.INVAL });
+    }
+    expect(l.sane_get_state()).toMatchObject({ handles: 0 });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
@@ -0,0 +1,94 @@
+// const { webusb } = require('usb');
+const { libsane } = require('..');
+
+const lib = libsane();
+
+const parameters = {
+    format: 0, // GRAY
+    last_frame: true,
+    bytes_per_line: 20,
+    pixels_per_line: 20,
+    lines: 3,
+    depth: 8,
+};
+
+test('sane_image_begin', async () => {
+    const l = await lib;
+    expect(l.sane_image_begin({ ...parameters, depth: 4 }, l.SANE_IMAGE_LAYOUT.RGBA)).toEqual({
+        status: l.SANE_STATUS.UNSUPPORTED,
+    });
+    expect(l.sane_image_begin(parameters, l.SANE_IMAGE_LAYOUT.RGBA)).toEqual({
+        status: l.SANE_STATUS.GOOD,
+    });
+});
+
+test('sane_image_convert', async () => {
+    const l = await lib;
+    const data = Uint8Array.from({ length: 30 }, (_, i) => i);
+    // 1.5 lines, half a line is kept for the next call
+    const res1 = l.sane_image_convert(data);
+    expect(res1).toMatchObject({ status: l.SANE_STATUS.GOOD, line: 0, lines: 1 });
+    expect(Array.from(res1.data.subarray(0, 8))).toEqual([0, 0, 0, 255, 1, 1, 1, 255]);
+    expect(res1.data.length).toBe(80);
+    const res2 = l.sane_image_convert(data);
+    expect(res2).toMatchObject({ status: l.SANE_STATUS.GOOD, line: 1, lines: 2 });
+    expect(Array.from(res2.data.subarray(0, 4))).toEqual([20, 20, 20, 255]);
+    expect(Array.from(res2.data.subarray(80, 84))).toEqual([10, 10, 10, 255]);
+});
+
+test('sane_image_end', async () => {
+    const l = await lib;
+    expect(l.sane_image_end()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_image_end()).toEqual({ status: l.SANE_STATUS.INVAL });
+});
+
+test('sane_fast_image_convert', async () => {
+    const l = await lib;
+    expect(l.sane_image_begin(parameters, l.SANE_IMAGE_LAYOUT.GRAY)).toEqual({ status: l.SANE_STATUS.GOOD });
+    // not in the module memory, copied to the staging buffer
+    const data = Uint8Array.from({ length: 30 }, (_, i) => i);
+    const res = l.sane_fast_image_convert(data);
+    expect(res.status).toBe(l.SANE_STATUS.GOOD);
+    expect(res.line).toBe(0);
+    expect(res.lines).toBe(1);
+    expect(Array.from(res.data)).toEqual(Array.from(data.subarray(0, 20)));
+    expect(res.parameters).toBeNull();
+    expect(l.sane_image_end()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_fast_image_convert(data).status).toBe(l.SANE_STATUS.INVAL);
+});
+
+test('sane_image_preview', async () => {
+    const l = await lib;
+    expect(l.sane_image_preview(5, 3)).toEqual({ status: l.SANE_STATUS.INVAL });
+    expect(l.sane_image_preview_get()).toEqual({ status: l.SANE_STATUS.INVAL, levels: null });
+    expect(l.sane_image_begin(parameters, l.SANE_IMAGE_LAYOUT.GRAY)).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_image_preview(5, 3)).toEqual({ status: l.SANE_STATUS.GOOD });
+    const data = Uint8Array.from({ length: 60 }, (_, i) => i);
+    // 4x4 areas, only 3 lines, the level is complete with the last line
+    expect(l.sane_image_convert(data.subarray(0, 40)).lines).toBe(2);
+    expect(l.sane_image_preview_get().levels.map(level => level.lines)).toEqual([0, 0, 0]);
+    expect(l.sane_image_convert(data.subarray(40)).lines).toBe(1);
+    const { status, levels } = l.sane_image_preview_get();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    expect(levels.map(({ width, height, lines }) => [width, height, lines])).toEqual([[5, 1, 1], [3, 1, 1], [2, 1, 1]]);
+    expect(Array.from(levels[0].data)).toEqual([22, 26, 30, 34, 38]);
+    expect(Array.from(levels[1].data)).toEqual([24, 32, 38]);
+    expect(Array.from(levels[2].data)).toEqual([28, 38]);
+    expect(l.sane_image_end()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('sane_encoder', async () => {
+    const l = await lib;
+    const begin = l.sane_encoder_begin(parameters, l.SANE_IMAGE_FORMAT.PNG, {});
+    expect(begin.status).toBe(l.SANE_STATUS.GOOD);
+    // png signature + IHDR
+    expect(Array.from(begin.data.subarray(0, 8))).toEqual([0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a]);
+    expect(begin.data.length).toBe(8 + 25);
+    expect(l.sane_encoder_begin(parameters, l.SANE_IMAGE_FORMAT.PNG, {})).toEqual({ status: l.SANE_STATUS.INVAL, data: null });
+    expect(l.sane_encoder_write(new Uint8Array(30)).status).toBe(l.SANE_STATUS.GOOD);
+    const end = l.sane_encoder_end();
+    expect(end.status).toBe(l.SANE_STATUS.GOOD);
+    // ends with IEND
+    expect(Array.from(end.data.subarray(-8, -4))).toEqual([0x49, 0x45, 0x4e, 0x44]);
+    expect(l.sane_encoder_end()).toEqual({ status: l.SANE_STATUS.INVAL, data: null });
+});
@@ -0,0 +1,68 @@
+// const { webusb } = require('usb');
+const { libsane, ScanImageReader } = require('..');
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 1,
+        readBufferSize: 64 * 1024,
+        memoryLimit: 256 * 1024 * 1024,
+    },
+});
+
+test('sane_get_memory_stats', async () => {
+    const l = await lib;
+    const stats = l.sane_get_memory_stats();
+    expect(stats).toEqual({
+        heap_size: expect.toBePositive(),
+        malloc_used: expect.toBePositive(),
+        malloc_footprint: expect.toBePositive(),
+        malloc_footprint_peak: expect.toBePositive(),
+        read_buffer_size: 64 * 1024,
+    });
+    expect(stats.heap_size).toBe(l.HEAPU8.length);
+    expect(stats.malloc_footprint_peak).toBeGreaterThanOrEqual(stats.malloc_footprint);
+});
+
+test('memoryLimit', async () => {
+    const l = await lib;
+    const limit = 256 * 1024 * 1024;
+    const page = 64 * 1024;
+    const memory = l.wasmMemory;
+    expect(memory.buffer.byteLength).toBeGreaterThanOrEqual(l.SANE_WASM_INITIAL_MEMORY);
+    expect(l.sane_get_memory_stats().heap_size).toBeLessThanOrEqual(limit);
+    // one page past the limit
+    expect(() => memory.grow((limit - memory.buffer.byteLength) / page + 1)).toThrow(RangeError);
+    expect(memory.buffer.byteLength).toBeLessThanOrEqual(limit);
+});
+
+test('ScanImageReader (sink, no full image)', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    await l.sane_get_devices();
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+
+    let bytes = 0;
+    let closed = false;
+    const sink = new WritableStream({
+        write(chunk) {
+            expect(chunk).toBeInstanceOf(Uint8Array);
+            bytes += chunk.length;
+            return new Promise(resolve => setTimeout(resolve, 1)); // slow sink
+        },
+        close() {
+            closed = true;
+        },
+    });
+    const reader = new ScanImageReader(l, { keepImage: false, sink });
+    let image = false;
+    reader.on('image', () => { image = true; });
+    const { status, parameters, promise } = await reader.start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    await promise;
+    expect(bytes).toBe(parameters.lines * parameters.pixels_per_line * 4);
+    expect(closed).toBeTrue();
+    expect(image).toBeFalse();
+
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
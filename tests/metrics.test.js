@@ -0,0 +1,67 @@
+// const { webusb } = require('usb');
+const { libsane, ScanDataReader } = require('..');
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 1,
+        metrics: true,
+    },
+});
+
+test('sane_get_metrics (disabled)', async () => {
+    const l = await libsane();
+    expect(l.sane_get_metrics()).toBeNull();
+});
+
+test('sane_get_metrics', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    await l.sane_get_devices();
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    let res;
+    do {
+        res = await l.sane_read_blocking();
+    } while (res.status === l.SANE_STATUS.GOOD);
+    expect(res.status).toBe(l.SANE_STATUS.EOF);
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+
+    const metrics = l.sane_get_metrics();
+    expect(metrics.functions.sane_read).toMatchObject({
+        calls: expect.toBePositive(),
+        total_ms: expect.toBeNumber(),
+        histogram_us: expect.toBeArrayOfSize(24),
+    });
+    expect(metrics.functions.sane_start.calls).toBe(1);
+    expect(metrics.proxy.queue.calls).toBePositive();
+    expect(metrics.reads.bytes).toBePositive();
+    expect(metrics.reads.histogram_bytes.reduce((a, b) => a + b)).toBe(metrics.reads.calls);
+    expect(metrics.usb).toEqual({});
+});
+
+test('sane_reset_metrics', async () => {
+    const l = await lib;
+    l.sane_reset_metrics();
+    const metrics = l.sane_get_metrics();
+    expect(metrics.functions).toEqual({});
+    expect(metrics.reads).toMatchObject({ calls: 0, bytes: 0, empty: 0 });
+});
+
+test('ScanDataReader timing', async () => {
+    const l = await lib;
+    const reader = new ScanDataReader(l);
+    let timing = null;
+    reader.on('stop', (parameters, error, t) => { timing = t; });
+    const { status, promise } = await reader.start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    await promise;
+    expect(timing).toBe(reader.timing);
+    expect(timing).toEqual({
+        reads: expect.toBePositive(),
+        read_ms: expect.toBeNumber(),
+        convert_ms: 0,
+        fire_ms: expect.toBeNumber(),
+    });
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
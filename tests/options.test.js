@@ -0,0 +1,67 @@
+// const { webusb } = require('usb');
+const { libsane, ScanOptions } = require('..');
+
+const lib = libsane({
+    sane: {
+        debugTestDevices: 1,
+    },
+});
+
+test('sane_control_options_apply', async () => {
+    const l = await lib;
+    expect(await l.sane_control_options_apply({ mode: 'Gray' })).toEqual({ status: l.SANE_STATUS.INVAL, options: null });
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+    // scan area first and mode last, applied the other way around
+    const res = await l.sane_control_options_apply({
+        'br-x': 100,
+        resolution: 150,
+        'not-an-option': 1,
+        depth: 'eight',
+        mode: 'Color',
+    });
+    expect(res).toMatchObject({
+        status: l.SANE_STATUS.GOOD,
+        info: expect.toBeObject(),
+        values: { 'br-x': 100, resolution: 150, mode: 'Color', depth: expect.toBeNumber(), 'not-an-option': null },
+        inexact: expect.toBeArray(),
+        rejected: [
+            { name: 'depth', status: l.SANE_STATUS.INVAL },
+            { name: 'not-an-option', status: l.SANE_STATUS.INVAL },
+        ],
+    });
+    expect(res.options.length).toBe(res.options[0].value);
+    expect(res.options.find(o => o.descriptor.name === 'mode').value).toBe('Color');
+    // same as reading all options again
+    expect((await l.sane_get_all_options()).options).toEqual(res.options);
+});
+
+test('sane_get_option_descriptor (cached)', async () => {
+    const l = await lib;
+    const { options } = await l.sane_get_all_options();
+    const { status, option_descriptor } = l.sane_get_option_descriptor(0);
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    expect(option_descriptor).toBe(options[0].descriptor);
+    expect(l.sane_get_option_descriptor(options.length)).toEqual({ status: l.SANE_STATUS.GOOD, option_descriptor: null });
+    // reloaded on the device thread after RELOAD_OPTIONS
+    const enable = options.find(o => o.descriptor.name === 'enable-test-options');
+    const bool = options.find(o => o.descriptor.name === 'bool-soft-select-soft-detect');
+    expect(bool.descriptor.cap.INACTIVE).toBe(true);
+    const { info } = await l.sane_control_option_set_value(enable.index, true);
+    expect(info.RELOAD_OPTIONS).toBe(true);
+    expect(l.sane_get_option_descriptor(bool.index).option_descriptor.cap.INACTIVE).toBe(false);
+    expect((await l.sane_control_option_set_value(enable.index, false)).info.RELOAD_OPTIONS).toBe(true);
+});
+
+test('ScanOptions.apply', async () => {
+    const l = await lib;
+    const opts = await ScanOptions.get(l);
+    const { status, updated, values, rejected } = await opts.apply({ resolution: 75, mode: 'Gray' });
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    expect(values).toEqual({ mode: 'Gray', resolution: 75 });
+    expect(rejected).toEqual([]);
+    expect(updated.resolution.value).toBe(75);
+    expect(opts.resolution.value).not.toBe(75);
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
@@ -0,0 +1,21 @@
+// const { webusb } = require('usb');
+const { libsane } = require('..');
+
+test('sane_startup_timing', async () => {
+    const l = await libsane();
+    expect(l.sane_startup_timing()).toEqual({
+        fetch_ms: expect.toBeNumber(),
+        compile_ms: expect.toBeNumber(),
+        instantiate_ms: expect.toBeNumber(),
+        init_ms: expect.toBeNumber(),
+        total_ms: expect.toBePositive(),
+        cached: false,
+    });
+});
+
+test('sane_startup_timing (cached module)', async () => {
+    const l = await libsane();
+    expect(l.sane_startup_timing()).toMatchObject({ compile_ms: 0, cached: true });
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
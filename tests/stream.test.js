@@ -0,0 +1,130 @@
+// const { webusb } = require('usb');
+const { libsane, ScanStream, ScanDataReader } = require('..');
+
+// small read buffers and only 2 slots, so that a scan takes many reads
+const lib = libsane({ sane: { debugTestDevices: 1, readIdleMax: 50, readBufferSlots: 2, readBufferSize: 16 * 1024 } });
+
+test('sane_open', async () => {
+    const l = await lib;
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    await l.sane_get_devices();
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('ScanStream (byob reader)', async () => {
+    const l = await lib;
+    const { status, parameters, stream } = await new ScanStream(l).start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    const reader = stream.getReader({ mode: 'byob' });
+    let buffer = new ArrayBuffer(1000);
+    let bytes = 0;
+    for (;;) {
+        const { done, value } = await reader.read(new Uint8Array(buffer));
+        if (done) {
+            break;
+        }
+        expect(value.length).toBeLessThanOrEqual(1000);
+        bytes += value.length;
+        buffer = value.buffer; // reuse the (transferred) buffer
+    }
+    expect(bytes).toBe(parameters.bytes_per_line * parameters.lines);
+});
+
+test('ScanStream (cancel)', async () => {
+    const l = await lib;
+    const { stream } = await new ScanStream(l, { chunkSize: 100 }).start();
+    const reader = stream.getReader();
+    const { value } = await reader.read();
+    expect(value.length).toBeLessThanOrEqual(100);
+    await reader.cancel();
+    // the device can scan again
+    const res = await new ScanStream(l).start();
+    expect(res.status).toBe(l.SANE_STATUS.GOOD);
+    await res.stream.cancel();
+});
+
+test('ScanStream (node)', async () => {
+    const l = await lib;
+    const { status, parameters, stream } = await new ScanStream(l).startNode();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    let bytes = 0;
+    for await (const chunk of stream) {
+        bytes += chunk.length;
+    }
+    expect(bytes).toBe(parameters.bytes_per_line * parameters.lines);
+});
+
+test('sane_read_stream (slots)', async () => {
+    const l = await lib;
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    const { parameters } = await l.sane_get_parameters();
+    expect(l.sane_read_stream_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    // hold both slots, the helper thread has nowhere to read to
+    const held = [];
+    let bytes = 0;
+    for (let i = 0; i < 2; i++) {
+        const res = await l.sane_read_stream_next();
+        expect(res).toMatchObject({ status: l.SANE_STATUS.GOOD, slot: expect.toBeNumber() });
+        held.push(res.slot);
+        bytes += res.data.length;
+    }
+    let stats = l.sane_read_stream_stats();
+    for (let i = 0; i < 100 && !stats.stalls; i++) {
+        await new Promise(resolve => setTimeout(resolve, 10));
+        stats = l.sane_read_stream_stats();
+    }
+    expect(stats).toMatchObject({ active: true, slots: 2, filled: 0, reads: 2, bytes });
+    expect(stats.stalls).toBeGreaterThan(0);
+    // release them, reading resumes until EOF
+    held.forEach(slot => expect(l.sane_read_stream_release(slot)).toEqual({ status: l.SANE_STATUS.GOOD }));
+    expect(l.sane_read_stream_release(held[0])).toEqual({ status: l.SANE_STATUS.INVAL }); // already released
+    for (;;) {
+        const res = await l.sane_read_stream_next();
+        if (res.status !== l.SANE_STATUS.GOOD) {
+            expect(res.status).toBe(l.SANE_STATUS.EOF);
+            break;
+        }
+        bytes += res.data.length;
+        l.sane_read_stream_release(res.slot);
+    }
+    expect(bytes).toBe(parameters.bytes_per_line * parameters.lines);
+    stats = l.sane_read_stream_stats();
+    expect(stats.reads).toBeGreaterThan(2);
+    expect(stats.bytes).toBe(bytes);
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(l.sane_read_stream_stats()).toMatchObject({ active: false, slots: 0 });
+});
+
+test('ScanDataReader (blocking read mode)', async () => {
+    const l = await lib;
+    const reader = new ScanDataReader(l, { readMode: 'blocking' });
+    let bytes = 0;
+    reader.on('data', (parameters, data) => {
+        bytes += data.length;
+    });
+    const { status, parameters, promise } = await reader.start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    await promise;
+    expect(bytes).toBe(parameters.bytes_per_line * parameters.lines);
+});
+
+test('sane_read_blocking (cancel)', async () => {
+    const l = await lib;
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    const res = await l.sane_read_blocking();
+    expect(res.status).toBe(l.SANE_STATUS.GOOD);
+    expect(res.data.length).toBeGreaterThan(0);
+    // sane_cancel doesn't wait behind the read, the read returns early
+    const read = l.sane_read_blocking();
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect((await read).status).toBeOneOf([l.SANE_STATUS.GOOD, l.SANE_STATUS.CANCELLED]);
+    // the device can scan again
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('sane_close', async () => {
+    const l = await lib;
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
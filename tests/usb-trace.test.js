@@ -0,0 +1,120 @@
+const { libsane, USBRecorder, USBReplay } = require('..');
+
+// minimal WebUSB device
+const mockDevice = () => ({
+    vendorId: 0x04a9,
+    productId: 0x1234,
+    deviceClass: 0,
+    deviceSubclass: 0,
+    deviceProtocol: 0,
+    deviceVersionMajor: 1,
+    deviceVersionMinor: 0,
+    deviceVersionSubminor: 0,
+    usbVersionMajor: 2,
+    usbVersionMinor: 0,
+    usbVersionSubminor: 0,
+    manufacturerName: 'Mock',
+    productName: 'Scanner',
+    serialNumber: '0001',
+    configuration: { configurationValue: 1 },
+    configurations: [{
+        configurationValue: 1,
+        configurationName: null,
+        interfaces: [{
+            interfaceNumber: 0,
+            alternates: [{
+                alternateSetting: 0,
+                interfaceClass: 255,
+                interfaceSubclass: 0,
+                interfaceProtocol: 0,
+                interfaceName: null,
+                endpoints: [
+                    { endpointNumber: 1, direction: 'in', type: 'bulk', packetSize: 512 },
+                    { endpointNumber: 2, direction: 'out', type: 'bulk', packetSize: 512 },
+                ],
+            }],
+        }],
+    }],
+    opened: false,
+    async open() { this.opened = true; },
+    async claimInterface(n) {
+        if (n !== 0) {
+            throw new DOMException("Interface not found.", 'NotFoundError');
+        }
+    },
+    async transferOut(endpoint, data) { return { status: 'ok', bytesWritten: data.byteLength }; },
+    async transferIn(endpoint, length) { return { status: 'ok', data: new DataView(Uint8Array.from({ length }, (_, i) => i).buffer) }; },
+});
+
+const device = mockDevice();
+const usb = { getDevices: async () => [device] };
+
+let trace;
+
+test('USBRecorder', async () => {
+    const recorder = new USBRecorder(usb);
+    const [d] = await recorder.getDevices();
+    expect((await recorder.getDevices())[0]).toBe(d);
+    await d.open();
+    expect(d.opened).toBe(true);
+    await d.claimInterface(0);
+    await expect(d.claimInterface(1)).rejects.toMatchObject({ name: 'NotFoundError' });
+    expect(await d.transferOut(2, Uint8Array.of(1, 2, 3))).toEqual({ status: 'ok', bytesWritten: 3 });
+    expect(new Uint8Array((await d.transferIn(1, 4)).data.buffer)).toEqual(Uint8Array.of(0, 1, 2, 3));
+    trace = recorder.trace({ test: true });
+    expect(trace).toMatchObject({ format: 'sane-wasm-usb-trace', version: 1, meta: { test: true } });
+    expect(trace.devices).toEqual([expect.objectContaining({ vendorId: 0x04a9, productId: 0x1234, configuration: 1 })]);
+    expect(trace.calls.map(call => call[3])).toEqual(['open', 'claimInterface', 'claimInterface', 'transferOut', 'transferIn']);
+    expect(trace.calls[2][5]).toEqual({ $error: { name: 'NotFoundError', message: "Interface not found." } });
+    expect(trace.calls[3][4]).toEqual([2, { $b64: 'AQID' }]);
+    expect(trace.calls[4][5]).toEqual({ status: 'ok', data: { $b64: 'AAECAw==' } });
+});
+
+test('USBReplay', async () => {
+    const replay = new USBReplay(JSON.parse(JSON.stringify(trace)), { speed: Infinity });
+    const [d] = await replay.getDevices();
+    expect(d).toMatchObject({ vendorId: 0x04a9, productId: 0x1234, serialNumber: '0001', opened: false });
+    expect(d.configuration.interfaces[0]).toMatchObject({ interfaceNumber: 0, claimed: false });
+    expect(await replay.requestDevice({ filters: [{ vendorId: 0x04a9 }] })).toBe(d);
+    await expect(replay.requestDevice({ filters: [{ vendorId: 1 }] })).rejects.toMatchObject({ name: 'NotFoundError' });
+    await d.open();
+    expect(d.opened).toBe(true);
+    await d.claimInterface(0);
+    expect(d.configuration.interfaces[0].claimed).toBe(true);
+    await expect(d.claimInterface(1)).rejects.toMatchObject({ name: 'NotFoundError' });
+    // different data, not on the trace
+    await expect(d.transferOut(2, Uint8Array.of(3, 2, 1))).rejects.toMatchObject({ name: 'NetworkError' });
+    expect(replay.mismatches).toEqual([{ device: 0, method: 'transferOut', args: [2, { $b64: 'AwIB' }] }]);
+    expect(await d.transferOut(2, Uint8Array.of(1, 2, 3))).toEqual({ status: 'ok', bytesWritten: 3 });
+    const res = await d.transferIn(1, 4);
+    expect(res.data).toBeInstanceOf(DataView);
+    expect(new Uint8Array(res.data.buffer)).toEqual(Uint8Array.of(0, 1, 2, 3));
+    expect(replay.remaining).toBe(0);
+});
+
+test('USBReplay (not strict)', async () => {
+    const replay = new USBReplay(trace, { speed: Infinity, strict: false });
+    const [d] = await replay.getDevices();
+    expect(await d.transferOut(2, Uint8Array.of(3, 2, 1))).toEqual({ status: 'ok', bytesWritten: 3 });
+    // calls of the same device are matched in order, skipping the others
+    expect(replay.remaining).toBe(4);
+});
+
+test('USBReplay (timing)', async () => {
+    const slow = JSON.parse(JSON.stringify(trace));
+    slow.calls[4][1] = 50;
+    const replay = new USBReplay(slow, { speed: 2 });
+    const [d] = await replay.getDevices();
+    const t0 = performance.now();
+    await d.transferIn(1, 4);
+    expect(performance.now() - t0).toBeGreaterThanOrEqual(20);
+});
+
+test('usb option', async () => {
+    const replay = new USBReplay({ ...trace, devices: [], calls: [] });
+    const l = await libsane({ sane: { usb: replay } });
+    expect(globalThis.navigator.usb).toBe(replay);
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_get_devices()).toEqual({ status: l.SANE_STATUS.GOOD, devices: [] });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
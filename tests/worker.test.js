@@ -0,0 +1,49 @@
+// const { webusb } = require('usb');
+const { libsaneWorker } = require('..');
+
+const lib = libsaneWorker({ sane: { debugTestDevices: 1 } });
+
+afterAll(async () => {
+    (await lib).terminate();
+});
+
+test('libsaneWorker', async () => {
+    const l = await lib;
+    expect(l.SANE_STATUS.GOOD).toBe(0);
+    expect(l.SANE_WASM_VERSION).toBeString();
+    expect(l.sane_fast_read).toBeUndefined();
+    expect(await l.sane_init()).toMatchObject({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_get_state()).toMatchObject({ initialized: true });
+    expect(await l.sane_get_devices()).toMatchObject({ status: l.SANE_STATUS.GOOD, devices: expect.toBeArrayOfSize(1) });
+    expect(await l.sane_open('test:0')).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('libsaneWorker (sane_read)', async () => {
+    const l = await lib;
+    expect(await l.sane_start()).toEqual({ status: l.SANE_STATUS.GOOD });
+    const res = await l.sane_read_blocking();
+    expect(res.status).toBe(l.SANE_STATUS.GOOD);
+    expect(res.data).toBeInstanceOf(Uint8Array);
+    expect(await l.sane_cancel()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
+
+test('libsaneWorker (ScanImageReader)', async () => {
+    const l = await lib;
+    const reader = l.createReader('image');
+    let lines = 0;
+    let image = null;
+    reader.on('line', (parameters, data) => {
+        expect(data).toBeInstanceOf(Uint8ClampedArray);
+        lines += data.length / (parameters.pixels_per_line * 4);
+    });
+    reader.on('image', (parameters, data) => {
+        image = data;
+    });
+    const { status, parameters, promise } = await reader.start();
+    expect(status).toBe(l.SANE_STATUS.GOOD);
+    await promise;
+    expect(lines).toBe(parameters.lines);
+    expect(image.length).toBe(parameters.lines * parameters.pixels_per_line * 4);
+    expect(await l.sane_close()).toEqual({ status: l.SANE_STATUS.GOOD });
+    expect(await l.sane_exit()).toEqual({ status: l.SANE_STATUS.GOOD });
+});
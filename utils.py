@@ -302,6 +302,47 @@ def command_usb_backends(args):
     print(' '.join(lst))
 
 
+def read_usb_ids(file):
+    # (vendor, product) pairs, as lowercase 4 digit hex
+    for dev in read_desc_devices(file):
+        ids = dev.get('usbid', [])
+        if len(ids) == 2 and all(re.match(r'^0x[0-9a-fA-F]{1,4}$', i) for i in ids):
+            yield tuple('%04x' % int(i, 16) for i in ids)
+
+
+def command_usb_ids(args):
+    backends = args.backends.split(',')
+    lst = []
+    for f in os.scandir(dir_desc):
+        backend = os.path.splitext(f.name)[0]
+        if backend in backends:
+            for vendor, product in sorted(set(read_usb_ids(f))):
+                lst.append('%s:%s:%s' % (vendor, product, backend))
+    lst.sort()
+    print(' '.join(lst))
+
+
+def command_usb_families(args):
+    # group the backends by the manufacturer with most USB devices on each
+    # backend, the family name is the first word of the manufacturer name
+    backends = args.backends.split(',')
+    families = {}
+    for f in os.scandir(dir_desc):
+        backend = os.path.splitext(f.name)[0]
+        if backend not in backends:
+            continue
+        mfgs = {}
+        for dev, mfg, _, _ in read_desc_devices(f, True):
+            if 'interface' in dev and dev['interface'].find('USB') != -1:
+                name = re.sub(r'[^a-z0-9]', '', mfg['name'].split()[0].lower())
+                mfgs[name] = mfgs.get(name, 0) + 1
+        if mfgs:
+            family = max(sorted(mfgs), key=lambda k: mfgs[k])
+            families.setdefault(family, []).append(backend)
+    for family in sorted(families):
+        print(family, ' '.join(sorted(families[family])))
+
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(prog='util')
 
@@ -318,6 +359,14 @@ if __name__ == '__main__':
     parser_usb_backends.add_argument(
         '-e', '--exclude', help='backends to exclude')
     parser_usb_backends.set_defaults(fn=command_usb_backends)
+    parser_usb_ids = subparsers.add_parser('usb-ids', description='')
+    parser_usb_ids.add_argument(
+        '-b', '--backends', required=True, help='backends to list')
+    parser_usb_ids.set_defaults(fn=command_usb_ids)
+    parser_usb_families = subparsers.add_parser('usb-families', description='')
+    parser_usb_families.add_argument(
+        '-b', '--backends', required=True, help='backends to group')
+    parser_usb_families.set_defaults(fn=command_usb_families)
 
     args = parser.parse_args()
     args.fn(args)